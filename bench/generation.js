@@ -1,4 +1,4 @@
-const { LlamaContext, LlamaSampler } = require('..')
+const { LlamaContext, LlamaSampler, binding } = require('..')
 
 module.exports = function runGenerationBench (model) {
   const ctx = new LlamaContext(model, { contextSize: 2048, batchSize: 512 })
@@ -33,6 +33,14 @@ module.exports = function runGenerationBench (model) {
   }
 
   const genTime = Date.now() - genStart
+  const perf = ctx.getPerf()
+  const samplerPerf = sampler.getPerf()
+
+  // Fused native loop: sample/accept/decode without per-token JS crossings
+  ctx.clearMemory()
+  const fusedStart = Date.now()
+  const fused = binding.generate(ctx._handle, sampler._handle, tokens, { maxTokens })
+  const fusedTime = Date.now() - fusedStart
 
   sampler.free()
   ctx.free()
@@ -44,6 +52,13 @@ module.exports = function runGenerationBench (model) {
     generatedTokens: generated.length,
     genTimeMs: genTime,
     genSpeed: generated.length / genTime * 1000,
-    firstTokenMs: firstTokenTime
+    firstTokenMs: firstTokenTime,
+    nativePromptMs: perf.promptMs,
+    nativeEvalMs: perf.evalMs,
+    nativeEvalTokens: perf.evalTokens,
+    sampleMs: samplerPerf.sampleMs,
+    fusedTokens: fused.tokens.length,
+    fusedTimeMs: fusedTime,
+    fusedSpeed: fused.tokens.length / fusedTime * 1000
   }
 }
@@ -0,0 +1,89 @@
+const { systemInfo } = require('..')
+const fs = require('bare-fs')
+const os = require('bare-os')
+const path = require('bare-path')
+const { spawnSync } = require('bare-subprocess')
+
+const RESULTS_DIR = path.join(__dirname, 'results')
+
+function getLlamaVersion () {
+  try {
+    const result = spawnSync('git', ['-C', 'vendor/llama.cpp', 'describe', '--tags'])
+    if (result.status === 0) return result.stdout.toString().trim()
+    return 'unknown'
+  } catch {
+    return 'unknown'
+  }
+}
+
+function getMetadata () {
+  return {
+    date: new Date().toISOString(),
+    llamaVersion: getLlamaVersion(),
+    systemInfo: systemInfo(),
+    platform: os.platform(),
+    arch: os.arch(),
+    hostname: os.hostname()
+  }
+}
+
+function saveResult (name, result) {
+  if (!fs.existsSync(RESULTS_DIR)) {
+    fs.mkdirSync(RESULTS_DIR, { recursive: true })
+  }
+
+  const timestamp = new Date().toISOString().replace(/[:.]/g, '-')
+  const filename = `${name}-${timestamp}.json`
+  fs.writeFileSync(
+    path.join(RESULTS_DIR, filename),
+    JSON.stringify(result, null, 2)
+  )
+
+  // Append to history
+  const historyPath = path.join(RESULTS_DIR, `${name}-history.jsonl`)
+  fs.appendFileSync(historyPath, JSON.stringify(result) + '\n')
+
+  return filename
+}
+
+// Past results for name, oldest first. Unparseable lines are skipped.
+function loadHistory (name) {
+  const historyPath = path.join(RESULTS_DIR, `${name}-history.jsonl`)
+  if (!fs.existsSync(historyPath)) return []
+
+  const entries = []
+  for (const line of fs.readFileSync(historyPath, 'utf8').split('\n')) {
+    if (!line.trim()) continue
+    try {
+      entries.push(JSON.parse(line))
+    } catch {}
+  }
+  return entries
+}
+
+function median (values) {
+  const sorted = values.slice().sort((a, b) => a - b)
+  const mid = sorted.length >> 1
+  return sorted.length % 2 ? sorted[mid] : (sorted[mid - 1] + sorted[mid]) / 2
+}
+
+// Compare each case of result against the median p50 of the last `window`
+// runs with the same fingerprint (machine, build and model). All cases are
+// latencies, so a p50 more than `threshold` above the baseline is flagged.
+function compare (result, history, opts = {}) {
+  const { threshold = 0.1, window = 5 } = opts
+  const previous = history.filter((entry) => entry.fingerprint === result.fingerprint && entry.cases)
+
+  const rows = []
+  for (const [key, stats] of Object.entries(result.cases)) {
+    const past = previous.filter((entry) => entry.cases[key]).slice(-window)
+    if (past.length === 0) continue
+
+    const baseline = median(past.map((entry) => entry.cases[key].p50))
+    const ratio = stats.p50 / baseline
+    rows.push({ key, baseline, current: stats.p50, ratio, runs: past.length, regression: ratio > 1 + threshold })
+  }
+  return rows
+}
+
+module.exports = { RESULTS_DIR, getMetadata, saveResult, loadHistory, compare }
@@ -1,11 +1,8 @@
-const { LlamaModel, setQuiet, systemInfo } = require('..')
+const { LlamaModel, setQuiet } = require('..')
 const { getModelInfo } = require('../lib/ollama-models')
-const os = require('bare-os')
-const fs = require('bare-fs')
-const path = require('bare-path')
-const { spawnSync } = require('bare-subprocess')
 const runGenerationBench = require('./generation')
 const runEmbeddingsBench = require('./embeddings')
+const { getMetadata, saveResult } = require('./history')
 
 setQuiet(true)
 
@@ -18,47 +15,6 @@ function resolveModel (name) {
   return info.path
 }
 
-function getLlamaVersion () {
-  try {
-    const result = spawnSync('git', ['-C', 'vendor/llama.cpp', 'describe', '--tags'])
-    if (result.status === 0) return result.stdout.toString().trim()
-    return 'unknown'
-  } catch {
-    return 'unknown'
-  }
-}
-
-function getMetadata () {
-  return {
-    date: new Date().toISOString(),
-    llamaVersion: getLlamaVersion(),
-    systemInfo: systemInfo(),
-    platform: os.platform(),
-    arch: os.arch(),
-    hostname: os.hostname()
-  }
-}
-
-function saveResult (name, result) {
-  const resultsDir = path.join(__dirname, 'results')
-  if (!fs.existsSync(resultsDir)) {
-    fs.mkdirSync(resultsDir, { recursive: true })
-  }
-
-  const timestamp = new Date().toISOString().replace(/[:.]/g, '-')
-  const filename = `${name}-${timestamp}.json`
-  fs.writeFileSync(
-    path.join(resultsDir, filename),
-    JSON.stringify(result, null, 2)
-  )
-
-  // Append to history
-  const historyPath = path.join(resultsDir, `${name}-history.jsonl`)
-  fs.appendFileSync(historyPath, JSON.stringify(result) + '\n')
-
-  return filename
-}
-
 console.log('# bare-llama.cpp Benchmark\n')
 
 const metadata = getMetadata()
@@ -89,6 +45,8 @@ if (genModelPath) {
   console.log(`  Prompt processing: ${genResult.promptSpeed.toFixed(1)} tok/s (${genResult.promptTokens} tokens in ${genResult.promptTimeMs} ms)`)
   console.log(`  Generation speed:  ${genResult.genSpeed.toFixed(1)} tok/s (${genResult.generatedTokens} tokens in ${genResult.genTimeMs} ms)`)
   console.log(`  Time to first token: ${genResult.firstTokenMs} ms`)
+  console.log(`  Native timings: prompt ${genResult.nativePromptMs.toFixed(1)} ms, eval ${genResult.nativeEvalMs.toFixed(1)} ms (${genResult.nativeEvalTokens} tokens), sampling ${genResult.sampleMs.toFixed(1)} ms`)
+  console.log(`  Fused native loop: ${genResult.fusedSpeed.toFixed(1)} tok/s (prompt + ${genResult.fusedTokens} tokens in ${genResult.fusedTimeMs} ms)`)
   console.log(`  Saved: ${filename}`)
 } else {
   console.log('Generation model not available:', GENERATION_MODEL)
@@ -116,6 +74,7 @@ if (embModelPath) {
   console.log(`\nEmbedding Results:`)
   console.log(`  New context:    ${embResult.newContextRate.toFixed(1)} emb/s`)
   console.log(`  Reuse context:  ${embResult.reuseContextRate.toFixed(1)} emb/s`)
+  console.log(`  Batched:        ${embResult.batchRate.toFixed(1)} emb/s`)
   console.log(`  Speedup:        ${embResult.speedup.toFixed(2)}x`)
   console.log(`  Per embedding:  ${embResult.perEmbeddingMs.toFixed(2)} ms`)
   console.log(`  Saved: ${filename}`)
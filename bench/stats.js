@@ -0,0 +1,51 @@
+const { hrtime } = require('..')
+
+// Value at fraction p of sorted samples, interpolating between neighbours
+function percentile (sorted, p) {
+  if (sorted.length === 0) return NaN
+  const rank = (sorted.length - 1) * p
+  const lo = Math.floor(rank)
+  const hi = Math.ceil(rank)
+  return sorted[lo] + (sorted[hi] - sorted[lo]) * (rank - lo)
+}
+
+function summarize (samples) {
+  const sorted = Float64Array.from(samples).sort()
+  let sum = 0
+  for (const x of sorted) sum += x
+  return {
+    n: sorted.length,
+    min: sorted[0],
+    p50: percentile(sorted, 0.5),
+    p95: percentile(sorted, 0.95),
+    p99: percentile(sorted, 0.99),
+    max: sorted[sorted.length - 1],
+    mean: sum / sorted.length
+  }
+}
+
+// Time fn (milliseconds per call) after warmup calls. Runs at least
+// iterations times and keeps going until minTimeMs has passed, so fast calls
+// get enough samples for stable tail percentiles. setup runs untimed before
+// every call.
+function measure (fn, opts = {}) {
+  const { warmup = 3, iterations = 20, minTimeMs = 200, maxIterations = 10000, setup = null } = opts
+
+  for (let i = 0; i < warmup; i++) {
+    if (setup) setup()
+    fn()
+  }
+
+  const samples = []
+  const start = hrtime()
+  while (samples.length < maxIterations && (samples.length < iterations || hrtime() - start < minTimeMs)) {
+    if (setup) setup()
+    const t0 = hrtime()
+    fn()
+    samples.push(hrtime() - t0)
+  }
+
+  return summarize(samples)
+}
+
+module.exports = { percentile, summarize, measure }
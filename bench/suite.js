@@ -0,0 +1,261 @@
+const { command, flag, summary, description } = require('paparam')
+const { LlamaModel, LlamaContext, LlamaSampler, Detokenizer, setQuiet, binding } = require('..')
+const { getModelInfo } = require('../lib/ollama-models')
+const os = require('bare-os')
+const path = require('bare-path')
+const { syntheticModel } = require('./synthetic')
+const { measure } = require('./stats')
+const { getMetadata, saveResult, loadHistory, compare } = require('./history')
+
+setQuiet(true)
+
+const TEXT = 'The quick brown fox jumps over the lazy dog. Machine learning models process natural language text in batches of tokens. '
+const QUERY = 'What does the fox do?'
+
+function textOfLength (chars) {
+  return TEXT.repeat(Math.ceil(chars / TEXT.length)).slice(0, chars)
+}
+
+function resolveModel (nameOrPath) {
+  if (nameOrPath.endsWith('.gguf') || nameOrPath.includes('/')) return nameOrPath
+  const info = getModelInfo(nameOrPath)
+  if (!info) throw new Error(`Model ${nameOrPath} not found`)
+  return info.path
+}
+
+function sweeps (quick, maxThreads) {
+  const threads = [...new Set([1, Math.max(1, maxThreads >> 1), maxThreads])]
+  return {
+    textLengths: quick ? [100, 2000] : [100, 1000, 10000],
+    tokenCounts: quick ? [64, 512] : [64, 512, 4096],
+    promptLengths: quick ? [32, 256] : [32, 128, 512, 2048],
+    batchSizes: quick ? [64, 512] : [32, 128, 512],
+    threads: quick ? [maxThreads] : threads,
+    widths: quick ? [1, 4] : [1, 4, 16]
+  }
+}
+
+// Runs the cases of one group, printing each as it finishes
+class Suite {
+  constructor (measureOpts) {
+    this.measureOpts = measureOpts
+    this.cases = {}
+  }
+
+  run (key, fn, opts = {}) {
+    const stats = measure(fn, { ...this.measureOpts, ...opts })
+    this.cases[key] = stats
+    console.log(`  ${key.padEnd(48)} p50 ${fmt(stats.p50)}  p95 ${fmt(stats.p95)}  p99 ${fmt(stats.p99)}  (n=${stats.n})`)
+  }
+}
+
+function fmt (ms) {
+  return (ms < 1 ? ms.toFixed(4) : ms.toFixed(2)).padStart(9) + ' ms'
+}
+
+function benchTokenizer (suite, model, sw) {
+  console.log('\nTokenizer')
+
+  for (const chars of sw.textLengths) {
+    const text = textOfLength(chars)
+    suite.run(`tokenize/chars=${chars}`, () => model.tokenize(text, true))
+  }
+
+  const texts = sw.textLengths.flatMap((chars) => new Array(32).fill(textOfLength(chars)))
+  for (const threads of sw.threads) {
+    suite.run(`tokenizeBatch/texts=${texts.length},threads=${threads}`, () => model.tokenizeBatch(texts, { threads }))
+  }
+
+  for (const n of sw.tokenCounts) {
+    const tokens = model.tokenize(textOfLength(n * 8), false).subarray(0, n)
+    suite.run(`detokenize/tokens=${n}`, () => model.detokenize(tokens))
+
+    const detok = new Detokenizer(model)
+    suite.run(`detokenizer/tokens=${n}`, () => {
+      for (let i = 0; i < tokens.length; i++) detok.push(tokens[i])
+      detok.flush()
+    })
+    detok.free()
+  }
+}
+
+function benchDecode (suite, model, sw) {
+  console.log('\nDecode')
+
+  const maxPrompt = sw.promptLengths[sw.promptLengths.length - 1]
+  const prompt = model.tokenize(textOfLength(maxPrompt * 8), true).subarray(0, maxPrompt)
+
+  for (const threads of sw.threads) {
+    for (let b = 0; b < sw.batchSizes.length; b++) {
+      const batchSize = sw.batchSizes[b]
+      const ctx = new LlamaContext(model, { contextSize: maxPrompt + 64, batchSize, threads })
+
+      for (const n of sw.promptLengths) {
+        // A larger batch than the prompt measures the same thing again
+        if (b > 0 && sw.batchSizes[b - 1] >= n) continue
+        const tokens = prompt.subarray(0, n)
+        suite.run(`prompt/tokens=${n},batch=${batchSize},threads=${threads}`, () => ctx.decode(tokens), {
+          setup: () => ctx.clearMemory()
+        })
+      }
+
+      ctx.free()
+    }
+
+    // One new token at a fixed position: with reusePrefix, a repeated prompt
+    // decodes only its last token again
+    const ctx = new LlamaContext(model, { contextSize: 128, threads })
+    const tokens = prompt.subarray(0, 32)
+    ctx.decode(tokens)
+    suite.run(`eval/threads=${threads}`, () => ctx.decode(tokens, { reusePrefix: true }))
+    ctx.free()
+  }
+
+  // Batch width: one scheduler step decodes a token for every active sequence
+  const stepPrompt = prompt.subarray(0, 8)
+  for (const width of sw.widths) {
+    const ctx = new LlamaContext(model, { contextSize: width * 96, sequences: width })
+    const sched = binding.createScheduler(ctx._handle)
+    const samplers = Array.from({ length: width }, () => new LlamaSampler(model, { temp: 0 }))
+    const active = new Map()
+
+    const step = () => {
+      const { finished } = binding.schedulerStep(sched)
+      for (const id of finished) active.delete(id)
+    }
+
+    // New requests are prefilled by an untimed step, so the timed step only
+    // decodes one token per sequence
+    const refill = () => {
+      let submitted = false
+      for (const sampler of samplers) {
+        if ([...active.values()].includes(sampler)) continue
+        active.set(binding.schedulerSubmit(sched, sampler._handle, stepPrompt, { maxTokens: 64 }), sampler)
+        submitted = true
+      }
+      if (submitted) step()
+    }
+
+    suite.run(`step/width=${width}`, step, { setup: refill })
+
+    binding.freeScheduler(sched)
+    for (const sampler of samplers) sampler.free()
+    ctx.free()
+  }
+}
+
+function benchEmbeddings (suite, model, sw) {
+  console.log('\nEmbeddings')
+
+  const maxWidth = sw.widths[sw.widths.length - 1]
+  const texts = Array.from({ length: maxWidth }, (_, i) => textOfLength(64 + (i % 4) * 32))
+  const ctx = new LlamaContext(model, { contextSize: 2048, batchSize: 2048, embeddings: true, poolingType: 1, sequences: maxWidth })
+
+  for (const width of sw.widths) {
+    const batch = texts.slice(0, width)
+    suite.run(`embedBatch/width=${width}`, () => ctx.embedBatch(batch))
+  }
+
+  ctx.free()
+}
+
+function benchRerank (suite, model, sw) {
+  console.log('\nRerank')
+
+  const maxWidth = sw.widths[sw.widths.length - 1]
+  const documents = Array.from({ length: maxWidth }, (_, i) => textOfLength(64 + (i % 4) * 32))
+  const ctx = new LlamaContext(model, { contextSize: 4096, batchSize: 4096, embeddings: true, poolingType: 4, sequences: maxWidth })
+
+  for (const width of sw.widths) {
+    const docs = documents.slice(0, width)
+    suite.run(`rerank/docs=${width}`, () => ctx.rerank(QUERY, docs))
+  }
+
+  ctx.free()
+}
+
+function report (rows, threshold) {
+  if (rows.length === 0) {
+    console.log('\nNo previous runs with this fingerprint to compare against.')
+    return 0
+  }
+
+  console.log(`\nComparison with history (p50, regression above +${(threshold * 100).toFixed(0)}%)`)
+  let regressions = 0
+  for (const row of rows) {
+    const change = ((row.ratio - 1) * 100).toFixed(1).padStart(6)
+    const flag = row.regression ? '  REGRESSION' : ''
+    console.log(`  ${row.key.padEnd(48)} ${fmt(row.baseline)} -> ${fmt(row.current)} ${change}%${flag}`)
+    if (row.regression) regressions++
+  }
+
+  console.log(regressions ? `\n${regressions} regression(s) against the last runs.` : '\nNo regressions.')
+  return regressions
+}
+
+const main = command(
+  'suite',
+  summary('Benchmark tokenizer, decode, embeddings and rerank over parameter sweeps'),
+  description('Runs offline against a generated synthetic model unless --model is given. Reports p50/p95/p99 per case and compares against bench/results/suite-history.jsonl.'),
+  flag('--model <path>', 'GGUF path or Ollama model name (default: synthetic model)'),
+  flag('--embedding-model <path>', 'Model for the embedding cases (default: --model)'),
+  flag('--rerank-model <path>', 'Reranker for the rerank cases (skipped if not given)'),
+  flag('--quick', 'Smaller sweeps'),
+  flag('--threads <n>', 'Largest thread count to sweep (default: all cores)'),
+  flag('--min-time <ms>', 'Minimum time per case').default('200'),
+  flag('--threshold <fraction>', 'p50 increase flagged as a regression').default('0.1'),
+  flag('--window <runs>', 'Previous runs in the baseline').default('5'),
+  flag('--discard', 'Do not save this run to the history'),
+  flag('--fail-on-regression', 'Exit with status 1 if any case regressed'),
+  (cmd) => {
+    const flags = cmd.flags
+    const maxThreads = Number(flags.threads) || os.availableParallelism()
+    const sw = sweeps(!!flags.quick, maxThreads)
+    const threshold = Number(flags.threshold)
+
+    const modelPath = flags.model ? resolveModel(flags.model) : syntheticModel()
+    const modelId = flags.model || path.basename(modelPath)
+
+    const metadata = getMetadata()
+    console.log('# bare-llama.cpp Benchmark Suite\n')
+    console.log('Date:', metadata.date)
+    console.log('llama.cpp:', metadata.llamaVersion)
+    console.log('Platform:', metadata.platform, metadata.arch)
+    console.log('Model:', modelId)
+
+    const suite = new Suite({ minTimeMs: Number(flags.minTime) })
+    const model = new LlamaModel(modelPath)
+    benchTokenizer(suite, model, sw)
+    benchDecode(suite, model, sw)
+
+    if (!flags.embeddingModel) benchEmbeddings(suite, model, sw)
+    model.free()
+
+    if (flags.embeddingModel) {
+      const embModel = new LlamaModel(resolveModel(flags.embeddingModel))
+      benchEmbeddings(suite, embModel, sw)
+      embModel.free()
+    }
+
+    if (flags.rerankModel) {
+      const rerankModel = new LlamaModel(resolveModel(flags.rerankModel))
+      benchRerank(suite, rerankModel, sw)
+      rerankModel.free()
+    }
+
+    // Runs are only comparable on the same machine, build and models
+    const fingerprint = [
+      metadata.platform, metadata.arch, metadata.hostname, metadata.llamaVersion,
+      modelId, flags.embeddingModel || '', flags.rerankModel || ''
+    ].join('|')
+
+    const result = { ...metadata, fingerprint, model: modelId, quick: !!flags.quick, cases: suite.cases }
+    const rows = compare(result, loadHistory('suite'), { threshold, window: Number(flags.window) })
+    const regressions = report(rows, threshold)
+
+    if (!flags.discard) console.log(`\nSaved: ${saveResult('suite', result)}`)
+    if (regressions && flags.failOnRegression) Bare.exitCode = 1
+  }
+)
+
+main.parse()
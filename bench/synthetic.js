@@ -0,0 +1,333 @@
+const fs = require('fs')
+const os = require('os')
+const path = require('path')
+
+// Writes a tiny llama-architecture GGUF with random F32 weights and a small
+// SentencePiece vocab (byte fallback plus English word pieces), so the
+// benchmarks run offline. Outputs are meaningless, but every tensor has the
+// shape llama.cpp expects, so decode, embedding and tokenizer costs scale like
+// a real model of the same dimensions. syntheticAdapter() writes a matching
+// LoRA adapter so adapters can be tested without downloads too.
+
+const DEFAULTS = {
+  embd: 256,
+  layers: 4,
+  heads: 4,
+  headsKv: 2,
+  ff: 512,
+  contextLength: 4096,
+  seed: 1
+}
+
+const WORDS = [
+  'the', 'quick', 'brown', 'fox', 'jumps', 'over', 'lazy', 'dog', 'and', 'of',
+  'to', 'in', 'is', 'that', 'for', 'it', 'with', 'as', 'was', 'on',
+  'model', 'token', 'context', 'memory', 'batch', 'language', 'learning', 'data',
+  'machine', 'neural', 'network', 'text', 'process', 'natural', 'training'
+]
+
+const GGUF_TYPE_UINT32 = 4
+const GGUF_TYPE_INT32 = 5
+const GGUF_TYPE_FLOAT32 = 6
+const GGUF_TYPE_BOOL = 7
+const GGUF_TYPE_STRING = 8
+const GGUF_TYPE_ARRAY = 9
+
+const GGML_TYPE_F32 = 0
+const ALIGNMENT = 32
+
+function utf8 (str) {
+  const bytes = []
+  for (const ch of str) {
+    const c = ch.codePointAt(0)
+    if (c < 0x80) {
+      bytes.push(c)
+    } else if (c < 0x800) {
+      bytes.push(0xc0 | (c >> 6), 0x80 | (c & 0x3f))
+    } else if (c < 0x10000) {
+      bytes.push(0xe0 | (c >> 12), 0x80 | ((c >> 6) & 0x3f), 0x80 | (c & 0x3f))
+    } else {
+      bytes.push(0xf0 | (c >> 18), 0x80 | ((c >> 12) & 0x3f), 0x80 | ((c >> 6) & 0x3f), 0x80 | (c & 0x3f))
+    }
+  }
+  return new Uint8Array(bytes)
+}
+
+// Little-endian byte writer
+class Writer {
+  constructor () {
+    this.chunks = []
+    this.length = 0
+  }
+
+  bytes (data) {
+    this.chunks.push(data)
+    this.length += data.byteLength
+  }
+
+  u32 (n) {
+    const b = new Uint8Array(4)
+    new DataView(b.buffer).setUint32(0, n, true)
+    this.bytes(b)
+  }
+
+  i32 (n) {
+    const b = new Uint8Array(4)
+    new DataView(b.buffer).setInt32(0, n, true)
+    this.bytes(b)
+  }
+
+  u64 (n) {
+    const b = new Uint8Array(8)
+    const view = new DataView(b.buffer)
+    view.setUint32(0, n % 0x100000000, true)
+    view.setUint32(4, Math.floor(n / 0x100000000), true)
+    this.bytes(b)
+  }
+
+  f32 (x) {
+    const b = new Uint8Array(4)
+    new DataView(b.buffer).setFloat32(0, x, true)
+    this.bytes(b)
+  }
+
+  string (str) {
+    const b = utf8(str)
+    this.u64(b.byteLength)
+    this.bytes(b)
+  }
+
+  pad (alignment) {
+    const n = (alignment - (this.length % alignment)) % alignment
+    if (n > 0) this.bytes(new Uint8Array(n))
+  }
+
+  concat () {
+    const out = new Uint8Array(this.length)
+    let offset = 0
+    for (const chunk of this.chunks) {
+      out.set(chunk, offset)
+      offset += chunk.byteLength
+    }
+    return out
+  }
+}
+
+function buildVocab () {
+  const tokens = ['<unk>', '<s>', '</s>']
+  const scores = [0, 0, 0]
+  const types = [2, 3, 3] // unknown, control, control
+
+  for (let b = 0; b < 256; b++) {
+    tokens.push('<0x' + b.toString(16).toUpperCase().padStart(2, '0') + '>')
+    scores.push(0)
+    types.push(6) // byte
+  }
+
+  // SentencePiece merges adjacent pieces only if the result is in the vocab,
+  // so every prefix of a word is added, scored by length
+  const seen = new Set(tokens)
+  const add = (piece) => {
+    if (seen.has(piece)) return
+    seen.add(piece)
+    tokens.push(piece)
+    scores.push(-1000 + [...piece].length)
+    types.push(1) // normal
+  }
+
+  add('▁')
+  for (let c = 0x21; c < 0x7f; c++) add(String.fromCharCode(c))
+  for (const word of WORDS) {
+    const piece = '▁' + word
+    for (let i = 2; i <= piece.length; i++) add(piece.slice(0, i))
+  }
+
+  return { tokens, scores, types }
+}
+
+// Deterministic weights (mulberry32)
+function random (seed) {
+  let a = seed >>> 0
+  return function () {
+    a = (a + 0x6d2b79f5) >>> 0
+    let t = a
+    t = Math.imul(t ^ (t >>> 15), t | 1)
+    t ^= t + Math.imul(t ^ (t >>> 7), t | 61)
+    return ((t ^ (t >>> 14)) >>> 0) / 4294967296
+  }
+}
+
+function buildTensors (opts, nVocab) {
+  const headDim = opts.embd / opts.heads
+  const embdKv = headDim * opts.headsKv
+  const tensors = [
+    { name: 'token_embd.weight', dims: [opts.embd, nVocab] },
+    { name: 'output_norm.weight', dims: [opts.embd], norm: true },
+    { name: 'output.weight', dims: [opts.embd, nVocab] }
+  ]
+
+  for (let i = 0; i < opts.layers; i++) {
+    tensors.push(
+      { name: `blk.${i}.attn_norm.weight`, dims: [opts.embd], norm: true },
+      { name: `blk.${i}.attn_q.weight`, dims: [opts.embd, opts.embd] },
+      { name: `blk.${i}.attn_k.weight`, dims: [opts.embd, embdKv] },
+      { name: `blk.${i}.attn_v.weight`, dims: [opts.embd, embdKv] },
+      { name: `blk.${i}.attn_output.weight`, dims: [opts.embd, opts.embd] },
+      { name: `blk.${i}.ffn_norm.weight`, dims: [opts.embd], norm: true },
+      { name: `blk.${i}.ffn_gate.weight`, dims: [opts.embd, opts.ff] },
+      { name: `blk.${i}.ffn_down.weight`, dims: [opts.ff, opts.embd] },
+      { name: `blk.${i}.ffn_up.weight`, dims: [opts.embd, opts.ff] }
+    )
+  }
+
+  return tensors
+}
+
+function encodeModel (opts) {
+  const vocab = buildVocab()
+  const tensors = buildTensors(opts, vocab.tokens.length)
+  return encodeGguf([
+    ['general.architecture', GGUF_TYPE_STRING, 'llama'],
+    ['general.name', GGUF_TYPE_STRING, 'synthetic'],
+    ['general.alignment', GGUF_TYPE_UINT32, ALIGNMENT],
+    ['llama.context_length', GGUF_TYPE_UINT32, opts.contextLength],
+    ['llama.embedding_length', GGUF_TYPE_UINT32, opts.embd],
+    ['llama.block_count', GGUF_TYPE_UINT32, opts.layers],
+    ['llama.feed_forward_length', GGUF_TYPE_UINT32, opts.ff],
+    ['llama.attention.head_count', GGUF_TYPE_UINT32, opts.heads],
+    ['llama.attention.head_count_kv', GGUF_TYPE_UINT32, opts.headsKv],
+    ['llama.rope.dimension_count', GGUF_TYPE_UINT32, opts.embd / opts.heads],
+    ['llama.attention.layer_norm_rms_epsilon', GGUF_TYPE_FLOAT32, 1e-5],
+    ['llama.vocab_size', GGUF_TYPE_UINT32, vocab.tokens.length],
+    ['tokenizer.ggml.model', GGUF_TYPE_STRING, 'llama'],
+    ['tokenizer.ggml.tokens', GGUF_TYPE_ARRAY, [GGUF_TYPE_STRING, vocab.tokens]],
+    ['tokenizer.ggml.scores', GGUF_TYPE_ARRAY, [GGUF_TYPE_FLOAT32, vocab.scores]],
+    ['tokenizer.ggml.token_type', GGUF_TYPE_ARRAY, [GGUF_TYPE_INT32, vocab.types]],
+    ['tokenizer.ggml.unknown_token_id', GGUF_TYPE_UINT32, 0],
+    ['tokenizer.ggml.bos_token_id', GGUF_TYPE_UINT32, 1],
+    ['tokenizer.ggml.eos_token_id', GGUF_TYPE_UINT32, 2],
+    ['tokenizer.ggml.add_bos_token', GGUF_TYPE_BOOL, true]
+  ], tensors, opts.seed)
+}
+
+// LoRA on the attention query and output projections. llama.cpp checks
+// lora_a as [n_in, rank] and lora_b as [rank, n_out] against the base tensor.
+function encodeAdapter (opts) {
+  const tensors = []
+  for (let i = 0; i < opts.layers; i++) {
+    for (const name of ['attn_q', 'attn_output']) {
+      tensors.push(
+        { name: `blk.${i}.${name}.weight.lora_a`, dims: [opts.embd, opts.rank] },
+        { name: `blk.${i}.${name}.weight.lora_b`, dims: [opts.rank, opts.embd] }
+      )
+    }
+  }
+
+  return encodeGguf([
+    ['general.architecture', GGUF_TYPE_STRING, 'llama'],
+    ['general.type', GGUF_TYPE_STRING, 'adapter'],
+    ['general.alignment', GGUF_TYPE_UINT32, ALIGNMENT],
+    ['adapter.type', GGUF_TYPE_STRING, 'lora'],
+    ['adapter.lora.alpha', GGUF_TYPE_FLOAT32, opts.rank]
+  ], tensors, opts.seed + 1)
+}
+
+// F32 tensors with norms set to one and other weights random
+function encodeGguf (kvs, tensors, seed) {
+  const w = new Writer()
+  const value = (type, v) => {
+    switch (type) {
+      case GGUF_TYPE_UINT32: w.u32(v); break
+      case GGUF_TYPE_INT32: w.i32(v); break
+      case GGUF_TYPE_FLOAT32: w.f32(v); break
+      case GGUF_TYPE_BOOL: w.bytes(new Uint8Array([v ? 1 : 0])); break
+      case GGUF_TYPE_STRING: w.string(v); break
+      case GGUF_TYPE_ARRAY: {
+        const [elemType, items] = v
+        w.u32(elemType)
+        w.u64(items.length)
+        for (const item of items) value(elemType, item)
+        break
+      }
+    }
+  }
+
+  w.bytes(utf8('GGUF'))
+  w.u32(3)
+  w.u64(tensors.length)
+  w.u64(kvs.length)
+
+  for (const [key, type, v] of kvs) {
+    w.string(key)
+    w.u32(type)
+    value(type, v)
+  }
+
+  let offset = 0
+  for (const tensor of tensors) {
+    const elements = tensor.dims.reduce((a, b) => a * b, 1)
+    tensor.offset = offset
+    tensor.size = elements * 4
+    offset += Math.ceil(tensor.size / ALIGNMENT) * ALIGNMENT
+
+    w.string(tensor.name)
+    w.u32(tensor.dims.length)
+    for (const d of tensor.dims) w.u64(d)
+    w.u32(GGML_TYPE_F32)
+    w.u64(tensor.offset)
+  }
+
+  w.pad(ALIGNMENT)
+
+  const rand = random(seed)
+  for (const tensor of tensors) {
+    const data = new Float32Array(tensor.size / 4)
+    if (tensor.norm) {
+      data.fill(1)
+    } else {
+      // Scaled so activations stay in range through the layers
+      const scale = 1 / Math.sqrt(tensor.dims[0])
+      for (let i = 0; i < data.length; i++) data[i] = (rand() * 2 - 1) * scale
+    }
+    w.bytes(new Uint8Array(data.buffer))
+    w.pad(ALIGNMENT)
+  }
+
+  return w.concat()
+}
+
+function writeOnce (file, encode) {
+  if (!fs.existsSync(file)) {
+    const tmp = file + '.tmp'
+    fs.writeFileSync(tmp, encode())
+    fs.renameSync(tmp, file)
+  }
+  return file
+}
+
+function modelName (opts) {
+  return `${opts.embd}x${opts.layers}-h${opts.heads}-kv${opts.headsKv}-ff${opts.ff}-c${opts.contextLength}-s${opts.seed}`
+}
+
+// Path of the synthetic model for opts, writing it on first use. Files are
+// named by their options so different shapes don't collide.
+function syntheticModel (opts = {}) {
+  opts = { ...DEFAULTS, ...opts }
+  if (opts.embd % opts.heads !== 0 || opts.heads % opts.headsKv !== 0) {
+    throw new Error('embd must be divisible by heads, and heads by headsKv')
+  }
+
+  const name = `bare-llama-synthetic-${modelName(opts)}.gguf`
+  return writeOnce(path.join(opts.dir || os.tmpdir(), name), () => encodeModel(opts))
+}
+
+// Path of a LoRA adapter (rank 4 by default) for the model syntheticModel()
+// writes with the same opts
+function syntheticAdapter (opts = {}) {
+  opts = { ...DEFAULTS, rank: 4, ...opts }
+
+  const name = `bare-llama-synthetic-${modelName(opts)}-lora-r${opts.rank}.gguf`
+  return writeOnce(path.join(opts.dir || os.tmpdir(), name), () => encodeAdapter(opts))
+}
+
+module.exports = { syntheticModel, syntheticAdapter, DEFAULTS }
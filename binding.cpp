@@ -3,13 +3,16 @@
 #endif
 
 #include <assert.h>
+#include <math.h>
 #include <stdlib.h>
 #include <string.h>
 #include <bare.h>
 #include <js.h>
 #include <utf.h>
+#include <uv.h>
 #include <llama.h>
-#include <gguf.h>
+#include <ggml-cpu.h>
+#include <ggml-backend.h>
 #include "sampling.h"
 #include "log.h"
 
@@ -18,23 +21,121 @@ static js_type_tag_t llama_model_type_tag = {0x4c4c414d41, 0x4d4f44454c};  // "L
 static js_type_tag_t llama_context_type_tag = {0x4c4c414d41, 0x435458};    // "LLAMA CTX"
 static js_type_tag_t llama_sampler_type_tag = {0x4c4c414d41, 0x53414d50};  // "LLAMA SAMP"
 
-// Wrapper structs to prevent double-free
+typedef struct model_entry_s model_entry_t;
+typedef struct stream_s stream_t;
+
+static void model_registry_release(model_entry_t *entry);
+
+// Wrapper structs to prevent double-free. entry is set when the model is
+// shared through the model registry.
 typedef struct {
   struct llama_model *ptr;
+  model_entry_t *entry;
 } model_wrap_t;
 
+// CPU threadpool shared by several contexts. A ggml threadpool runs one graph
+// at a time, so lock serializes decodes across the contexts using it. The
+// threads stop once the pool was freed (or collected) and no context uses it;
+// the wrapper itself lives until the JS handle is finalized.
+typedef struct {
+  struct ggml_threadpool *ptr;
+  int32_t n_threads;
+  int32_t n_contexts;
+  bool released;
+  bool finalized;
+  uv_mutex_t lock;
+} threadpool_wrap_t;
+
+// LoRA adapter. Like a threadpool, the adapter is freed once its handle was
+// released and no context uses it. A model shared through the registry is
+// pinned by entry until then, as other handles may free theirs. An unshared
+// model is owned by one handle: model_ref keeps it alive until the adapter
+// handle is finalized, after which the model frees the adapter itself.
+typedef struct {
+  struct llama_adapter_lora *ptr;
+  struct llama_model *model;
+  model_entry_t *entry;
+  model_wrap_t *owner;
+  js_ref_t *model_ref;
+  int32_t n_contexts;
+  bool released;
+  bool finalized;
+} adapter_wrap_t;
+
+// Compiled grammar handle. model_ref keeps the vocab alive.
+typedef struct {
+  struct llama_sampler *ptr;
+  const struct llama_vocab *vocab;
+  js_ref_t *model_ref;
+} grammar_wrap_t;
+
+// busy is set while async work owns the handle; free_pending defers a free()
+// that arrives in the meantime until the work completes. output_base is the
+// index of the first token of the last decoded chunk, so sample indices can
+// refer to positions in the caller's token array. cached mirrors the tokens
+// held in sequence 0 of the KV cache, for prefix reuse.
 typedef struct {
   struct llama_context *ptr;
+  bool busy;
+  bool free_pending;
+  bool embeddings;
+  size_t output_base;
+  llama_token *cached;
+  size_t n_cached;
+  size_t cap_cached;
+  uint64_t cache_hit_tokens;
+  uint64_t cache_miss_tokens;
+  // Context shift: when a decode would overflow sequence 0, drop shift_discard
+  // tokens after the first shift_keep (0 = half of the rest) and slide the
+  // remainder down instead of failing
+  bool shift;
+  uint32_t shift_keep;
+  uint32_t shift_discard;
+  uint64_t shifts;
+  uint64_t shifted_tokens;
+  // Tokens of the history shifted out from after the kept prefix: cached[i]
+  // for i >= shift_keep is token i + shift_offset of the full history
+  size_t shift_offset;
+  // Threadpools owned by the context, when affinity options were given
+  struct ggml_threadpool *threadpool;
+  struct ggml_threadpool *threadpool_batch;
+  // Shared threadpool attached with the threadPool option
+  threadpool_wrap_t *shared_pool;
+  // KV cache element types, for getKvCacheSize
+  enum ggml_type type_k;
+  enum ggml_type type_v;
+  // Weak references to zero-copy output views, detached when outputs change
+  js_ref_t **views;
+  size_t n_views;
+  size_t cap_views;
+  // LoRA adapters applied with setAdapters
+  adapter_wrap_t **adapters;
+  float *adapter_scales;
+  size_t n_adapters;
+  // Counters for getPerf, since the last resetPerf
+  uint64_t decode_calls;
+  uint64_t decode_tokens;
+  uint64_t decode_ns;
+  uint32_t decode_max_batch;
+  // Stream of the generateStream running on this context, for generateCancel
+  stream_t *stream;
 } context_wrap_t;
 
 typedef struct {
   struct llama_sampler *ptr;
+  bool busy;
+  bool free_pending;
 } sampler_wrap_t;
 
 // Forward declarations
 static void finalize_model(js_env_t *env, void *data, void *hint);
 static void finalize_context(js_env_t *env, void *data, void *hint);
 static void finalize_sampler(js_env_t *env, void *data, void *hint);
+static void finalize_scheduler(js_env_t *env, void *data, void *hint);
+static void finalize_thread_pool(js_env_t *env, void *data, void *hint);
+static void finalize_detokenizer(js_env_t *env, void *data, void *hint);
+static void finalize_adapter(js_env_t *env, void *data, void *hint);
+static void finalize_grammar(js_env_t *env, void *data, void *hint);
 
 // Helper to throw JS error
 static js_value_t *throw_error(js_env_t *env, const char *msg) {
@@ -42,324 +143,5921 @@ static js_value_t *throw_error(js_env_t *env, const char *msg) {
   return NULL;
 }
 
-// readGgufMeta(path: string, key: string): string | null
-// Reads GGUF metadata without loading the full model
-static js_value_t *
-fn_read_gguf_meta(js_env_t *env, js_callback_info_t *info) {
+// Helper to get string property
+static char *get_string_property(js_env_t *env, js_value_t *opts, const char *name) {
   int err;
-  size_t argc = 2;
-  js_value_t *argv[2];
+  bool has_prop;
+  js_value_t *val;
 
-  err = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
-  if (err < 0) return throw_error(env, "Failed to get callback info");
+  err = js_has_named_property(env, opts, name, &has_prop);
+  if (err != 0 || !has_prop) return NULL;
 
-  if (argc < 2) return throw_error(env, "Path and key required");
+  err = js_get_named_property(env, opts, name, &val);
+  if (err != 0) return NULL;
 
-  // Get path
-  size_t path_len;
-  err = js_get_value_string_utf8(env, argv[0], NULL, 0, &path_len);
-  if (err < 0) return throw_error(env, "Invalid path");
+  size_t len;
+  err = js_get_value_string_utf8(env, val, NULL, 0, &len);
+  if (err != 0) return NULL;
 
-  char *path = (char *)malloc(path_len + 1);
-  if (!path) return throw_error(env, "Memory allocation failed");
+  char *str = (char *)malloc(len + 1);
+  if (!str) return NULL;
 
-  err = js_get_value_string_utf8(env, argv[0], (utf8_t *)path, path_len + 1, NULL);
-  if (err < 0) {
-    free(path);
-    return throw_error(env, "Failed to read path");
+  err = js_get_value_string_utf8(env, val, (utf8_t *)str, len + 1, NULL);
+  if (err != 0) {
+    free(str);
+    return NULL;
   }
 
-  // Get key
-  size_t key_len;
-  err = js_get_value_string_utf8(env, argv[1], NULL, 0, &key_len);
-  if (err < 0) {
-    free(path);
-    return throw_error(env, "Invalid key");
-  }
+  return str;
+}
 
-  char *key = (char *)malloc(key_len + 1);
-  if (!key) {
-    free(path);
-    return throw_error(env, "Memory allocation failed");
-  }
+// Helper to read a string argument; caller frees
+static char *get_string_value(js_env_t *env, js_value_t *val) {
+  size_t len;
+  if (js_get_value_string_utf8(env, val, NULL, 0, &len) != 0) return NULL;
 
-  err = js_get_value_string_utf8(env, argv[1], (utf8_t *)key, key_len + 1, NULL);
-  if (err < 0) {
-    free(path);
-    free(key);
-    return throw_error(env, "Failed to read key");
-  }
+  char *str = (char *)malloc(len + 1);
+  if (!str) return NULL;
 
-  // Open GGUF file and read metadata
-  struct gguf_init_params params = { .no_alloc = true, .ctx = NULL };
-  struct gguf_context *gguf = gguf_init_from_file(path, params);
-  free(path);
+  if (js_get_value_string_utf8(env, val, (utf8_t *)str, len + 1, NULL) != 0) {
+    free(str);
+    return NULL;
+  }
+  return str;
+}
 
-  if (!gguf) {
-    free(key);
-    js_value_t *null_val;
-    js_get_null(env, &null_val);
-    return null_val;
+// Detach every zero-copy view of the context's outputs. Call on the JS thread
+// before anything that may decode, clear or free the context.
+static void context_invalidate_views(js_env_t *env, context_wrap_t *wrap) {
+  for (size_t i = 0; i < wrap->n_views; i++) {
+    js_value_t *buffer;
+    if (js_get_reference_value(env, wrap->views[i], &buffer) == 0 && buffer) {
+      js_detach_arraybuffer(env, buffer);
+    }
+    js_delete_reference(env, wrap->views[i]);
   }
+  wrap->n_views = 0;
+}
 
-  // Find the key
-  int key_id = gguf_find_key(gguf, key);
-  free(key);
+// Stop the threads and free the wrapper once nothing can use them
+static void threadpool_maybe_free(threadpool_wrap_t *pool) {
+  if (pool->n_contexts > 0) return;
+  if (pool->ptr && (pool->released || pool->finalized)) {
+    ggml_threadpool_free(pool->ptr);
+    pool->ptr = NULL;
+  }
+  if (pool->finalized) {
+    uv_mutex_destroy(&pool->lock);
+    free(pool);
+  }
+}
 
-  if (key_id < 0) {
-    gguf_free(gguf);
-    js_value_t *null_val;
-    js_get_null(env, &null_val);
-    return null_val;
+static void adapter_maybe_free(adapter_wrap_t *adapter) {
+  if (adapter->n_contexts > 0) return;
+  if (adapter->ptr && adapter->released) {
+    // A freed model has already freed its adapters
+    if (adapter->entry || (adapter->owner && adapter->owner->ptr)) llama_adapter_lora_free(adapter->ptr);
+    adapter->ptr = NULL;
+    if (adapter->entry) {
+      model_registry_release(adapter->entry);
+      adapter->entry = NULL;
+    }
   }
+  if (adapter->finalized) free(adapter);
+}
 
-  // Get value as string
-  const char *value = gguf_get_val_str(gguf, key_id);
-  if (!value) {
-    gguf_free(gguf);
-    js_value_t *null_val;
-    js_get_null(env, &null_val);
-    return null_val;
+static void context_release_adapters(context_wrap_t *wrap) {
+  for (size_t i = 0; i < wrap->n_adapters; i++) {
+    wrap->adapters[i]->n_contexts--;
+    adapter_maybe_free(wrap->adapters[i]);
   }
+  free(wrap->adapters);
+  free(wrap->adapter_scales);
+  wrap->adapters = NULL;
+  wrap->adapter_scales = NULL;
+  wrap->n_adapters = 0;
+}
 
-  js_value_t *result;
-  err = js_create_string_utf8(env, (utf8_t *)value, strlen(value), &result);
-  gguf_free(gguf);
+// Free a context and the threadpools and adapters it uses. Those must outlive
+// the context.
+static void context_release(context_wrap_t *wrap) {
+  if (wrap->ptr) {
+    llama_free(wrap->ptr);
+    wrap->ptr = NULL;
+  }
+  context_release_adapters(wrap);
+  if (wrap->shared_pool) {
+    wrap->shared_pool->n_contexts--;
+    threadpool_maybe_free(wrap->shared_pool);
+    wrap->shared_pool = NULL;
+  }
+  if (wrap->threadpool_batch) {
+    ggml_threadpool_free(wrap->threadpool_batch);
+    wrap->threadpool_batch = NULL;
+  }
+  if (wrap->threadpool) {
+    ggml_threadpool_free(wrap->threadpool);
+    wrap->threadpool = NULL;
+  }
+}
 
-  if (err < 0) return throw_error(env, "Failed to create string");
+// Process-wide counters for getMetrics. They only ever grow, so they can be
+// exported as monotonic counters.
+static struct {
+  uv_mutex_t lock;
+  uint64_t decode_calls;
+  uint64_t decode_tokens;
+  uint64_t decode_ns;
+  uint64_t tokenize_calls;
+  uint64_t tokenize_texts;
+  uint64_t tokenize_bytes;
+  uint64_t tokenize_tokens;
+  uint64_t output_copies;
+  uint64_t output_bytes;
+} metrics;
+
+static uv_once_t metrics_once = UV_ONCE_INIT;
+
+static void
+metrics_init(void) {
+  uv_mutex_init(&metrics.lock);
+}
 
-  return result;
+static void
+metrics_record_decode(uint32_t n_tokens, uint64_t ns) {
+  uv_once(&metrics_once, metrics_init);
+  uv_mutex_lock(&metrics.lock);
+  metrics.decode_calls++;
+  metrics.decode_tokens += n_tokens;
+  metrics.decode_ns += ns;
+  uv_mutex_unlock(&metrics.lock);
 }
 
-// loadModel(path: string, params?: object): Model
-static js_value_t *
-fn_load_model(js_env_t *env, js_callback_info_t *info) {
-  int err;
-  size_t argc = 2;
-  js_value_t *argv[2];
+// One tokenize or tokenizeBatch call over n_texts texts
+static void
+metrics_record_tokenize(uint64_t n_texts, uint64_t n_bytes, uint64_t n_tokens) {
+  uv_once(&metrics_once, metrics_init);
+  uv_mutex_lock(&metrics.lock);
+  metrics.tokenize_calls++;
+  metrics.tokenize_texts += n_texts;
+  metrics.tokenize_bytes += n_bytes;
+  metrics.tokenize_tokens += n_tokens;
+  uv_mutex_unlock(&metrics.lock);
+}
 
-  err = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
-  if (err < 0) return throw_error(env, "Failed to get callback info");
+// Logits or embeddings copied out of the context into JS memory
+static void
+metrics_record_copy(uint64_t n_bytes) {
+  uv_once(&metrics_once, metrics_init);
+  uv_mutex_lock(&metrics.lock);
+  metrics.output_copies++;
+  metrics.output_bytes += n_bytes;
+  uv_mutex_unlock(&metrics.lock);
+}
 
-  if (argc < 1) return throw_error(env, "Model path required");
+// Growable byte buffer for building output text
+typedef struct {
+  char *data;
+  size_t len;
+  size_t cap;
+} text_buf_t;
+
+static bool
+text_buf_reserve(text_buf_t *buf, size_t extra) {
+  if (buf->len + extra <= buf->cap) return true;
+  size_t cap = buf->cap ? buf->cap : 256;
+  while (cap < buf->len + extra) cap *= 2;
+  char *data = (char *)realloc(buf->data, cap);
+  if (!data) return false;
+  buf->data = data;
+  buf->cap = cap;
+  return true;
+}
 
-  // Get model path
-  size_t path_len;
-  err = js_get_value_string_utf8(env, argv[0], NULL, 0, &path_len);
-  if (err < 0) return throw_error(env, "Invalid model path");
+static bool
+text_buf_append(text_buf_t *buf, const char *data, size_t len) {
+  if (!text_buf_reserve(buf, len)) return false;
+  memcpy(buf->data + buf->len, data, len);
+  buf->len += len;
+  return true;
+}
 
-  char *path = (char *)malloc(path_len + 1);
-  if (!path) return throw_error(env, "Memory allocation failed");
+// Append the text piece for a token, growing the buffer if the piece is long
+static bool
+text_buf_append_token(text_buf_t *buf, const struct llama_vocab *vocab, llama_token token, bool special) {
+  if (!text_buf_reserve(buf, 64)) return false;
+  int32_t n = llama_token_to_piece(vocab, token, buf->data + buf->len, (int32_t)(buf->cap - buf->len), 0, special);
+  if (n < 0) {
+    if (!text_buf_reserve(buf, (size_t)-n)) return false;
+    n = llama_token_to_piece(vocab, token, buf->data + buf->len, (int32_t)(buf->cap - buf->len), 0, special);
+  }
+  if (n > 0) buf->len += n;
+  return n >= 0;
+}
 
-  err = js_get_value_string_utf8(env, argv[0], (utf8_t *)path, path_len + 1, NULL);
-  if (err < 0) {
-    free(path);
-    return throw_error(env, "Failed to read model path");
+// Length of the longest prefix of buf that does not end inside a multibyte
+// UTF-8 sequence. Tokens can split characters, so streamed text is held back
+// until the sequence is complete.
+static size_t
+utf8_complete_len(const char *buf, size_t len) {
+  // A sequence is at most 4 bytes, so only the tail needs inspecting
+  for (size_t i = 1; i <= 4 && i <= len; i++) {
+    unsigned char c = (unsigned char)buf[len - i];
+    if ((c & 0xC0) == 0x80) continue;  // Continuation byte
+    size_t need = 1;
+    if ((c & 0xE0) == 0xC0) need = 2;
+    else if ((c & 0xF0) == 0xE0) need = 3;
+    else if ((c & 0xF8) == 0xF0) need = 4;
+    return i < need ? len - i : len;
   }
+  return len;
+}
 
-  // Set up default params
-  struct llama_model_params params = llama_model_default_params();
-  params.progress_callback = NULL;  // Disable progress callback
-  // use_mmap defaults to true - keep it for better memory usage
+// Async work runs on the libuv thread pool. execute() runs off the JS thread
+// and must not touch the JS environment; complete() runs back on the JS thread
+// and returns the resolution value, or NULL to reject with work->error.
+// complete() is always called and frees any op-specific resources.
+typedef struct async_work_s async_work_t;
+
+struct async_work_s {
+  uv_work_t req;
+  js_env_t *env;
+  js_deferred_t *deferred;
+  js_ref_t *refs[2];  // Keep handle arguments alive while in flight
+  context_wrap_t *ctx_wrap;
+  sampler_wrap_t *sampler_wrap;
+  void (*execute)(async_work_t *work);
+  js_value_t *(*complete)(async_work_t *work);
+  const char *error;
+};
+
+static void
+on_async_work(uv_work_t *req) {
+  async_work_t *work = (async_work_t *)req->data;
+  work->execute(work);
+}
 
-  // Parse optional params
-  if (argc >= 2) {
-    js_value_t *opts = argv[1];
-    js_value_t *val;
-    bool has_prop;
+static void
+on_async_work_done(uv_work_t *req, int status) {
+  async_work_t *work = (async_work_t *)req->data;
+  js_env_t *env = work->env;
 
-    // n_gpu_layers
-    err = js_has_named_property(env, opts, "nGpuLayers", &has_prop);
-    if (err == 0 && has_prop) {
-      err = js_get_named_property(env, opts, "nGpuLayers", &val);
-      if (err == 0) {
-        int32_t n;
-        js_get_value_int32(env, val, &n);
-        params.n_gpu_layers = n;
-      }
+  js_handle_scope_t *scope;
+  js_open_handle_scope(env, &scope);
+
+  if (status != 0 && !work->error) work->error = "Async work was cancelled";
+
+  // Release handles first so complete() may hand them back to JS
+  if (work->ctx_wrap) {
+    work->ctx_wrap->busy = false;
+    if (work->ctx_wrap->free_pending && work->ctx_wrap->ptr) {
+      context_release(work->ctx_wrap);
+    }
+  }
+  if (work->sampler_wrap) {
+    work->sampler_wrap->busy = false;
+    if (work->sampler_wrap->free_pending && work->sampler_wrap->ptr) {
+      llama_sampler_free(work->sampler_wrap->ptr);
+      work->sampler_wrap->ptr = NULL;
     }
   }
 
-  // Load the model
-  struct llama_model *model = llama_model_load_from_file(path, params);
-  free(path);
-
-  if (!model) return throw_error(env, "Failed to load model");
+  js_value_t *result = work->complete(work);
 
-  // Create wrapper to prevent double-free
-  model_wrap_t *wrap = (model_wrap_t *)malloc(sizeof(model_wrap_t));
-  if (!wrap) {
-    llama_model_free(model);
-    return throw_error(env, "Failed to allocate wrapper");
+  if (result) {
+    js_resolve_deferred(env, work->deferred, result);
+  } else {
+    const char *msg = work->error ? work->error : "Async work failed";
+    js_value_t *message, *error;
+    js_create_string_utf8(env, (utf8_t *)msg, strlen(msg), &message);
+    js_create_error(env, NULL, message, &error);
+    js_reject_deferred(env, work->deferred, error);
   }
-  wrap->ptr = model;
 
-  // Wrap in JS object
-  js_value_t *result;
-  err = js_create_external(env, wrap, finalize_model, NULL, &result);
-  if (err < 0) {
-    llama_model_free(model);
-    free(wrap);
-    return throw_error(env, "Failed to create model wrapper");
+  for (int i = 0; i < 2; i++) {
+    if (work->refs[i]) js_delete_reference(env, work->refs[i]);
   }
 
-  // Note: js_add_type_tag crashes in Bare runtime, so we skip type tagging
+  free(work);
 
-  return result;
+  js_close_handle_scope(env, scope);
 }
 
-// freeModel(model: Model): void
+// Queue work and return its promise. handles[] are the JS values backing
+// ctx_wrap/sampler_wrap (may be NULL); they are referenced until completion
+// and their wrappers are marked busy so synchronous calls are rejected.
 static js_value_t *
-fn_free_model(js_env_t *env, js_callback_info_t *info) {
+queue_async_work(js_env_t *env, async_work_t *work, js_value_t *handles[2]) {
   int err;
-  size_t argc = 1;
-  js_value_t *argv[1];
 
-  err = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
-  if (err < 0) return NULL;
+  work->env = env;
+  work->req.data = work;
 
-  // Get wrapper from external
-  model_wrap_t *wrap;
-  err = js_get_value_external(env, argv[0], (void **)&wrap);
-  if (err < 0 || !wrap) return NULL;
+  uv_loop_t *loop;
+  err = js_get_env_loop(env, &loop);
+  if (err < 0) {
+    work->error = "Failed to get event loop";
+    work->complete(work);
+    free(work);
+    return throw_error(env, "Failed to get event loop");
+  }
 
-  // Free the model and nullify pointer to prevent double-free
-  if (wrap->ptr) {
-    llama_model_free(wrap->ptr);
-    wrap->ptr = NULL;
+  js_value_t *promise;
+  err = js_create_promise(env, &work->deferred, &promise);
+  if (err < 0) {
+    work->error = "Failed to create promise";
+    work->complete(work);
+    free(work);
+    return throw_error(env, "Failed to create promise");
   }
 
-  js_value_t *null_val;
-  js_get_null(env, &null_val);
-  return null_val;
-}
+  for (int i = 0; i < 2; i++) {
+    if (handles && handles[i]) js_create_reference(env, handles[i], 1, &work->refs[i]);
+  }
+  if (work->ctx_wrap) work->ctx_wrap->busy = true;
+  if (work->sampler_wrap) work->sampler_wrap->busy = true;
 
-// createContext(model: Model, params?: object): Context
-static js_value_t *
-fn_create_context(js_env_t *env, js_callback_info_t *info) {
-  int err;
-  size_t argc = 2;
-  js_value_t *argv[2];
+  err = uv_queue_work(loop, &work->req, on_async_work, on_async_work_done);
+  if (err < 0) {
+    // Settle as if the work had run and failed: releases the busy flags and
+    // references, lets complete() clean up and rejects the promise
+    work->error = "Failed to queue async work";
+    on_async_work_done(&work->req, err);
+  }
 
-  err = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
-  if (err < 0) return throw_error(env, "Failed to get callback info");
+  return promise;
+}
 
-  if (argc < 1) return throw_error(env, "Model required");
+// GGUF metadata reader. Parses only the header and key/value section of a
+// file, without the tensor infos gguf_init_from_file also reads. Values are
+// kept as their on-disk bytes and converted to JS on request; arrays longer
+// than GGUF_INLINE_ARRAY_MAX elements (the tokenizer vocab and scores) are
+// skipped and only read back from the file when asked for by key.
+#define GGUF_INLINE_ARRAY_MAX 1024
+#define GGUF_META_CACHE_MAX 256
+
+enum {
+  GGUF_META_UINT8,
+  GGUF_META_INT8,
+  GGUF_META_UINT16,
+  GGUF_META_INT16,
+  GGUF_META_UINT32,
+  GGUF_META_INT32,
+  GGUF_META_FLOAT32,
+  GGUF_META_BOOL,
+  GGUF_META_STRING,
+  GGUF_META_ARRAY,
+  GGUF_META_UINT64,
+  GGUF_META_INT64,
+  GGUF_META_FLOAT64,
+  GGUF_META_COUNT
+};
+
+static const size_t gguf_meta_type_size[GGUF_META_COUNT] = {1, 1, 2, 2, 4, 4, 4, 1, 0, 0, 8, 8, 8};
 
-  // Get model wrapper
-  model_wrap_t *model_wrap;
-  err = js_get_value_external(env, argv[0], (void **)&model_wrap);
-  if (err < 0 || !model_wrap || !model_wrap->ptr) return throw_error(env, "Invalid model");
-  
-  struct llama_model *model = model_wrap->ptr;
+typedef struct {
+  char *key;
+  uint32_t type;
+  uint32_t array_type;  // Element type of arrays
+  uint64_t n;           // Elements of arrays
+  int64_t offset;       // File offset of the value (of the elements for arrays)
+  uint64_t size;        // Bytes of the value (of the elements for arrays)
+  uint8_t *data;        // On-disk bytes, or NULL for a skipped array
+} gguf_meta_kv_t;
+
+typedef struct gguf_meta_entry_s gguf_meta_entry_t;
+
+struct gguf_meta_entry_s {
+  char *path;
+  uint64_t dev, ino, size;
+  int64_t mtime_sec, mtime_nsec;
+  uint32_t version;
+  uint64_t n_tensors;
+  gguf_meta_kv_t *kvs;
+  uint64_t n_kvs;
+  uint64_t last_used;
+  gguf_meta_entry_t *next;
+};
+
+// Process-wide cache of parsed headers, keyed by path and validated against
+// the file's identity, size and mtime
+static struct {
+  uv_mutex_t lock;
+  gguf_meta_entry_t *entries;
+  size_t n_entries;
+  uint64_t clock;
+} gguf_meta_cache;
+
+static uv_once_t gguf_meta_cache_once = UV_ONCE_INIT;
+
+static void
+gguf_meta_cache_init(void) {
+  uv_mutex_init(&gguf_meta_cache.lock);
+}
 
-  struct llama_context_params params = llama_context_default_params();
+static void
+gguf_meta_entry_free(gguf_meta_entry_t *entry) {
+  for (uint64_t i = 0; i < entry->n_kvs; i++) {
+    free(entry->kvs[i].key);
+    free(entry->kvs[i].data);
+  }
+  free(entry->kvs);
+  free(entry->path);
+  free(entry);
+}
 
-  // Parse optional params
-  if (argc >= 2) {
-    js_value_t *opts = argv[1];
-    js_value_t *val;
-    bool has_prop;
+// Buffered sequential reader over a file opened with uv_fs
+typedef struct {
+  uv_loop_t *loop;
+  uv_file file;
+  char buf[65536];
+  size_t len;
+  size_t pos;
+  int64_t buf_offset;
+} gguf_reader_t;
 
-    // n_ctx (context size)
-    err = js_has_named_property(env, opts, "contextSize", &has_prop);
-    if (err == 0 && has_prop) {
-      err = js_get_named_property(env, opts, "contextSize", &val);
-      if (err == 0) {
-        int32_t n;
-        js_get_value_int32(env, val, &n);
-        params.n_ctx = (uint32_t)n;
-      }
+static int64_t
+gguf_reader_tell(gguf_reader_t *r) {
+  return r->buf_offset + (int64_t)r->pos;
+}
+
+static bool
+gguf_reader_read(gguf_reader_t *r, void *out, uint64_t n) {
+  char *dst = (char *)out;
+  while (n > 0) {
+    if (r->pos == r->len) {
+      r->buf_offset += (int64_t)r->len;
+      r->pos = 0;
+      r->len = 0;
+
+      uv_fs_t req;
+      uv_buf_t buf = uv_buf_init(r->buf, sizeof(r->buf));
+      int read = uv_fs_read(r->loop, &req, r->file, &buf, 1, r->buf_offset, NULL);
+      uv_fs_req_cleanup(&req);
+      if (read <= 0) return false;
+      r->len = (size_t)read;
     }
+    size_t chunk = r->len - r->pos < n ? r->len - r->pos : (size_t)n;
+    if (dst) {
+      memcpy(dst, r->buf + r->pos, chunk);
+      dst += chunk;
+    }
+    r->pos += chunk;
+    n -= chunk;
+  }
+  return true;
+}
 
-    // n_batch
-    err = js_has_named_property(env, opts, "batchSize", &has_prop);
-    if (err == 0 && has_prop) {
-      err = js_get_named_property(env, opts, "batchSize", &val);
-      if (err == 0) {
-        int32_t n;
-        js_get_value_int32(env, val, &n);
-        params.n_batch = (uint32_t)n;
-      }
+static bool
+gguf_reader_skip(gguf_reader_t *r, uint64_t n) {
+  if (n <= r->len - r->pos) {
+    r->pos += n;
+    return true;
+  }
+  r->buf_offset = gguf_reader_tell(r) + (int64_t)n;
+  r->pos = 0;
+  r->len = 0;
+  return true;
+}
+
+// Read a GGUF string (u64 length + bytes) as a NUL-terminated copy
+static char *
+gguf_reader_string(gguf_reader_t *r) {
+  uint64_t len;
+  if (!gguf_reader_read(r, &len, sizeof(len)) || len > (1u << 30)) return NULL;
+  char *str = (char *)malloc(len + 1);
+  if (!str) return NULL;
+  if (!gguf_reader_read(r, str, len)) {
+    free(str);
+    return NULL;
+  }
+  str[len] = '\0';
+  return str;
+}
+
+// Read one value into kv. Small values are kept; long arrays only have
+// their position and size recorded.
+static bool
+gguf_reader_value(gguf_reader_t *r, gguf_meta_kv_t *kv) {
+  if (kv->type >= GGUF_META_COUNT) return false;
+
+  if (kv->type == GGUF_META_ARRAY) {
+    if (!gguf_reader_read(r, &kv->array_type, sizeof(kv->array_type))) return false;
+    if (!gguf_reader_read(r, &kv->n, sizeof(kv->n))) return false;
+    if (kv->array_type >= GGUF_META_COUNT || kv->array_type == GGUF_META_ARRAY) return false;
+
+    kv->offset = gguf_reader_tell(r);
+    bool keep = kv->n <= GGUF_INLINE_ARRAY_MAX;
+
+    if (kv->array_type != GGUF_META_STRING) {
+      size_t elem = gguf_meta_type_size[kv->array_type];
+      if (kv->n > ((uint64_t)1 << 40) / elem) return false;
+      kv->size = kv->n * elem;
+      if (!keep) return gguf_reader_skip(r, kv->size);
+      kv->data = (uint8_t *)malloc(kv->size ? kv->size : 1);
+      return kv->data && gguf_reader_read(r, kv->data, kv->size);
     }
 
-    // embeddings
-    err = js_has_named_property(env, opts, "embeddings", &has_prop);
-    if (err == 0 && has_prop) {
-      err = js_get_named_property(env, opts, "embeddings", &val);
-      if (err == 0) {
-        bool embd;
-        js_get_value_bool(env, val, &embd);
-        params.embeddings = embd;
+    // Strings are length-prefixed, so their total size is only known by
+    // walking them
+    text_buf_t buf = {NULL, 0, 0};
+    for (uint64_t i = 0; i < kv->n; i++) {
+      uint64_t len;
+      if (!gguf_reader_read(r, &len, sizeof(len)) || len > (1u << 30)) {
+        free(buf.data);
+        return false;
+      }
+      if (keep) {
+        if (!text_buf_append(&buf, (const char *)&len, sizeof(len)) || !text_buf_reserve(&buf, len)) {
+          free(buf.data);
+          return false;
+        }
+        if (!gguf_reader_read(r, buf.data + buf.len, len)) {
+          free(buf.data);
+          return false;
+        }
+        buf.len += len;
+      } else if (!gguf_reader_skip(r, len)) {
+        return false;
       }
+      kv->size += sizeof(len) + len;
     }
+    kv->data = (uint8_t *)buf.data;
+    return !keep || kv->n == 0 || kv->data;
+  }
 
-    // poolingType (-1=unspecified, 0=none, 1=mean, 2=cls, 3=last, 4=rank)
+  kv->offset = gguf_reader_tell(r);
+
+  if (kv->type == GGUF_META_STRING) {
+    uint64_t len;
+    if (!gguf_reader_read(r, &len, sizeof(len)) || len > (1u << 30)) return false;
+    kv->size = sizeof(len) + len;
+    kv->data = (uint8_t *)malloc(kv->size);
+    if (!kv->data) return false;
+    memcpy(kv->data, &len, sizeof(len));
+    return gguf_reader_read(r, kv->data + sizeof(len), len);
+  }
+
+  kv->size = gguf_meta_type_size[kv->type];
+  kv->data = (uint8_t *)malloc(kv->size);
+  return kv->data && gguf_reader_read(r, kv->data, kv->size);
+}
+
+// Parse the header of path into a new cache entry, or NULL if the file can't
+// be read or isn't GGUF (v2 or later)
+static gguf_meta_entry_t *
+gguf_meta_parse(uv_loop_t *loop, const char *path) {
+  uv_fs_t req;
+  int fd = uv_fs_open(loop, &req, path, UV_FS_O_RDONLY, 0, NULL);
+  uv_fs_req_cleanup(&req);
+  if (fd < 0) return NULL;
+
+  gguf_reader_t *r = (gguf_reader_t *)calloc(1, sizeof(gguf_reader_t));
+  gguf_meta_entry_t *entry = (gguf_meta_entry_t *)calloc(1, sizeof(gguf_meta_entry_t));
+  bool ok = r && entry;
+
+  if (ok) {
+    r->loop = loop;
+    r->file = fd;
+
+    char magic[4];
+    ok = gguf_reader_read(r, magic, sizeof(magic)) && memcmp(magic, "GGUF", 4) == 0 &&
+         gguf_reader_read(r, &entry->version, sizeof(entry->version)) && entry->version >= 2 &&
+         gguf_reader_read(r, &entry->n_tensors, sizeof(entry->n_tensors)) &&
+         gguf_reader_read(r, &entry->n_kvs, sizeof(entry->n_kvs)) && entry->n_kvs < (1u << 20);
+  }
+
+  if (ok) {
+    entry->kvs = (gguf_meta_kv_t *)calloc(entry->n_kvs ? entry->n_kvs : 1, sizeof(gguf_meta_kv_t));
+    ok = entry->kvs != NULL;
+  }
+
+  uint64_t n_read = 0;
+  while (ok && n_read < entry->n_kvs) {
+    gguf_meta_kv_t *kv = &entry->kvs[n_read++];
+    ok = (kv->key = gguf_reader_string(r)) != NULL &&
+         gguf_reader_read(r, &kv->type, sizeof(kv->type)) &&
+         gguf_reader_value(r, kv);
+  }
+
+  uv_fs_close(loop, &req, fd, NULL);
+  uv_fs_req_cleanup(&req);
+  free(r);
+
+  if (!ok) {
+    if (entry) {
+      entry->n_kvs = n_read;
+      gguf_meta_entry_free(entry);
+    }
+    return NULL;
+  }
+
+  entry->path = strdup(path);
+  if (!entry->path) {
+    gguf_meta_entry_free(entry);
+    return NULL;
+  }
+  return entry;
+}
+
+// Cached header of path, parsing it on a miss or when the file changed.
+// Call with the cache lock held; the entry is valid until it is released.
+static gguf_meta_entry_t *
+gguf_meta_get(uv_loop_t *loop, const char *path) {
+  uv_fs_t req;
+  int err = uv_fs_stat(loop, &req, path, NULL);
+  uv_stat_t st = req.statbuf;
+  uv_fs_req_cleanup(&req);
+  if (err < 0) return NULL;
+
+  gguf_meta_entry_t **e = &gguf_meta_cache.entries;
+  while (*e && strcmp((*e)->path, path) != 0) e = &(*e)->next;
+
+  if (*e) {
+    gguf_meta_entry_t *entry = *e;
+    if (entry->dev == st.st_dev && entry->ino == st.st_ino && entry->size == st.st_size &&
+        entry->mtime_sec == (int64_t)st.st_mtim.tv_sec && entry->mtime_nsec == (int64_t)st.st_mtim.tv_nsec) {
+      entry->last_used = ++gguf_meta_cache.clock;
+      return entry;
+    }
+    *e = entry->next;
+    gguf_meta_entry_free(entry);
+    gguf_meta_cache.n_entries--;
+  }
+
+  gguf_meta_entry_t *entry = gguf_meta_parse(loop, path);
+  if (!entry) return NULL;
+
+  entry->dev = st.st_dev;
+  entry->ino = st.st_ino;
+  entry->size = st.st_size;
+  entry->mtime_sec = (int64_t)st.st_mtim.tv_sec;
+  entry->mtime_nsec = (int64_t)st.st_mtim.tv_nsec;
+  entry->last_used = ++gguf_meta_cache.clock;
+
+  if (gguf_meta_cache.n_entries == GGUF_META_CACHE_MAX) {
+    gguf_meta_entry_t **victim = &gguf_meta_cache.entries;
+    for (e = &gguf_meta_cache.entries; *e; e = &(*e)->next) {
+      if ((*e)->last_used < (*victim)->last_used) victim = e;
+    }
+    gguf_meta_entry_t *evicted = *victim;
+    *victim = evicted->next;
+    gguf_meta_entry_free(evicted);
+    gguf_meta_cache.n_entries--;
+  }
+
+  entry->next = gguf_meta_cache.entries;
+  gguf_meta_cache.entries = entry;
+  gguf_meta_cache.n_entries++;
+  return entry;
+}
+
+static gguf_meta_kv_t *
+gguf_meta_find(gguf_meta_entry_t *entry, const char *key) {
+  for (uint64_t i = 0; i < entry->n_kvs; i++) {
+    if (strcmp(entry->kvs[i].key, key) == 0) return &entry->kvs[i];
+  }
+  return NULL;
+}
+
+// Convert one scalar or string value at p to JS; advances p past it
+static js_value_t *
+gguf_meta_scalar_to_js(js_env_t *env, uint32_t type, const uint8_t **p) {
+  js_value_t *result = NULL;
+  const uint8_t *v = *p;
+
+  switch (type) {
+  case GGUF_META_UINT8: js_create_uint32(env, *v, &result); break;
+  case GGUF_META_INT8: js_create_int32(env, *(const int8_t *)v, &result); break;
+  case GGUF_META_UINT16: { uint16_t x; memcpy(&x, v, 2); js_create_uint32(env, x, &result); break; }
+  case GGUF_META_INT16: { int16_t x; memcpy(&x, v, 2); js_create_int32(env, x, &result); break; }
+  case GGUF_META_UINT32: { uint32_t x; memcpy(&x, v, 4); js_create_uint32(env, x, &result); break; }
+  case GGUF_META_INT32: { int32_t x; memcpy(&x, v, 4); js_create_int32(env, x, &result); break; }
+  case GGUF_META_FLOAT32: { float x; memcpy(&x, v, 4); js_create_double(env, x, &result); break; }
+  case GGUF_META_BOOL: js_get_boolean(env, *v != 0, &result); break;
+  case GGUF_META_UINT64: { uint64_t x; memcpy(&x, v, 8); js_create_double(env, (double)x, &result); break; }
+  case GGUF_META_INT64: { int64_t x; memcpy(&x, v, 8); js_create_int64(env, x, &result); break; }
+  case GGUF_META_FLOAT64: { double x; memcpy(&x, v, 8); js_create_double(env, x, &result); break; }
+  case GGUF_META_STRING: {
+    uint64_t len;
+    memcpy(&len, v, sizeof(len));
+    js_create_string_utf8(env, (const utf8_t *)v + sizeof(len), len, &result);
+    *p += sizeof(len) + len;
+    return result;
+  }
+  }
+
+  *p += gguf_meta_type_size[type];
+  return result;
+}
+
+// Convert kv to JS. data holds the value's bytes (the elements for arrays).
+static js_value_t *
+gguf_meta_to_js(js_env_t *env, const gguf_meta_kv_t *kv, const uint8_t *data) {
+  if (kv->type != GGUF_META_ARRAY) return gguf_meta_scalar_to_js(env, kv->type, &data);
+
+  js_value_t *result;
+  js_create_array_with_length(env, (size_t)kv->n, &result);
+  for (uint64_t i = 0; i < kv->n; i++) {
+    js_value_t *item = gguf_meta_scalar_to_js(env, kv->array_type, &data);
+    js_set_element(env, result, (uint32_t)i, item);
+  }
+  return result;
+}
+
+// Value of kv as JS, reading a skipped array back from the file
+static js_value_t *
+gguf_meta_value(js_env_t *env, uv_loop_t *loop, const gguf_meta_entry_t *entry, const gguf_meta_kv_t *kv) {
+  if (kv->data || kv->size == 0) return gguf_meta_to_js(env, kv, kv->data);
+
+  uint8_t *data = (uint8_t *)malloc(kv->size);
+  if (!data) return NULL;
+
+  uv_fs_t req;
+  int fd = uv_fs_open(loop, &req, entry->path, UV_FS_O_RDONLY, 0, NULL);
+  uv_fs_req_cleanup(&req);
+
+  bool ok = fd >= 0;
+  uint64_t done = 0;
+  while (ok && done < kv->size) {
+    uint64_t chunk = kv->size - done < (1u << 30) ? kv->size - done : (1u << 30);
+    uv_buf_t buf = uv_buf_init((char *)data + done, (unsigned int)chunk);
+    int read = uv_fs_read(loop, &req, fd, &buf, 1, kv->offset + (int64_t)done, NULL);
+    uv_fs_req_cleanup(&req);
+    ok = read > 0;
+    if (ok) done += (uint64_t)read;
+  }
+  if (fd >= 0) {
+    uv_fs_close(loop, &req, fd, NULL);
+    uv_fs_req_cleanup(&req);
+  }
+
+  js_value_t *result = ok ? gguf_meta_to_js(env, kv, data) : NULL;
+  free(data);
+  return result;
+}
+
+// readGgufMeta(path: string, key: string): string | null
+// Reads one string value from the cached GGUF header; null if the file can't
+// be read or the key is missing or not a string.
+static js_value_t *
+fn_read_gguf_meta(js_env_t *env, js_callback_info_t *info) {
+  int err;
+  size_t argc = 2;
+  js_value_t *argv[2];
+
+  err = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
+  if (err < 0) return throw_error(env, "Failed to get callback info");
+
+  if (argc < 2) return throw_error(env, "Path and key required");
+
+  char *path = get_string_value(env, argv[0]);
+  if (!path) return throw_error(env, "Invalid path");
+
+  char *key = get_string_value(env, argv[1]);
+  if (!key) {
+    free(path);
+    return throw_error(env, "Invalid key");
+  }
+
+  uv_loop_t *loop;
+  js_get_env_loop(env, &loop);
+
+  uv_once(&gguf_meta_cache_once, gguf_meta_cache_init);
+  uv_mutex_lock(&gguf_meta_cache.lock);
+
+  js_value_t *result = NULL;
+  gguf_meta_entry_t *entry = gguf_meta_get(loop, path);
+  gguf_meta_kv_t *kv = entry ? gguf_meta_find(entry, key) : NULL;
+  if (kv && kv->type == GGUF_META_STRING) result = gguf_meta_to_js(env, kv, kv->data);
+
+  uv_mutex_unlock(&gguf_meta_cache.lock);
+  free(path);
+  free(key);
+
+  if (!result) js_get_null(env, &result);
+  return result;
+}
+
+// readGgufMetaAll(path: string, opts?: { keys?: string[], maxArrayLength?: number }): object | null
+// All metadata of a GGUF file as typed values, or only the listed keys.
+// Without keys, arrays longer than maxArrayLength (default 64) are left out;
+// listed keys are always returned in full. Headers are cached by path and
+// revalidated against the file's size and mtime, so repeated scans don't
+// touch the file contents.
+static js_value_t *
+fn_read_gguf_meta_all(js_env_t *env, js_callback_info_t *info) {
+  int err;
+  size_t argc = 2;
+  js_value_t *argv[2];
+
+  err = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
+  if (err < 0) return throw_error(env, "Failed to get callback info");
+
+  if (argc < 1) return throw_error(env, "Path required");
+
+  js_value_t *keys = NULL;
+  uint32_t n_keys = 0;
+  uint32_t max_array_length = 64;
+
+  if (argc >= 2) {
+    js_value_t *opts = argv[1];
+    js_value_t *val;
+    bool has_prop;
+
+    js_has_named_property(env, opts, "keys", &has_prop);
+    if (has_prop) {
+      js_get_named_property(env, opts, "keys", &val);
+      bool is_array = false;
+      js_is_array(env, val, &is_array);
+      if (is_array) {
+        keys = val;
+        js_get_array_length(env, keys, &n_keys);
+      }
+    }
+
+    js_has_named_property(env, opts, "maxArrayLength", &has_prop);
+    if (has_prop) {
+      js_get_named_property(env, opts, "maxArrayLength", &val);
+      js_get_value_uint32(env, val, &max_array_length);
+    }
+  }
+
+  char *path = get_string_value(env, argv[0]);
+  if (!path) return throw_error(env, "Invalid path");
+
+  uv_loop_t *loop;
+  js_get_env_loop(env, &loop);
+
+  uv_once(&gguf_meta_cache_once, gguf_meta_cache_init);
+  uv_mutex_lock(&gguf_meta_cache.lock);
+
+  gguf_meta_entry_t *entry = gguf_meta_get(loop, path);
+  free(path);
+
+  js_value_t *result;
+
+  if (!entry) {
+    uv_mutex_unlock(&gguf_meta_cache.lock);
+    js_get_null(env, &result);
+    return result;
+  }
+
+  js_create_object(env, &result);
+
+  if (keys) {
+    for (uint32_t i = 0; i < n_keys; i++) {
+      js_value_t *item;
+      js_get_element(env, keys, i, &item);
+      char *key = get_string_value(env, item);
+      if (!key) continue;
+
+      gguf_meta_kv_t *kv = gguf_meta_find(entry, key);
+      js_value_t *val = kv ? gguf_meta_value(env, loop, entry, kv) : NULL;
+      if (val) js_set_named_property(env, result, key, val);
+      free(key);
+    }
+  } else {
+    for (uint64_t i = 0; i < entry->n_kvs; i++) {
+      gguf_meta_kv_t *kv = &entry->kvs[i];
+      if (kv->type == GGUF_META_ARRAY && kv->n > max_array_length) continue;
+
+      js_value_t *val = gguf_meta_value(env, loop, entry, kv);
+      if (val) js_set_named_property(env, result, kv->key, val);
+    }
+  }
+
+  uv_mutex_unlock(&gguf_meta_cache.lock);
+
+  return result;
+}
+
+// Model load parameters plus the storage they point into
+typedef struct {
+  struct llama_model_params params;
+  // Terminated by an entry with a NULL pattern
+  struct llama_model_tensor_buft_override *overrides;
+  size_t n_overrides;
+} model_options_t;
+
+static void
+model_options_free(model_options_t *o) {
+  for (size_t i = 0; i < o->n_overrides; i++) free((void *)o->overrides[i].pattern);
+  free(o->overrides);
+  o->overrides = NULL;
+  o->n_overrides = 0;
+}
+
+// Buffer type by buffer type name ("CPU", "CUDA0", "CUDA_Host") or device name
+static ggml_backend_buffer_type_t
+find_buffer_type(const char *name) {
+  for (size_t i = 0; i < ggml_backend_dev_count(); i++) {
+    ggml_backend_dev_t dev = ggml_backend_dev_get(i);
+    ggml_backend_buffer_type_t buft = ggml_backend_dev_buffer_type(dev);
+    if (buft && (strcmp(ggml_backend_buft_name(buft), name) == 0 || strcmp(ggml_backend_dev_name(dev), name) == 0)) {
+      return buft;
+    }
+    buft = ggml_backend_dev_host_buffer_type(dev);
+    if (buft && strcmp(ggml_backend_buft_name(buft), name) == 0) return buft;
+  }
+  return NULL;
+}
+
+static bool
+parse_model_bool(js_env_t *env, js_value_t *opts, const char *name, bool *out) {
+  js_value_t *val;
+  bool has_prop;
+  int err = js_has_named_property(env, opts, name, &has_prop);
+  if (err == 0 && has_prop) {
+    err = js_get_named_property(env, opts, name, &val);
+    if (err == 0) return js_get_value_bool(env, val, out) == 0;
+  }
+  return false;
+}
+
+// Parse LlamaModel options into llama_model_params. Throws and returns false
+// on error; the caller frees o with model_options_free either way.
+static bool
+parse_model_options(js_env_t *env, js_value_t *opts, model_options_t *o) {
+  int err;
+  js_value_t *val;
+  bool has_prop;
+
+  // n_gpu_layers
+  err = js_has_named_property(env, opts, "nGpuLayers", &has_prop);
+  if (err == 0 && has_prop) {
+    err = js_get_named_property(env, opts, "nGpuLayers", &val);
+    if (err == 0) {
+      int32_t n;
+      js_get_value_int32(env, val, &n);
+      o->params.n_gpu_layers = n;
+    }
+  }
+
+  parse_model_bool(env, opts, "useMmap", &o->params.use_mmap);
+  parse_model_bool(env, opts, "useMlock", &o->params.use_mlock);
+  parse_model_bool(env, opts, "vocabOnly", &o->params.vocab_only);
+  parse_model_bool(env, opts, "checkTensors", &o->params.check_tensors);
+
+  // tensorOverrides: { [pattern]: bufferType }, e.g. { '\\.ffn_.*_exps\\.': 'CPU' }
+  err = js_has_named_property(env, opts, "tensorOverrides", &has_prop);
+  if (err == 0 && has_prop) {
+    err = js_get_named_property(env, opts, "tensorOverrides", &val);
+    if (err < 0) return true;
+
+    js_value_t *keys;
+    uint32_t n;
+    err = js_get_property_names(env, val, &keys);
+    if (err < 0) {
+      throw_error(env, "tensorOverrides must be an object of pattern: bufferType");
+      return false;
+    }
+    js_get_array_length(env, keys, &n);
+
+    o->overrides = (struct llama_model_tensor_buft_override *)calloc(n + 1, sizeof(struct llama_model_tensor_buft_override));
+    if (!o->overrides) {
+      throw_error(env, "Memory allocation failed");
+      return false;
+    }
+
+    for (uint32_t i = 0; i < n; i++) {
+      js_value_t *key, *target;
+      js_get_element(env, keys, i, &key);
+      js_get_property(env, val, key, &target);
+
+      char *pattern = get_string_value(env, key);
+      char *name = get_string_value(env, target);
+      if (!pattern || !name) {
+        free(pattern);
+        free(name);
+        throw_error(env, "tensorOverrides must be an object of pattern: bufferType");
+        return false;
+      }
+
+      ggml_backend_buffer_type_t buft = find_buffer_type(name);
+      free(name);
+      if (!buft) {
+        free(pattern);
+        throw_error(env, "Unknown buffer type in tensorOverrides");
+        return false;
+      }
+
+      o->overrides[o->n_overrides].pattern = pattern;
+      o->overrides[o->n_overrides].buft = buft;
+      o->n_overrides++;
+    }
+
+    o->params.tensor_buft_overrides = o->overrides;
+  }
+
+  return true;
+}
+
+// onProgress for synchronous loads, called directly on the JS thread.
+// Returning false from the callback cancels the load.
+typedef struct {
+  js_env_t *env;
+  js_value_t *function;
+  bool cancelled;
+} load_progress_t;
+
+static bool
+on_load_progress(float progress, void *user_data) {
+  load_progress_t *p = (load_progress_t *)user_data;
+  if (p->cancelled) return false;
+
+  js_handle_scope_t *scope;
+  js_open_handle_scope(p->env, &scope);
+
+  js_value_t *arg, *global, *result;
+  js_create_double(p->env, progress, &arg);
+  js_get_global(p->env, &global);
+
+  if (js_call_function(p->env, global, p->function, 1, &arg, &result) < 0) {
+    p->cancelled = true;
+  } else {
+    js_value_type_t type;
+    js_typeof(p->env, result, &type);
+    if (type == js_boolean) {
+      bool keep_going = true;
+      js_get_value_bool(p->env, result, &keep_going);
+      p->cancelled = !keep_going;
+    }
+  }
+
+  js_close_handle_scope(p->env, scope);
+  return !p->cancelled;
+}
+
+// Get opts.onProgress if it is a function
+static js_value_t *
+get_progress_callback(js_env_t *env, js_value_t *opts) {
+  js_value_t *val;
+  bool has_prop;
+  int err = js_has_named_property(env, opts, "onProgress", &has_prop);
+  if (err < 0 || !has_prop) return NULL;
+
+  err = js_get_named_property(env, opts, "onProgress", &val);
+  if (err < 0) return NULL;
+
+  bool is_function = false;
+  js_is_function(env, val, &is_function);
+  return is_function ? val : NULL;
+}
+
+// Process-wide cache of compiled llguidance grammars, keyed by vocab and
+// grammar text. Samplers get a clone of the cached grammar, which shares its
+// compiled state, so each grammar is compiled once per model. Entries are
+// evicted least recently used first, and dropped when their model is freed.
+#define GRAMMAR_CACHE_MAX 64
+
+typedef struct grammar_entry_s grammar_entry_t;
+
+struct grammar_entry_s {
+  const struct llama_vocab *vocab;
+  char *grammar;
+  struct llama_sampler *ptr;
+  uint64_t last_used;
+  grammar_entry_t *next;
+};
+
+static struct {
+  uv_mutex_t lock;
+  grammar_entry_t *entries;
+  size_t n_entries;
+  uint64_t clock;
+  uint64_t hits;
+  uint64_t misses;
+} grammar_cache;
+
+static uv_once_t grammar_cache_once = UV_ONCE_INIT;
+
+static void
+grammar_cache_init(void) {
+  uv_mutex_init(&grammar_cache.lock);
+}
+
+static void
+grammar_entry_free(grammar_entry_t *entry) {
+  llama_sampler_free(entry->ptr);
+  free(entry->grammar);
+  free(entry);
+}
+
+// A new grammar sampler for Lark grammar text, or NULL if it doesn't compile
+static struct llama_sampler *
+grammar_cache_get(const struct llama_vocab *vocab, const char *grammar) {
+  uv_once(&grammar_cache_once, grammar_cache_init);
+  uv_mutex_lock(&grammar_cache.lock);
+
+  grammar_entry_t *entry = grammar_cache.entries;
+  while (entry && (entry->vocab != vocab || strcmp(entry->grammar, grammar) != 0)) entry = entry->next;
+
+  if (entry) {
+    grammar_cache.hits++;
+  } else {
+    grammar_cache.misses++;
+
+    struct llama_sampler *compiled = llama_sampler_init_llg(vocab, "lark", grammar);
+    entry = compiled ? (grammar_entry_t *)calloc(1, sizeof(grammar_entry_t)) : NULL;
+    char *grammar_copy = entry ? strdup(grammar) : NULL;
+    if (!grammar_copy) {
+      free(entry);
+      uv_mutex_unlock(&grammar_cache.lock);
+      // Uncacheable: hand out the compiled grammar itself
+      return compiled;
+    }
+
+    if (grammar_cache.n_entries == GRAMMAR_CACHE_MAX) {
+      grammar_entry_t **victim = &grammar_cache.entries;
+      for (grammar_entry_t **e = &grammar_cache.entries; *e; e = &(*e)->next) {
+        if ((*e)->last_used < (*victim)->last_used) victim = e;
+      }
+      grammar_entry_t *evicted = *victim;
+      *victim = evicted->next;
+      grammar_entry_free(evicted);
+      grammar_cache.n_entries--;
+    }
+
+    entry->vocab = vocab;
+    entry->grammar = grammar_copy;
+    entry->ptr = compiled;
+    entry->next = grammar_cache.entries;
+    grammar_cache.entries = entry;
+    grammar_cache.n_entries++;
+  }
+
+  entry->last_used = ++grammar_cache.clock;
+  struct llama_sampler *sampler = llama_sampler_clone(entry->ptr);
+
+  uv_mutex_unlock(&grammar_cache.lock);
+  return sampler;
+}
+
+// Drop the grammars compiled for a model's vocab; call before freeing it
+static void
+grammar_cache_forget(const struct llama_model *model) {
+  uv_once(&grammar_cache_once, grammar_cache_init);
+  uv_mutex_lock(&grammar_cache.lock);
+
+  const struct llama_vocab *vocab = llama_model_get_vocab(model);
+  grammar_entry_t **e = &grammar_cache.entries;
+  while (*e) {
+    if ((*e)->vocab == vocab) {
+      grammar_entry_t *entry = *e;
+      *e = entry->next;
+      grammar_entry_free(entry);
+      grammar_cache.n_entries--;
+    } else {
+      e = &(*e)->next;
+    }
+  }
+
+  uv_mutex_unlock(&grammar_cache.lock);
+}
+
+// Process-wide model registry. Loads of the same file (same device, inode,
+// size and mtime) with the same parameters share one llama_model. Entries are
+// refcounted by handles; idle entries stay cached while the total size of
+// cached models fits the budget and are evicted least recently used first.
+struct model_entry_s {
+  char *key;
+  char *path;
+  struct llama_model *model;
+  uint64_t size;
+  int32_t refs;
+  uint64_t last_used;
+  model_entry_t *next;
+};
+
+static struct {
+  uv_mutex_t lock;
+  model_entry_t *entries;
+  uint64_t budget;
+  uint64_t clock;
+  uint64_t hits;
+  uint64_t misses;
+} model_registry;
+
+static uv_once_t model_registry_once = UV_ONCE_INIT;
+
+static void
+model_registry_init(void) {
+  uv_mutex_init(&model_registry.lock);
+}
+
+// Free idle models, least recently used first, until the cache fits the
+// budget. Call with the lock held.
+static void
+model_registry_trim(void) {
+  while (true) {
+    uint64_t total = 0;
+    model_entry_t **victim = NULL;
+    for (model_entry_t **e = &model_registry.entries; *e; e = &(*e)->next) {
+      total += (*e)->size;
+      if ((*e)->refs == 0 && (!victim || (*e)->last_used < (*victim)->last_used)) victim = e;
+    }
+    if (!victim || total <= model_registry.budget) return;
+
+    model_entry_t *entry = *victim;
+    *victim = entry->next;
+    grammar_cache_forget(entry->model);
+    llama_model_free(entry->model);
+    free(entry->key);
+    free(entry->path);
+    free(entry);
+  }
+}
+
+// Take a reference to a cached model, or NULL on a miss
+static model_entry_t *
+model_registry_acquire(const char *key) {
+  uv_once(&model_registry_once, model_registry_init);
+  uv_mutex_lock(&model_registry.lock);
+
+  model_entry_t *entry = model_registry.entries;
+  while (entry && strcmp(entry->key, key) != 0) entry = entry->next;
+
+  if (entry) {
+    entry->refs++;
+    entry->last_used = ++model_registry.clock;
+    model_registry.hits++;
+  } else {
+    model_registry.misses++;
+  }
+
+  uv_mutex_unlock(&model_registry.lock);
+  return entry;
+}
+
+// Register a freshly loaded model and take a reference to it. If a concurrent
+// load registered the same key first, model is freed and that entry is used.
+// Returns NULL (model still owned by the caller) on allocation failure.
+static model_entry_t *
+model_registry_insert(const char *key, const char *path, struct llama_model *model) {
+  uv_once(&model_registry_once, model_registry_init);
+  uv_mutex_lock(&model_registry.lock);
+
+  model_entry_t *entry = model_registry.entries;
+  while (entry && strcmp(entry->key, key) != 0) entry = entry->next;
+
+  if (entry) {
+    llama_model_free(model);
+  } else {
+    entry = (model_entry_t *)calloc(1, sizeof(model_entry_t));
+    char *key_copy = strdup(key);
+    char *path_copy = strdup(path);
+    if (!entry || !key_copy || !path_copy) {
+      free(entry);
+      free(key_copy);
+      free(path_copy);
+      uv_mutex_unlock(&model_registry.lock);
+      return NULL;
+    }
+    entry->key = key_copy;
+    entry->path = path_copy;
+    entry->model = model;
+    entry->size = llama_model_size(model);
+    entry->next = model_registry.entries;
+    model_registry.entries = entry;
+  }
+
+  entry->refs++;
+  entry->last_used = ++model_registry.clock;
+  model_registry_trim();
+
+  uv_mutex_unlock(&model_registry.lock);
+  return entry;
+}
+
+static void
+model_registry_release(model_entry_t *entry) {
+  uv_mutex_lock(&model_registry.lock);
+  entry->refs--;
+  entry->last_used = ++model_registry.clock;
+  model_registry_trim();
+  uv_mutex_unlock(&model_registry.lock);
+}
+
+// Take another reference to an entry already held through a handle
+static void
+model_registry_retain(model_entry_t *entry) {
+  uv_mutex_lock(&model_registry.lock);
+  entry->refs++;
+  uv_mutex_unlock(&model_registry.lock);
+}
+
+// Registry key for path and params, or NULL if the file can't be stat'ed
+static char *
+model_registry_key(js_env_t *env, const char *path, const model_options_t *o) {
+  uv_loop_t *loop;
+  js_get_env_loop(env, &loop);
+
+  uv_fs_t req;
+  int err = uv_fs_stat(loop, &req, path, NULL);
+  if (err < 0) {
+    uv_fs_req_cleanup(&req);
+    return NULL;
+  }
+  uv_stat_t st = req.statbuf;
+  uv_fs_req_cleanup(&req);
+
+  text_buf_t key = {NULL, 0, 0};
+  char buf[256];
+  int n = snprintf(
+    buf, sizeof(buf), "%llu:%llu:%llu:%lld.%ld|%d:%d:%d:%d:%d|",
+    (unsigned long long)st.st_dev, (unsigned long long)st.st_ino, (unsigned long long)st.st_size,
+    (long long)st.st_mtim.tv_sec, (long)st.st_mtim.tv_nsec,
+    o->params.n_gpu_layers, o->params.use_mmap, o->params.use_mlock, o->params.vocab_only, o->params.check_tensors
+  );
+  bool ok = text_buf_append(&key, buf, (size_t)n) && text_buf_append(&key, path, strlen(path));
+
+  for (size_t i = 0; ok && i < o->n_overrides; i++) {
+    const char *buft = ggml_backend_buft_name(o->overrides[i].buft);
+    ok = text_buf_append(&key, "|", 1) &&
+         text_buf_append(&key, o->overrides[i].pattern, strlen(o->overrides[i].pattern)) &&
+         text_buf_append(&key, "=", 1) &&
+         text_buf_append(&key, buft, strlen(buft));
+  }
+
+  if (!ok || !text_buf_append(&key, "", 1)) {
+    free(key.data);
+    return NULL;
+  }
+  return key.data;
+}
+
+// Whether opts.shared allows using the registry (default true)
+static bool
+parse_model_shared(js_env_t *env, js_value_t *opts) {
+  bool shared = true;
+  parse_model_bool(env, opts, "shared", &shared);
+  return shared;
+}
+
+// Release a model handle's reference to its model
+static void
+model_release(model_wrap_t *wrap) {
+  if (!wrap->ptr) return;
+  if (wrap->entry) {
+    model_registry_release(wrap->entry);
+    wrap->entry = NULL;
+  } else {
+    grammar_cache_forget(wrap->ptr);
+    llama_model_free(wrap->ptr);
+  }
+  wrap->ptr = NULL;
+}
+
+// Wrap a loaded model in a JS external; releases the model on failure
+static int
+create_model_handle(js_env_t *env, struct llama_model *model, model_entry_t *entry, js_value_t **result) {
+  // Create wrapper to prevent double-free
+  model_wrap_t *wrap = (model_wrap_t *)malloc(sizeof(model_wrap_t));
+  if (!wrap) {
+    if (entry) model_registry_release(entry);
+    else llama_model_free(model);
+    return -1;
+  }
+  wrap->ptr = model;
+  wrap->entry = entry;
+
+  // Wrap in JS object
+  int err = js_create_external(env, wrap, finalize_model, NULL, result);
+  if (err < 0) {
+    model_release(wrap);
+    free(wrap);
+    return err;
+  }
+
+  // Note: js_add_type_tag crashes in Bare runtime, so we skip type tagging
+
+  return 0;
+}
+
+// loadModel(path: string, params?: object): Model
+static js_value_t *
+fn_load_model(js_env_t *env, js_callback_info_t *info) {
+  int err;
+  size_t argc = 2;
+  js_value_t *argv[2];
+
+  err = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
+  if (err < 0) return throw_error(env, "Failed to get callback info");
+
+  if (argc < 1) return throw_error(env, "Model path required");
+
+  // Get model path
+  size_t path_len;
+  err = js_get_value_string_utf8(env, argv[0], NULL, 0, &path_len);
+  if (err < 0) return throw_error(env, "Invalid model path");
+
+  char *path = (char *)malloc(path_len + 1);
+  if (!path) return throw_error(env, "Memory allocation failed");
+
+  err = js_get_value_string_utf8(env, argv[0], (utf8_t *)path, path_len + 1, NULL);
+  if (err < 0) {
+    free(path);
+    return throw_error(env, "Failed to read model path");
+  }
+
+  // Set up default params
+  model_options_t options = {llama_model_default_params(), NULL, 0};
+  options.params.progress_callback = NULL;  // Disable progress callback
+  // use_mmap defaults to true - keep it for better memory usage
+
+  load_progress_t progress = {env, NULL, false};
+  bool shared = true;
+
+  // Parse optional params
+  if (argc >= 2) {
+    shared = parse_model_shared(env, argv[1]);
+    if (!parse_model_options(env, argv[1], &options)) {
+      model_options_free(&options);
+      free(path);
+      return NULL;
+    }
+
+    progress.function = get_progress_callback(env, argv[1]);
+    if (progress.function) {
+      options.params.progress_callback = on_load_progress;
+      options.params.progress_callback_user_data = &progress;
+    }
+  }
+
+  // Reuse a registered model, or load and register it
+  char *key = shared ? model_registry_key(env, path, &options) : NULL;
+  model_entry_t *entry = key ? model_registry_acquire(key) : NULL;
+  struct llama_model *model;
+
+  if (entry) {
+    model = entry->model;
+    if (progress.function) on_load_progress(1.0f, &progress);
+  } else {
+    model = llama_model_load_from_file(path, options.params);
+    if (model && key) entry = model_registry_insert(key, path, model);
+    if (entry) model = entry->model;
+  }
+  model_options_free(&options);
+  free(key);
+  free(path);
+
+  if (!model) {
+    bool pending = false;
+    js_is_exception_pending(env, &pending);
+    if (pending) return NULL;
+    return throw_error(env, progress.cancelled ? "Model load cancelled" : "Failed to load model");
+  }
+
+  js_value_t *result;
+  err = create_model_handle(env, model, entry, &result);
+  if (err < 0) return throw_error(env, "Failed to create model wrapper");
+
+  return result;
+}
+
+// onProgress for async loads. The loader thread records the latest value and
+// queues at most one call at a time; JS returning false sets cancelled.
+typedef struct {
+  uv_mutex_t lock;
+  float latest;
+  bool queued;
+  bool cancelled;
+  js_threadsafe_function_t *tsfn;
+} async_progress_t;
+
+static bool
+on_load_progress_async(float progress, void *user_data) {
+  async_progress_t *p = (async_progress_t *)user_data;
+
+  uv_mutex_lock(&p->lock);
+  p->latest = progress;
+  bool queue = !p->queued;
+  p->queued = true;
+  bool cancelled = p->cancelled;
+  uv_mutex_unlock(&p->lock);
+
+  if (queue) js_call_threadsafe_function(p->tsfn, NULL, js_threadsafe_function_nonblocking);
+  return !cancelled;
+}
+
+static void
+async_progress_flush(js_env_t *env, js_value_t *function, async_progress_t *p) {
+  uv_mutex_lock(&p->lock);
+  bool queued = p->queued;
+  float progress = p->latest;
+  p->queued = false;
+  uv_mutex_unlock(&p->lock);
+
+  if (!queued) return;
+
+  js_value_t *arg, *global, *result;
+  js_create_double(env, progress, &arg);
+  js_get_global(env, &global);
+  if (js_call_function(env, global, function, 1, &arg, &result) < 0) return;
+
+  js_value_type_t type;
+  js_typeof(env, result, &type);
+  if (type == js_boolean) {
+    bool keep_going = true;
+    js_get_value_bool(env, result, &keep_going);
+    if (!keep_going) {
+      uv_mutex_lock(&p->lock);
+      p->cancelled = true;
+      uv_mutex_unlock(&p->lock);
+    }
+  }
+}
+
+static void
+async_progress_on_call(js_env_t *env, js_value_t *function, void *context, void *data) {
+  (void)data;
+  async_progress_flush(env, function, (async_progress_t *)context);
+}
+
+static void
+async_progress_finalize(js_env_t *env, void *data, void *hint) {
+  (void)env; (void)hint;
+  async_progress_t *p = (async_progress_t *)data;
+  uv_mutex_destroy(&p->lock);
+  free(p);
+}
+
+typedef struct {
+  async_work_t base;
+  char *path;
+  char *key;
+  model_options_t options;
+  struct llama_model *model;
+  model_entry_t *entry;
+  async_progress_t *progress;
+  js_ref_t *on_progress;
+} load_model_work_t;
+
+static void
+load_model_execute(async_work_t *work) {
+  load_model_work_t *w = (load_model_work_t *)work;
+
+  // Already registered when the call was made
+  if (w->entry) {
+    w->model = w->entry->model;
+    if (w->progress) on_load_progress_async(1.0f, w->progress);
+    return;
+  }
+
+  w->model = llama_model_load_from_file(w->path, w->options.params);
+  if (!w->model) {
+    bool cancelled = false;
+    if (w->progress) {
+      uv_mutex_lock(&w->progress->lock);
+      cancelled = w->progress->cancelled;
+      uv_mutex_unlock(&w->progress->lock);
+    }
+    work->error = cancelled ? "Model load cancelled" : "Failed to load model";
+  }
+}
+
+static js_value_t *
+load_model_complete(async_work_t *work) {
+  load_model_work_t *w = (load_model_work_t *)work;
+  js_env_t *env = work->env;
+  model_options_free(&w->options);
+
+  // Deliver the final progress value before the promise settles
+  if (w->on_progress) {
+    js_value_t *function;
+    js_get_reference_value(env, w->on_progress, &function);
+    if (w->progress) async_progress_flush(env, function, w->progress);
+    js_delete_reference(env, w->on_progress);
+  }
+  if (w->progress) js_release_threadsafe_function(w->progress->tsfn, js_threadsafe_function_release);
+
+  if (w->model && !w->entry && w->key) {
+    w->entry = model_registry_insert(w->key, w->path, w->model);
+    if (w->entry) w->model = w->entry->model;
+  }
+  free(w->key);
+  free(w->path);
+
+  // Work that never ran still holds the reference taken at call time
+  if (!w->model && w->entry) model_registry_release(w->entry);
+
+  if (!w->model) return NULL;
+
+  js_value_t *result;
+  if (create_model_handle(work->env, w->model, w->entry, &result) < 0) {
+    work->error = "Failed to create model wrapper";
+    return NULL;
+  }
+  return result;
+}
+
+// loadModelAsync(path: string, params?: object): Promise<Model>
+static js_value_t *
+fn_load_model_async(js_env_t *env, js_callback_info_t *info) {
+  int err;
+  size_t argc = 2;
+  js_value_t *argv[2];
+
+  err = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
+  if (err < 0) return throw_error(env, "Failed to get callback info");
+
+  if (argc < 1) return throw_error(env, "Model path required");
+
+  size_t path_len;
+  err = js_get_value_string_utf8(env, argv[0], NULL, 0, &path_len);
+  if (err < 0) return throw_error(env, "Invalid model path");
+
+  load_model_work_t *work = (load_model_work_t *)calloc(1, sizeof(load_model_work_t));
+  if (!work) return throw_error(env, "Memory allocation failed");
+
+  work->path = (char *)malloc(path_len + 1);
+  if (!work->path) {
+    free(work);
+    return throw_error(env, "Memory allocation failed");
+  }
+
+  err = js_get_value_string_utf8(env, argv[0], (utf8_t *)work->path, path_len + 1, NULL);
+  if (err < 0) {
+    free(work->path);
+    free(work);
+    return throw_error(env, "Failed to read model path");
+  }
+
+  work->options.params = llama_model_default_params();
+  work->options.params.progress_callback = NULL;
+
+  bool shared = true;
+
+  if (argc >= 2) {
+    shared = parse_model_shared(env, argv[1]);
+    if (!parse_model_options(env, argv[1], &work->options)) {
+      model_options_free(&work->options);
+      free(work->path);
+      free(work);
+      return NULL;
+    }
+
+    js_value_t *on_progress = get_progress_callback(env, argv[1]);
+    if (on_progress) {
+      async_progress_t *progress = (async_progress_t *)calloc(1, sizeof(async_progress_t));
+      if (!progress) {
+        model_options_free(&work->options);
+        free(work->path);
+        free(work);
+        return throw_error(env, "Memory allocation failed");
+      }
+      uv_mutex_init(&progress->lock);
+
+      err = js_create_threadsafe_function(env, on_progress, 0, 1, async_progress_finalize, NULL, progress, async_progress_on_call, &progress->tsfn);
+      if (err < 0) {
+        uv_mutex_destroy(&progress->lock);
+        free(progress);
+        model_options_free(&work->options);
+        free(work->path);
+        free(work);
+        return throw_error(env, "Failed to create progress callback");
+      }
+
+      work->progress = progress;
+      js_create_reference(env, on_progress, 1, &work->on_progress);
+      work->options.params.progress_callback = on_load_progress_async;
+      work->options.params.progress_callback_user_data = progress;
+    }
+  }
+
+  if (shared) {
+    work->key = model_registry_key(env, work->path, &work->options);
+    if (work->key) work->entry = model_registry_acquire(work->key);
+  }
+
+  work->base.execute = load_model_execute;
+  work->base.complete = load_model_complete;
+
+  return queue_async_work(env, &work->base, NULL);
+}
+
+// freeModel(model: Model): void
+static js_value_t *
+fn_free_model(js_env_t *env, js_callback_info_t *info) {
+  int err;
+  size_t argc = 1;
+  js_value_t *argv[1];
+
+  err = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
+  if (err < 0) return NULL;
+
+  // Get wrapper from external
+  model_wrap_t *wrap;
+  err = js_get_value_external(env, argv[0], (void **)&wrap);
+  if (err < 0 || !wrap) return NULL;
+
+  // Release the model and nullify pointer to prevent double-free
+  model_release(wrap);
+
+  js_value_t *null_val;
+  js_get_null(env, &null_val);
+  return null_val;
+}
+
+// getModelCacheStats(): { models, totalSize, budget, hits, misses }
+// models lists { path, size, refs } for every registered model; refs is 0 for
+// idle models kept by the budget.
+static js_value_t *
+fn_get_model_cache_stats(js_env_t *env, js_callback_info_t *info) {
+  (void)info;
+  uv_once(&model_registry_once, model_registry_init);
+  uv_mutex_lock(&model_registry.lock);
+
+  js_value_t *result, *models, *val;
+  js_create_object(env, &result);
+  js_create_array(env, &models);
+
+  uint32_t i = 0;
+  uint64_t total = 0;
+  for (model_entry_t *e = model_registry.entries; e; e = e->next, i++) {
+    js_value_t *item;
+    js_create_object(env, &item);
+
+    js_create_string_utf8(env, (const utf8_t *)e->path, strlen(e->path), &val);
+    js_set_named_property(env, item, "path", val);
+
+    js_create_int64(env, (int64_t)e->size, &val);
+    js_set_named_property(env, item, "size", val);
+
+    js_create_int32(env, e->refs, &val);
+    js_set_named_property(env, item, "refs", val);
+
+    js_set_element(env, models, i, item);
+    total += e->size;
+  }
+  js_set_named_property(env, result, "models", models);
+
+  js_create_int64(env, (int64_t)total, &val);
+  js_set_named_property(env, result, "totalSize", val);
+
+  js_create_int64(env, (int64_t)model_registry.budget, &val);
+  js_set_named_property(env, result, "budget", val);
+
+  js_create_int64(env, (int64_t)model_registry.hits, &val);
+  js_set_named_property(env, result, "hits", val);
+
+  js_create_int64(env, (int64_t)model_registry.misses, &val);
+  js_set_named_property(env, result, "misses", val);
+
+  uv_mutex_unlock(&model_registry.lock);
+  return result;
+}
+
+// setModelCacheBudget(bytes: number): void
+// Idle models are kept while all registered models fit in bytes (default 0,
+// so a model is freed when its last handle is).
+static js_value_t *
+fn_set_model_cache_budget(js_env_t *env, js_callback_info_t *info) {
+  int err;
+  size_t argc = 1;
+  js_value_t *argv[1];
+
+  err = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
+  if (err < 0) return throw_error(env, "Failed to get callback info");
+
+  if (argc < 1) return throw_error(env, "Budget required");
+
+  int64_t budget;
+  err = js_get_value_int64(env, argv[0], &budget);
+  if (err < 0 || budget < 0) return throw_error(env, "Invalid budget");
+
+  uv_once(&model_registry_once, model_registry_init);
+  uv_mutex_lock(&model_registry.lock);
+  model_registry.budget = (uint64_t)budget;
+  model_registry_trim();
+  uv_mutex_unlock(&model_registry.lock);
+
+  js_value_t *undefined;
+  js_get_undefined(env, &undefined);
+  return undefined;
+}
+
+// clearModelCache(): void - free every idle model regardless of the budget
+static js_value_t *
+fn_clear_model_cache(js_env_t *env, js_callback_info_t *info) {
+  (void)info;
+  uv_once(&model_registry_once, model_registry_init);
+  uv_mutex_lock(&model_registry.lock);
+  uint64_t budget = model_registry.budget;
+  model_registry.budget = 0;
+  model_registry_trim();
+  model_registry.budget = budget;
+  uv_mutex_unlock(&model_registry.lock);
+
+  js_value_t *undefined;
+  js_get_undefined(env, &undefined);
+  return undefined;
+}
+
+// Parse CPU threadpool options (cpus, priority, strictCpu, poll) into tpp.
+// Sets *used if any were given. Throws and returns false on error.
+static bool
+parse_threadpool_params(js_env_t *env, js_value_t *opts, struct ggml_threadpool_params *tpp, bool *used) {
+  int err;
+  js_value_t *val;
+  bool has_prop;
+
+  // cpus: CPU indices the threads may run on
+  err = js_has_named_property(env, opts, "cpus", &has_prop);
+  if (err == 0 && has_prop) {
+    err = js_get_named_property(env, opts, "cpus", &val);
+    bool is_array = false;
+    if (err == 0) js_is_array(env, val, &is_array);
+    if (!is_array) {
+      throw_error(env, "cpus must be an array of CPU indices");
+      return false;
+    }
+
+    uint32_t n;
+    js_get_array_length(env, val, &n);
+    for (uint32_t i = 0; i < n; i++) {
+      js_value_t *item;
+      int32_t cpu;
+      js_get_element(env, val, i, &item);
+      js_get_value_int32(env, item, &cpu);
+      if (cpu < 0 || cpu >= GGML_MAX_N_THREADS) {
+        throw_error(env, "CPU index out of range");
+        return false;
+      }
+      tpp->cpumask[cpu] = true;
+    }
+    *used = true;
+  }
+
+  // priority (-1=low, 0=normal, 1=medium, 2=high, 3=realtime)
+  err = js_has_named_property(env, opts, "priority", &has_prop);
+  if (err == 0 && has_prop) {
+    err = js_get_named_property(env, opts, "priority", &val);
+    if (err == 0) {
+      int32_t n;
+      js_get_value_int32(env, val, &n);
+      tpp->prio = (enum ggml_sched_priority)n;
+      *used = true;
+    }
+  }
+
+  // strictCpu: pin each thread to its own CPU from the mask
+  err = js_has_named_property(env, opts, "strictCpu", &has_prop);
+  if (err == 0 && has_prop) {
+    err = js_get_named_property(env, opts, "strictCpu", &val);
+    if (err == 0) {
+      js_get_value_bool(env, val, &tpp->strict_cpu);
+      *used = true;
+    }
+  }
+
+  // poll: busy-wait level before sleeping (0-100)
+  err = js_has_named_property(env, opts, "poll", &has_prop);
+  if (err == 0 && has_prop) {
+    err = js_get_named_property(env, opts, "poll", &val);
+    if (err == 0) {
+      uint32_t n;
+      js_get_value_uint32(env, val, &n);
+      tpp->poll = n;
+      *used = true;
+    }
+  }
+
+  return true;
+}
+
+// createThreadPool(opts?: object): ThreadPool
+// A CPU threadpool that any number of contexts can attach to with the
+// threadPool option. Takes threads plus the same affinity options as
+// createContext (cpus, priority, strictCpu, poll).
+static js_value_t *
+fn_create_thread_pool(js_env_t *env, js_callback_info_t *info) {
+  int err;
+  size_t argc = 1;
+  js_value_t *argv[1];
+
+  err = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
+  if (err < 0) return throw_error(env, "Failed to get callback info");
+
+  int32_t n_threads = llama_context_default_params().n_threads;
+
+  struct ggml_threadpool_params tpp;
+  ggml_threadpool_params_init(&tpp, 0);
+
+  if (argc >= 1) {
+    js_value_t *val;
+    bool has_prop;
+    err = js_has_named_property(env, argv[0], "threads", &has_prop);
+    if (err == 0 && has_prop) {
+      err = js_get_named_property(env, argv[0], "threads", &val);
+      if (err == 0) js_get_value_int32(env, val, &n_threads);
+    }
+
+    bool used = false;
+    if (!parse_threadpool_params(env, argv[0], &tpp, &used)) return NULL;
+  }
+
+  if (n_threads < 1 || n_threads > GGML_MAX_N_THREADS) return throw_error(env, "Invalid thread count");
+  tpp.n_threads = n_threads;
+
+  threadpool_wrap_t *pool = (threadpool_wrap_t *)malloc(sizeof(threadpool_wrap_t));
+  if (!pool) return throw_error(env, "Failed to allocate wrapper");
+
+  pool->ptr = ggml_threadpool_new(&tpp);
+  if (!pool->ptr) {
+    free(pool);
+    return throw_error(env, "Failed to create threadpool");
+  }
+  pool->n_threads = n_threads;
+  pool->n_contexts = 0;
+  pool->released = false;
+  pool->finalized = false;
+  uv_mutex_init(&pool->lock);
+
+  js_value_t *result;
+  err = js_create_external(env, pool, finalize_thread_pool, NULL, &result);
+  if (err < 0) {
+    pool->finalized = true;
+    threadpool_maybe_free(pool);
+    return throw_error(env, "Failed to create thread pool wrapper");
+  }
+
+  return result;
+}
+
+// loadAdapter(model: Model, path: string): Adapter
+// Loads a LoRA adapter for model. Apply it to contexts with setAdapters().
+static js_value_t *
+fn_load_adapter(js_env_t *env, js_callback_info_t *info) {
+  int err;
+  size_t argc = 2;
+  js_value_t *argv[2];
+
+  err = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
+  if (err < 0) return throw_error(env, "Failed to get callback info");
+
+  if (argc < 2) return throw_error(env, "Model and path required");
+
+  model_wrap_t *model_wrap;
+  err = js_get_value_external(env, argv[0], (void **)&model_wrap);
+  if (err < 0 || !model_wrap || !model_wrap->ptr) return throw_error(env, "Invalid model");
+
+  char *path = get_string_value(env, argv[1]);
+  if (!path) return throw_error(env, "Invalid path");
+
+  struct llama_adapter_lora *lora = llama_adapter_lora_init(model_wrap->ptr, path);
+  free(path);
+  if (!lora) return throw_error(env, "Failed to load adapter");
+
+  adapter_wrap_t *adapter = (adapter_wrap_t *)calloc(1, sizeof(adapter_wrap_t));
+  if (!adapter) {
+    llama_adapter_lora_free(lora);
+    return throw_error(env, "Memory allocation failed");
+  }
+  adapter->ptr = lora;
+  adapter->model = model_wrap->ptr;
+
+  js_value_t *result;
+  err = js_create_external(env, adapter, finalize_adapter, NULL, &result);
+  if (err < 0) {
+    llama_adapter_lora_free(lora);
+    free(adapter);
+    return throw_error(env, "Failed to create external");
+  }
+
+  if (model_wrap->entry) {
+    adapter->entry = model_wrap->entry;
+    model_registry_retain(adapter->entry);
+  } else {
+    adapter->owner = model_wrap;
+    js_create_reference(env, argv[0], 1, &adapter->model_ref);
+  }
+
+  return result;
+}
+
+// freeAdapter(adapter: Adapter): void
+// The adapter is freed once no context uses it.
+static js_value_t *
+fn_free_adapter(js_env_t *env, js_callback_info_t *info) {
+  int err;
+  size_t argc = 1;
+  js_value_t *argv[1];
+
+  err = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
+  if (err < 0) return NULL;
+
+  adapter_wrap_t *adapter;
+  err = js_get_value_external(env, argv[0], (void **)&adapter);
+  if (err < 0 || !adapter) return NULL;
+
+  adapter->released = true;
+  adapter_maybe_free(adapter);
+
+  js_value_t *null_val;
+  js_get_null(env, &null_val);
+  return null_val;
+}
+
+// setAdapters(ctx: Context, adapters: { adapter: Adapter, scale: number }[]): boolean
+// Replaces the context's LoRA adapters. A change clears the context memory,
+// since cached state was computed with the old weights; returns whether the
+// adapters changed.
+static js_value_t *
+fn_set_adapters(js_env_t *env, js_callback_info_t *info) {
+  int err;
+  size_t argc = 2;
+  js_value_t *argv[2];
+
+  err = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
+  if (err < 0) return throw_error(env, "Failed to get callback info");
+
+  if (argc < 2) return throw_error(env, "Context and adapters required");
+
+  context_wrap_t *wrap;
+  err = js_get_value_external(env, argv[0], (void **)&wrap);
+  if (err < 0 || !wrap || !wrap->ptr) return throw_error(env, "Invalid context");
+  if (wrap->busy) return throw_error(env, "Context is busy");
+
+  bool is_array;
+  err = js_is_array(env, argv[1], &is_array);
+  if (err < 0 || !is_array) return throw_error(env, "Adapters must be an array");
+
+  uint32_t n;
+  js_get_array_length(env, argv[1], &n);
+
+  adapter_wrap_t **adapters = (adapter_wrap_t **)calloc(n ? n : 1, sizeof(adapter_wrap_t *));
+  float *scales = (float *)calloc(n ? n : 1, sizeof(float));
+  if (!adapters || !scales) {
+    free(adapters);
+    free(scales);
+    return throw_error(env, "Memory allocation failed");
+  }
+
+  const struct llama_model *model = llama_get_model(wrap->ptr);
+  const char *error = NULL;
+
+  for (uint32_t i = 0; i < n && !error; i++) {
+    js_value_t *item, *val;
+    js_get_element(env, argv[1], i, &item);
+
+    bool has_prop = false;
+    js_has_named_property(env, item, "adapter", &has_prop);
+    if (!has_prop) {
+      error = "Each entry needs an adapter";
+      break;
+    }
+    js_get_named_property(env, item, "adapter", &val);
+
+    adapter_wrap_t *adapter;
+    err = js_get_value_external(env, val, (void **)&adapter);
+    if (err < 0 || !adapter || !adapter->ptr || adapter->released) {
+      error = "Invalid adapter";
+      break;
+    }
+    // An unshared model that was freed took the adapter with it
+    bool model_alive = adapter->entry || (adapter->owner && adapter->owner->ptr);
+    if (!model_alive || adapter->model != model) {
+      error = "Adapter was loaded for a different model";
+      break;
+    }
+
+    double scale = 1.0;
+    js_has_named_property(env, item, "scale", &has_prop);
+    if (has_prop) {
+      js_get_named_property(env, item, "scale", &val);
+      js_get_value_double(env, val, &scale);
+    }
+
+    adapters[i] = adapter;
+    scales[i] = (float)scale;
+  }
+
+  if (error) {
+    free(adapters);
+    free(scales);
+    return throw_error(env, error);
+  }
+
+  bool changed = n != wrap->n_adapters;
+  for (uint32_t i = 0; i < n && !changed; i++) {
+    changed = adapters[i] != wrap->adapters[i] || scales[i] != wrap->adapter_scales[i];
+  }
+
+  if (!changed) {
+    free(adapters);
+    free(scales);
+  } else {
+    llama_clear_adapter_lora(wrap->ptr);
+    for (uint32_t i = 0; i < n && !error; i++) {
+      if (llama_set_adapter_lora(wrap->ptr, adapters[i]->ptr, scales[i]) != 0) error = "Failed to apply adapter";
+    }
+
+    // Take the new references before dropping the old ones
+    for (uint32_t i = 0; i < n; i++) adapters[i]->n_contexts++;
+    context_release_adapters(wrap);
+    wrap->adapters = adapters;
+    wrap->adapter_scales = scales;
+    wrap->n_adapters = n;
+
+    if (error) {
+      llama_clear_adapter_lora(wrap->ptr);
+      context_release_adapters(wrap);
+    }
+
+    context_invalidate_views(env, wrap);
+    llama_memory_t mem = llama_get_memory(wrap->ptr);
+    if (mem) llama_memory_clear(mem, true);
+    wrap->n_cached = 0;
+
+    if (error) return throw_error(env, error);
+  }
+
+  js_value_t *result;
+  js_get_boolean(env, changed, &result);
+  return result;
+}
+
+// freeThreadPool(pool: ThreadPool): void
+// The threads stop once every attached context has been freed too.
+static js_value_t *
+fn_free_thread_pool(js_env_t *env, js_callback_info_t *info) {
+  int err;
+  size_t argc = 1;
+  js_value_t *argv[1];
+
+  err = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
+  if (err < 0) return NULL;
+
+  threadpool_wrap_t *pool;
+  err = js_get_value_external(env, argv[0], (void **)&pool);
+  if (err < 0 || !pool) return NULL;
+
+  pool->released = true;
+  threadpool_maybe_free(pool);
+
+  js_value_t *null_val;
+  js_get_null(env, &null_val);
+  return null_val;
+}
+
+// KV cache types accepted by kvCacheTypeK / kvCacheTypeV
+static const enum ggml_type kv_cache_types[] = {
+  GGML_TYPE_F32, GGML_TYPE_F16, GGML_TYPE_BF16, GGML_TYPE_Q8_0,
+  GGML_TYPE_Q4_0, GGML_TYPE_Q4_1, GGML_TYPE_IQ4_NL, GGML_TYPE_Q5_0, GGML_TYPE_Q5_1,
+};
+
+// Parse a KV cache type name ("f16", "q8_0", ...) from opts[name] into *type.
+// Throws and returns false on an unknown name.
+static bool
+parse_kv_cache_type(js_env_t *env, js_value_t *opts, const char *name, enum ggml_type *type) {
+  char *str = get_string_property(env, opts, name);
+  if (!str) return true;
+
+  for (size_t i = 0; i < sizeof(kv_cache_types) / sizeof(kv_cache_types[0]); i++) {
+    if (strcmp(str, ggml_type_name(kv_cache_types[i])) == 0) {
+      *type = kv_cache_types[i];
+      free(str);
+      return true;
+    }
+  }
+
+  free(str);
+  throw_error(env, "Unsupported KV cache type (use f32, f16, bf16, q8_0, q4_0, q4_1, iq4_nl, q5_0 or q5_1)");
+  return false;
+}
+
+// createContext(model: Model, params?: object): Context
+static js_value_t *
+fn_create_context(js_env_t *env, js_callback_info_t *info) {
+  int err;
+  size_t argc = 2;
+  js_value_t *argv[2];
+
+  err = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
+  if (err < 0) return throw_error(env, "Failed to get callback info");
+
+  if (argc < 1) return throw_error(env, "Model required");
+
+  // Get model wrapper
+  model_wrap_t *model_wrap;
+  err = js_get_value_external(env, argv[0], (void **)&model_wrap);
+  if (err < 0 || !model_wrap || !model_wrap->ptr) return throw_error(env, "Invalid model");
+  
+  struct llama_model *model = model_wrap->ptr;
+
+  struct llama_context_params params = llama_context_default_params();
+  params.no_perf = false;
+
+  // CPU threadpool settings, used only if one of them is given
+  struct ggml_threadpool_params tpp;
+  ggml_threadpool_params_init(&tpp, 0);
+  bool use_threadpool = false;
+  threadpool_wrap_t *shared_pool = NULL;
+  bool threads_set = false;
+
+  bool shift = false;
+  uint32_t shift_keep = 0;
+  uint32_t shift_discard = 0;
+
+  // Parse optional params
+  if (argc >= 2) {
+    js_value_t *opts = argv[1];
+    js_value_t *val;
+    bool has_prop;
+
+    // Threads for generation (n_threads) and prompt processing (n_threads_batch)
+    err = js_has_named_property(env, opts, "threads", &has_prop);
+    if (err == 0 && has_prop) {
+      err = js_get_named_property(env, opts, "threads", &val);
+      if (err == 0) {
+        int32_t n;
+        js_get_value_int32(env, val, &n);
+        params.n_threads = n;
+        params.n_threads_batch = n;
+        threads_set = true;
+      }
+    }
+
+    err = js_has_named_property(env, opts, "threadsBatch", &has_prop);
+    if (err == 0 && has_prop) {
+      err = js_get_named_property(env, opts, "threadsBatch", &val);
+      if (err == 0) {
+        int32_t n;
+        js_get_value_int32(env, val, &n);
+        params.n_threads_batch = n;
+      }
+    }
+
+    if (!parse_threadpool_params(env, opts, &tpp, &use_threadpool)) return NULL;
+
+    // threadPool: shared ThreadPool handle
+    err = js_has_named_property(env, opts, "threadPool", &has_prop);
+    if (err == 0 && has_prop) {
+      err = js_get_named_property(env, opts, "threadPool", &val);
+      if (err == 0) {
+        js_value_type_t type;
+        js_typeof(env, val, &type);
+        if (type != js_undefined && type != js_null) {
+          err = js_get_value_external(env, val, (void **)&shared_pool);
+          if (err < 0 || !shared_pool || shared_pool->released) return throw_error(env, "Invalid thread pool");
+          if (use_threadpool) return throw_error(env, "threadPool can't be combined with cpus, priority, strictCpu or poll");
+        }
+      }
+    }
+
+    // n_ctx (context size)
+    err = js_has_named_property(env, opts, "contextSize", &has_prop);
+    if (err == 0 && has_prop) {
+      err = js_get_named_property(env, opts, "contextSize", &val);
+      if (err == 0) {
+        int32_t n;
+        js_get_value_int32(env, val, &n);
+        params.n_ctx = (uint32_t)n;
+      }
+    }
+
+    // n_batch
+    err = js_has_named_property(env, opts, "batchSize", &has_prop);
+    if (err == 0 && has_prop) {
+      err = js_get_named_property(env, opts, "batchSize", &val);
+      if (err == 0) {
+        int32_t n;
+        js_get_value_int32(env, val, &n);
+        params.n_batch = (uint32_t)n;
+      }
+    }
+
+    // embeddings
+    err = js_has_named_property(env, opts, "embeddings", &has_prop);
+    if (err == 0 && has_prop) {
+      err = js_get_named_property(env, opts, "embeddings", &val);
+      if (err == 0) {
+        bool embd;
+        js_get_value_bool(env, val, &embd);
+        params.embeddings = embd;
+      }
+    }
+
+    // n_seq_max (independent sequences sharing the context)
+    err = js_has_named_property(env, opts, "sequences", &has_prop);
+    if (err == 0 && has_prop) {
+      err = js_get_named_property(env, opts, "sequences", &val);
+      if (err == 0) {
+        int32_t n;
+        js_get_value_int32(env, val, &n);
+        params.n_seq_max = (uint32_t)n;
+      }
+    }
+
+    // poolingType (-1=unspecified, 0=none, 1=mean, 2=cls, 3=last, 4=rank)
     err = js_has_named_property(env, opts, "poolingType", &has_prop);
     if (err == 0 && has_prop) {
-      err = js_get_named_property(env, opts, "poolingType", &val);
-      if (err == 0) {
-        int32_t n;
-        js_get_value_int32(env, val, &n);
-        params.pooling_type = (enum llama_pooling_type)n;
+      err = js_get_named_property(env, opts, "poolingType", &val);
+      if (err == 0) {
+        int32_t n;
+        js_get_value_int32(env, val, &n);
+        params.pooling_type = (enum llama_pooling_type)n;
+      }
+    }
+
+    // n_ubatch (physical batch size)
+    err = js_has_named_property(env, opts, "ubatchSize", &has_prop);
+    if (err == 0 && has_prop) {
+      err = js_get_named_property(env, opts, "ubatchSize", &val);
+      if (err == 0) {
+        int32_t n;
+        js_get_value_int32(env, val, &n);
+        params.n_ubatch = (uint32_t)n;
+      }
+    }
+
+    // KV cache quantization
+    if (!parse_kv_cache_type(env, opts, "kvCacheTypeK", &params.type_k)) return NULL;
+    if (!parse_kv_cache_type(env, opts, "kvCacheTypeV", &params.type_v)) return NULL;
+
+    // contextShift: true, or { keep, discard }
+    err = js_has_named_property(env, opts, "contextShift", &has_prop);
+    if (err == 0 && has_prop) {
+      err = js_get_named_property(env, opts, "contextShift", &val);
+      js_value_type_t type = js_undefined;
+      if (err == 0) js_typeof(env, val, &type);
+      if (type == js_boolean) {
+        js_get_value_bool(env, val, &shift);
+      } else if (type == js_object) {
+        shift = true;
+        js_value_t *num;
+        js_has_named_property(env, val, "keep", &has_prop);
+        if (has_prop) {
+          js_get_named_property(env, val, "keep", &num);
+          js_get_value_uint32(env, num, &shift_keep);
+        }
+        js_has_named_property(env, val, "discard", &has_prop);
+        if (has_prop) {
+          js_get_named_property(env, val, "discard", &num);
+          js_get_value_uint32(env, num, &shift_discard);
+        }
+      }
+    }
+
+    // flashAttention: true, false or 'auto'
+    err = js_has_named_property(env, opts, "flashAttention", &has_prop);
+    if (err == 0 && has_prop) {
+      err = js_get_named_property(env, opts, "flashAttention", &val);
+      js_value_type_t type = js_undefined;
+      if (err == 0) js_typeof(env, val, &type);
+      if (type == js_boolean) {
+        bool enabled;
+        js_get_value_bool(env, val, &enabled);
+        params.flash_attn_type = enabled ? LLAMA_FLASH_ATTN_TYPE_ENABLED : LLAMA_FLASH_ATTN_TYPE_DISABLED;
+      } else if (type == js_string) {
+        char *str = get_string_value(env, val);
+        bool is_auto = str && strcmp(str, "auto") == 0;
+        free(str);
+        if (!is_auto) return throw_error(env, "flashAttention must be true, false or 'auto'");
+        params.flash_attn_type = LLAMA_FLASH_ATTN_TYPE_AUTO;
+      } else if (type != js_undefined) {
+        return throw_error(env, "flashAttention must be true, false or 'auto'");
+      }
+    }
+  }
+
+  // Quantized V rows are only read by the flash attention kernels
+  bool v_quantized = params.type_v != GGML_TYPE_F32 && params.type_v != GGML_TYPE_F16 && params.type_v != GGML_TYPE_BF16;
+  if (v_quantized && params.flash_attn_type == LLAMA_FLASH_ATTN_TYPE_DISABLED) {
+    return throw_error(env, "A quantized kvCacheTypeV requires flashAttention");
+  }
+
+  // Use the whole shared pool unless told otherwise
+  if (shared_pool && !threads_set) {
+    params.n_threads = shared_pool->n_threads;
+    params.n_threads_batch = shared_pool->n_threads;
+  }
+
+  struct llama_context *ctx = llama_init_from_model(model, params);
+  if (!ctx) return throw_error(env, "Failed to create context");
+
+  if (shift && !llama_memory_can_shift(llama_get_memory(ctx))) {
+    llama_free(ctx);
+    return throw_error(env, "contextShift is not supported by this model's context memory");
+  }
+
+  // Create wrapper to prevent double-free
+  context_wrap_t *wrap = (context_wrap_t *)malloc(sizeof(context_wrap_t));
+  if (!wrap) {
+    llama_free(ctx);
+    return throw_error(env, "Failed to allocate wrapper");
+  }
+  wrap->ptr = ctx;
+  wrap->busy = false;
+  wrap->free_pending = false;
+  wrap->embeddings = params.embeddings;
+  wrap->output_base = 0;
+  wrap->cached = NULL;
+  wrap->n_cached = 0;
+  wrap->cap_cached = 0;
+  wrap->cache_hit_tokens = 0;
+  wrap->cache_miss_tokens = 0;
+  // BOS stays in front of the kept tokens
+  wrap->shift = shift;
+  wrap->shift_keep = shift_keep + (llama_vocab_get_add_bos(llama_model_get_vocab(model)) ? 1 : 0);
+  wrap->shift_discard = shift_discard;
+  wrap->shifts = 0;
+  wrap->shifted_tokens = 0;
+  wrap->shift_offset = 0;
+  wrap->threadpool = NULL;
+  wrap->threadpool_batch = NULL;
+  wrap->shared_pool = NULL;
+  wrap->type_k = params.type_k;
+  wrap->type_v = params.type_v;
+  wrap->views = NULL;
+  wrap->n_views = 0;
+  wrap->cap_views = 0;
+  wrap->adapters = NULL;
+  wrap->adapter_scales = NULL;
+  wrap->n_adapters = 0;
+  wrap->decode_calls = 0;
+  wrap->decode_tokens = 0;
+  wrap->decode_ns = 0;
+  wrap->decode_max_batch = 0;
+  wrap->stream = NULL;
+
+  if (shared_pool) {
+    shared_pool->n_contexts++;
+    wrap->shared_pool = shared_pool;
+    llama_attach_threadpool(ctx, shared_pool->ptr, NULL);
+  }
+
+  if (use_threadpool) {
+    tpp.n_threads = params.n_threads;
+    wrap->threadpool = ggml_threadpool_new(&tpp);
+
+    // Prompt processing gets its own pool when the thread counts differ
+    if (wrap->threadpool && params.n_threads_batch != params.n_threads) {
+      tpp.n_threads = params.n_threads_batch;
+      wrap->threadpool_batch = ggml_threadpool_new(&tpp);
+    }
+
+    if (!wrap->threadpool || (params.n_threads_batch != params.n_threads && !wrap->threadpool_batch)) {
+      context_release(wrap);
+      free(wrap);
+      return throw_error(env, "Failed to create threadpool");
+    }
+
+    llama_attach_threadpool(ctx, wrap->threadpool, wrap->threadpool_batch);
+  }
+
+  js_value_t *result;
+  err = js_create_external(env, wrap, finalize_context, NULL, &result);
+  if (err < 0) {
+    context_release(wrap);
+    free(wrap);
+    return throw_error(env, "Failed to create context wrapper");
+  }
+
+  // Skip type tagging - js_add_type_tag crashes in Bare runtime
+  // err = js_add_type_tag(env, result, &llama_context_type_tag);
+
+  return result;
+}
+
+// freeContext(ctx: Context): void
+static js_value_t *
+fn_free_context(js_env_t *env, js_callback_info_t *info) {
+  int err;
+  size_t argc = 1;
+  js_value_t *argv[1];
+
+  err = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
+  if (err < 0) return NULL;
+
+  // Get wrapper from external
+  context_wrap_t *wrap;
+  err = js_get_value_external(env, argv[0], (void **)&wrap);
+  if (err < 0 || !wrap) return NULL;
+
+  context_invalidate_views(env, wrap);
+
+  // Defer until in-flight async work completes
+  if (wrap->busy) {
+    wrap->free_pending = true;
+  } else if (wrap->ptr) {
+    // Free the context and nullify pointer to prevent double-free
+    context_release(wrap);
+  }
+
+  js_value_t *null_val;
+  js_get_null(env, &null_val);
+  return null_val;
+}
+
+// clearMemory(ctx: Context): void - Clear context memory for reuse
+static js_value_t *
+fn_clear_memory(js_env_t *env, js_callback_info_t *info) {
+  int err;
+  size_t argc = 1;
+  js_value_t *argv[1];
+
+  err = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
+  if (err < 0) return throw_error(env, "Failed to get callback info");
+
+  context_wrap_t *wrap;
+  err = js_get_value_external(env, argv[0], (void **)&wrap);
+  if (err < 0 || !wrap || !wrap->ptr) return throw_error(env, "Invalid context");
+  if (wrap->busy) return throw_error(env, "Context is busy");
+  context_invalidate_views(env, wrap);
+
+  struct llama_context *ctx = wrap->ptr;
+
+  llama_memory_t mem = llama_get_memory(ctx);
+  if (mem) {
+    llama_memory_clear(mem, true);
+  }
+  wrap->n_cached = 0;
+
+  js_value_t *undefined;
+  js_get_undefined(env, &undefined);
+  return undefined;
+}
+
+// getKvCacheSize(ctx: Context): { k: number, v: number, total: number }
+// Estimated bytes of the KV cache buffers, computed from model metadata rather
+// than read back from the allocated buffers: one K and one V row per layer and
+// context cell, at the configured cache types and the model-wide n_head_kv.
+// Models with sliding-window or recurrent layers, or with n_head_kv varying by
+// layer, can differ substantially.
+static js_value_t *
+fn_get_kv_cache_size(js_env_t *env, js_callback_info_t *info) {
+  int err;
+  size_t argc = 1;
+  js_value_t *argv[1];
+
+  err = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
+  if (err < 0) return throw_error(env, "Failed to get callback info");
+
+  context_wrap_t *wrap;
+  err = js_get_value_external(env, argv[0], (void **)&wrap);
+  if (err < 0 || !wrap || !wrap->ptr) return throw_error(env, "Invalid context");
+
+  const struct llama_model *model = llama_get_model(wrap->ptr);
+  int64_t n_layer = llama_model_n_layer(model);
+  int64_t n_head = llama_model_n_head(model);
+  int64_t n_head_kv = llama_model_n_head_kv(model);
+  int64_t n_ctx = llama_n_ctx(wrap->ptr);
+
+  // Head sizes from metadata, falling back to n_embd / n_head
+  int64_t head_k = n_head > 0 ? llama_model_n_embd(model) / n_head : 0;
+  int64_t head_v = head_k;
+
+  char arch[64], key[128], buf[32];
+  if (llama_model_meta_val_str(model, "general.architecture", arch, sizeof(arch)) > 0) {
+    snprintf(key, sizeof(key), "%s.attention.key_length", arch);
+    if (llama_model_meta_val_str(model, key, buf, sizeof(buf)) > 0) head_k = atoll(buf);
+    snprintf(key, sizeof(key), "%s.attention.value_length", arch);
+    if (llama_model_meta_val_str(model, key, buf, sizeof(buf)) > 0) head_v = atoll(buf);
+  }
+
+  double k = (double)n_layer * n_ctx * ggml_row_size(wrap->type_k, head_k * n_head_kv);
+  double v = (double)n_layer * n_ctx * ggml_row_size(wrap->type_v, head_v * n_head_kv);
+
+  js_value_t *result, *val;
+  js_create_object(env, &result);
+
+  js_create_double(env, k, &val);
+  js_set_named_property(env, result, "k", val);
+
+  js_create_double(env, v, &val);
+  js_set_named_property(env, result, "v", val);
+
+  js_create_double(env, k + v, &val);
+  js_set_named_property(env, result, "total", val);
+
+  return result;
+}
+
+// setThreads(ctx: Context, threads: number, threadsBatch?: number): void
+// With an attached threadpool, counts above the pool size are capped to it.
+static js_value_t *
+fn_set_threads(js_env_t *env, js_callback_info_t *info) {
+  int err;
+  size_t argc = 3;
+  js_value_t *argv[3];
+
+  err = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
+  if (err < 0) return throw_error(env, "Failed to get callback info");
+
+  if (argc < 2) return throw_error(env, "Context and threads required");
+
+  context_wrap_t *wrap;
+  err = js_get_value_external(env, argv[0], (void **)&wrap);
+  if (err < 0 || !wrap || !wrap->ptr) return throw_error(env, "Invalid context");
+  if (wrap->busy) return throw_error(env, "Context is busy");
+
+  int32_t n_threads;
+  err = js_get_value_int32(env, argv[1], &n_threads);
+  if (err < 0 || n_threads < 1) return throw_error(env, "Invalid thread count");
+
+  int32_t n_threads_batch = n_threads;
+  if (argc >= 3) {
+    js_value_type_t type;
+    js_typeof(env, argv[2], &type);
+    if (type != js_undefined) {
+      err = js_get_value_int32(env, argv[2], &n_threads_batch);
+      if (err < 0 || n_threads_batch < 1) return throw_error(env, "Invalid thread count");
+    }
+  }
+
+  llama_set_n_threads(wrap->ptr, n_threads, n_threads_batch);
+
+  js_value_t *undefined;
+  js_get_undefined(env, &undefined);
+  return undefined;
+}
+
+// getThreads(ctx: Context): { threads: number, threadsBatch: number }
+static js_value_t *
+fn_get_threads(js_env_t *env, js_callback_info_t *info) {
+  int err;
+  size_t argc = 1;
+  js_value_t *argv[1];
+
+  err = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
+  if (err < 0) return throw_error(env, "Failed to get callback info");
+
+  context_wrap_t *wrap;
+  err = js_get_value_external(env, argv[0], (void **)&wrap);
+  if (err < 0 || !wrap || !wrap->ptr) return throw_error(env, "Invalid context");
+
+  js_value_t *result, *val;
+  js_create_object(env, &result);
+
+  js_create_int32(env, llama_n_threads(wrap->ptr), &val);
+  js_set_named_property(env, result, "threads", val);
+
+  js_create_int32(env, llama_n_threads_batch(wrap->ptr), &val);
+  js_set_named_property(env, result, "threadsBatch", val);
+
+  return result;
+}
+
+// getCacheStats(ctx: Context): { cachedTokens, hitTokens, missTokens, shifts, shiftedTokens }
+// hitTokens and missTokens count prompt tokens reused from and decoded into
+// the KV cache by reusePrefix decodes. shifts counts context shifts and
+// shiftedTokens the tokens they discarded.
+static js_value_t *
+fn_get_cache_stats(js_env_t *env, js_callback_info_t *info) {
+  int err;
+  size_t argc = 1;
+  js_value_t *argv[1];
+
+  err = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
+  if (err < 0) return throw_error(env, "Failed to get callback info");
+
+  context_wrap_t *wrap;
+  err = js_get_value_external(env, argv[0], (void **)&wrap);
+  if (err < 0 || !wrap || !wrap->ptr) return throw_error(env, "Invalid context");
+
+  js_value_t *result, *val;
+  js_create_object(env, &result);
+
+  js_create_int64(env, (int64_t)wrap->n_cached, &val);
+  js_set_named_property(env, result, "cachedTokens", val);
+
+  js_create_int64(env, (int64_t)wrap->cache_hit_tokens, &val);
+  js_set_named_property(env, result, "hitTokens", val);
+
+  js_create_int64(env, (int64_t)wrap->cache_miss_tokens, &val);
+  js_set_named_property(env, result, "missTokens", val);
+
+  js_create_int64(env, (int64_t)wrap->shifts, &val);
+  js_set_named_property(env, result, "shifts", val);
+
+  js_create_int64(env, (int64_t)wrap->shifted_tokens, &val);
+  js_set_named_property(env, result, "shiftedTokens", val);
+
+  return result;
+}
+
+// getPerf(ctx: Context): object
+// llama.cpp's timings (prompt tokens are those decoded in batches of more than
+// one, eval tokens the single-token decodes) plus the binding's own counts of
+// llama_decode calls, since creation or the last resetPerf.
+static js_value_t *
+fn_get_perf(js_env_t *env, js_callback_info_t *info) {
+  int err;
+  size_t argc = 1;
+  js_value_t *argv[1];
+
+  err = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
+  if (err < 0) return throw_error(env, "Failed to get callback info");
+
+  context_wrap_t *wrap;
+  err = js_get_value_external(env, argv[0], (void **)&wrap);
+  if (err < 0 || !wrap || !wrap->ptr) return throw_error(env, "Invalid context");
+  if (wrap->busy) return throw_error(env, "Context is busy");
+
+  struct llama_perf_context_data perf = llama_perf_context(wrap->ptr);
+
+  js_value_t *result, *val;
+  js_create_object(env, &result);
+
+  js_create_double(env, perf.t_load_ms, &val);
+  js_set_named_property(env, result, "loadMs", val);
+
+  js_create_double(env, perf.t_p_eval_ms, &val);
+  js_set_named_property(env, result, "promptMs", val);
+
+  js_create_int32(env, perf.n_p_eval, &val);
+  js_set_named_property(env, result, "promptTokens", val);
+
+  js_create_double(env, perf.t_eval_ms, &val);
+  js_set_named_property(env, result, "evalMs", val);
+
+  js_create_int32(env, perf.n_eval, &val);
+  js_set_named_property(env, result, "evalTokens", val);
+
+  js_create_int32(env, perf.n_reused, &val);
+  js_set_named_property(env, result, "graphsReused", val);
+
+  js_create_int64(env, (int64_t)wrap->decode_calls, &val);
+  js_set_named_property(env, result, "decodeCalls", val);
+
+  js_create_int64(env, (int64_t)wrap->decode_tokens, &val);
+  js_set_named_property(env, result, "decodeTokens", val);
+
+  js_create_double(env, (double)wrap->decode_ns / 1e6, &val);
+  js_set_named_property(env, result, "decodeMs", val);
+
+  js_create_uint32(env, wrap->decode_max_batch, &val);
+  js_set_named_property(env, result, "maxBatch", val);
+
+  return result;
+}
+
+// resetPerf(ctx: Context): void
+static js_value_t *
+fn_reset_perf(js_env_t *env, js_callback_info_t *info) {
+  int err;
+  size_t argc = 1;
+  js_value_t *argv[1];
+
+  err = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
+  if (err < 0) return throw_error(env, "Failed to get callback info");
+
+  context_wrap_t *wrap;
+  err = js_get_value_external(env, argv[0], (void **)&wrap);
+  if (err < 0 || !wrap || !wrap->ptr) return throw_error(env, "Invalid context");
+  if (wrap->busy) return throw_error(env, "Context is busy");
+
+  llama_perf_context_reset(wrap->ptr);
+  wrap->decode_calls = 0;
+  wrap->decode_tokens = 0;
+  wrap->decode_ns = 0;
+  wrap->decode_max_batch = 0;
+
+  js_value_t *null_val;
+  js_get_null(env, &null_val);
+  return null_val;
+}
+
+// Lark grammar text for the json or lark sampler option, or NULL if neither
+// is set. Caller frees.
+static char *
+get_grammar_text(js_env_t *env, js_value_t *opts) {
+  char *json_grammar = get_string_property(env, opts, "json");
+  if (json_grammar) {
+    // Wrap JSON schema in Lark grammar format for llguidance
+    char *wrapped_grammar = (char *)malloc(strlen(json_grammar) + 64);
+    if (wrapped_grammar) sprintf(wrapped_grammar, "%%llguidance {}\nstart: %%json %s", json_grammar);
+    free(json_grammar);
+    return wrapped_grammar;
+  }
+  return get_string_property(env, opts, "lark");
+}
+
+// compileGrammar(model: Model, opts: { json?: string, lark?: string }): Grammar
+// Compiles a grammar once; samplers created with { grammar } clone it.
+static js_value_t *
+fn_compile_grammar(js_env_t *env, js_callback_info_t *info) {
+  int err;
+  size_t argc = 2;
+  js_value_t *argv[2];
+
+  err = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
+  if (err < 0) return throw_error(env, "Failed to get callback info");
+
+  if (argc < 2) return throw_error(env, "Model and grammar required");
+
+  model_wrap_t *model_wrap;
+  err = js_get_value_external(env, argv[0], (void **)&model_wrap);
+  if (err < 0 || !model_wrap || !model_wrap->ptr) return throw_error(env, "Invalid model");
+
+  char *grammar_text = get_grammar_text(env, argv[1]);
+  if (!grammar_text) return throw_error(env, "json or lark grammar required");
+
+  const struct llama_vocab *vocab = llama_model_get_vocab(model_wrap->ptr);
+  struct llama_sampler *grammar = grammar_cache_get(vocab, grammar_text);
+  free(grammar_text);
+  if (!grammar) return throw_error(env, "Failed to compile grammar");
+
+  grammar_wrap_t *wrap = (grammar_wrap_t *)calloc(1, sizeof(grammar_wrap_t));
+  if (!wrap) {
+    llama_sampler_free(grammar);
+    return throw_error(env, "Memory allocation failed");
+  }
+  wrap->ptr = grammar;
+  wrap->vocab = vocab;
+
+  js_value_t *result;
+  err = js_create_external(env, wrap, finalize_grammar, NULL, &result);
+  if (err < 0) {
+    llama_sampler_free(grammar);
+    free(wrap);
+    return throw_error(env, "Failed to create external");
+  }
+
+  js_create_reference(env, argv[0], 1, &wrap->model_ref);
+
+  return result;
+}
+
+// freeGrammar(grammar: Grammar): void
+static js_value_t *
+fn_free_grammar(js_env_t *env, js_callback_info_t *info) {
+  int err;
+  size_t argc = 1;
+  js_value_t *argv[1];
+
+  err = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
+  if (err < 0) return NULL;
+
+  grammar_wrap_t *wrap;
+  err = js_get_value_external(env, argv[0], (void **)&wrap);
+  if (err < 0 || !wrap) return NULL;
+
+  if (wrap->ptr) {
+    llama_sampler_free(wrap->ptr);
+    wrap->ptr = NULL;
+  }
+  if (wrap->model_ref) {
+    js_delete_reference(env, wrap->model_ref);
+    wrap->model_ref = NULL;
+  }
+
+  js_value_t *null_val;
+  js_get_null(env, &null_val);
+  return null_val;
+}
+
+// getGrammarCacheStats(): { entries, hits, misses }
+static js_value_t *
+fn_get_grammar_cache_stats(js_env_t *env, js_callback_info_t *info) {
+  (void)info;
+  uv_once(&grammar_cache_once, grammar_cache_init);
+  uv_mutex_lock(&grammar_cache.lock);
+  size_t n_entries = grammar_cache.n_entries;
+  uint64_t hits = grammar_cache.hits;
+  uint64_t misses = grammar_cache.misses;
+  uv_mutex_unlock(&grammar_cache.lock);
+
+  js_value_t *result, *val;
+  js_create_object(env, &result);
+  js_create_int64(env, (int64_t)n_entries, &val);
+  js_set_named_property(env, result, "entries", val);
+  js_create_int64(env, (int64_t)hits, &val);
+  js_set_named_property(env, result, "hits", val);
+  js_create_int64(env, (int64_t)misses, &val);
+  js_set_named_property(env, result, "misses", val);
+  return result;
+}
+
+// createSampler(model: Model, params?: object): Sampler
+static js_value_t *
+fn_create_sampler(js_env_t *env, js_callback_info_t *info) {
+  int err;
+  size_t argc = 2;
+  js_value_t *argv[2];
+
+  err = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
+  if (err < 0) return throw_error(env, "Failed to get callback info");
+
+  if (argc < 1) return throw_error(env, "Model required");
+
+  // Get model for vocab access (needed for grammar)
+  model_wrap_t *model_wrap;
+  err = js_get_value_external(env, argv[0], (void **)&model_wrap);
+  if (err < 0 || !model_wrap || !model_wrap->ptr) return throw_error(env, "Invalid model");
+  
+  struct llama_model *model = model_wrap->ptr;
+
+  const struct llama_vocab *vocab = llama_model_get_vocab(model);
+
+  struct llama_sampler_chain_params sparams = llama_sampler_chain_default_params();
+  sparams.no_perf = false;
+  struct llama_sampler *sampler = llama_sampler_chain_init(sparams);
+
+  // Default: greedy sampling
+  float temp = 0.0f;
+  int32_t top_k = 40;
+  float top_p = 0.95f;
+
+  // Grammar options (llguidance)
+  char *grammar_text = NULL;
+  grammar_wrap_t *grammar_wrap = NULL;
+
+  if (argc >= 2) {
+    js_value_t *opts = argv[1];
+    js_value_t *val;
+    bool has_prop;
+
+    err = js_has_named_property(env, opts, "temp", &has_prop);
+    if (err == 0 && has_prop) {
+      err = js_get_named_property(env, opts, "temp", &val);
+      if (err == 0) {
+        double d;
+        js_get_value_double(env, val, &d);
+        temp = (float)d;
+      }
+    }
+
+    err = js_has_named_property(env, opts, "topK", &has_prop);
+    if (err == 0 && has_prop) {
+      err = js_get_named_property(env, opts, "topK", &val);
+      if (err == 0) {
+        js_get_value_int32(env, val, &top_k);
+      }
+    }
+
+    err = js_has_named_property(env, opts, "topP", &has_prop);
+    if (err == 0 && has_prop) {
+      err = js_get_named_property(env, opts, "topP", &val);
+      if (err == 0) {
+        double d;
+        js_get_value_double(env, val, &d);
+        top_p = (float)d;
+      }
+    }
+
+    // Grammar options (llguidance): a compiled grammar, json or lark
+    err = js_has_named_property(env, opts, "grammar", &has_prop);
+    if (err == 0 && has_prop) {
+      err = js_get_named_property(env, opts, "grammar", &val);
+      js_value_type_t type = js_undefined;
+      if (err == 0) js_typeof(env, val, &type);
+      if (type != js_undefined && type != js_null) {
+        err = js_get_value_external(env, val, (void **)&grammar_wrap);
+        if (err < 0 || !grammar_wrap || !grammar_wrap->ptr) {
+          llama_sampler_free(sampler);
+          return throw_error(env, "Invalid grammar");
+        }
+        if (grammar_wrap->vocab != vocab) {
+          llama_sampler_free(sampler);
+          return throw_error(env, "Grammar was compiled for a different model");
+        }
+      }
+    }
+
+    if (!grammar_wrap) grammar_text = get_grammar_text(env, opts);
+  }
+
+  // Add grammar sampler first if specified (must filter logits before sampling)
+  if (grammar_wrap) {
+    struct llama_sampler *grammar = llama_sampler_clone(grammar_wrap->ptr);
+    if (grammar) {
+      llama_sampler_chain_add(sampler, grammar);
+    }
+  } else if (grammar_text) {
+    struct llama_sampler *grammar = grammar_cache_get(vocab, grammar_text);
+    if (grammar) {
+      llama_sampler_chain_add(sampler, grammar);
+    }
+    free(grammar_text);
+  }
+
+  // Build sampler chain (after grammar filtering)
+  if (temp > 0) {
+    llama_sampler_chain_add(sampler, llama_sampler_init_top_k(top_k));
+    llama_sampler_chain_add(sampler, llama_sampler_init_top_p(top_p, 1));
+    llama_sampler_chain_add(sampler, llama_sampler_init_temp(temp));
+    llama_sampler_chain_add(sampler, llama_sampler_init_dist(0));
+  } else {
+    llama_sampler_chain_add(sampler, llama_sampler_init_greedy());
+  }
+
+  // Create wrapper to prevent double-free
+  sampler_wrap_t *wrap = (sampler_wrap_t *)malloc(sizeof(sampler_wrap_t));
+  if (!wrap) {
+    llama_sampler_free(sampler);
+    return throw_error(env, "Failed to allocate wrapper");
+  }
+  wrap->ptr = sampler;
+  wrap->busy = false;
+  wrap->free_pending = false;
+
+  js_value_t *result;
+  err = js_create_external(env, wrap, finalize_sampler, NULL, &result);
+  if (err < 0) {
+    llama_sampler_free(sampler);
+    free(wrap);
+    return throw_error(env, "Failed to create sampler wrapper");
+  }
+
+  // Skip type tagging - js_add_type_tag crashes in Bare runtime
+  // err = js_add_type_tag(env, result, &llama_sampler_type_tag);
+
+  return result;
+}
+
+// freeSampler(sampler: Sampler): void
+static js_value_t *
+fn_free_sampler(js_env_t *env, js_callback_info_t *info) {
+  int err;
+  size_t argc = 1;
+  js_value_t *argv[1];
+
+  err = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
+  if (err < 0) return NULL;
+
+  // Get wrapper from external
+  sampler_wrap_t *wrap;
+  err = js_get_value_external(env, argv[0], (void **)&wrap);
+  if (err < 0 || !wrap) return NULL;
+
+  // Defer until in-flight async work completes
+  if (wrap->busy) {
+    wrap->free_pending = true;
+  } else if (wrap->ptr) {
+    // Free the sampler and nullify pointer to prevent double-free
+    llama_sampler_free(wrap->ptr);
+    wrap->ptr = NULL;
+  }
+
+  js_value_t *null_val;
+  js_get_null(env, &null_val);
+  return null_val;
+}
+
+// getSamplerPerf(sampler: Sampler): { sampleMs, samples }
+static js_value_t *
+fn_get_sampler_perf(js_env_t *env, js_callback_info_t *info) {
+  int err;
+  size_t argc = 1;
+  js_value_t *argv[1];
+
+  err = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
+  if (err < 0) return throw_error(env, "Failed to get callback info");
+
+  sampler_wrap_t *wrap;
+  err = js_get_value_external(env, argv[0], (void **)&wrap);
+  if (err < 0 || !wrap || !wrap->ptr) return throw_error(env, "Invalid sampler");
+  if (wrap->busy) return throw_error(env, "Sampler is busy");
+
+  struct llama_perf_sampler_data perf = llama_perf_sampler(wrap->ptr);
+
+  js_value_t *result, *val;
+  js_create_object(env, &result);
+
+  js_create_double(env, perf.t_sample_ms, &val);
+  js_set_named_property(env, result, "sampleMs", val);
+
+  js_create_int32(env, perf.n_sample, &val);
+  js_set_named_property(env, result, "samples", val);
+
+  return result;
+}
+
+// resetSamplerPerf(sampler: Sampler): void
+static js_value_t *
+fn_reset_sampler_perf(js_env_t *env, js_callback_info_t *info) {
+  int err;
+  size_t argc = 1;
+  js_value_t *argv[1];
+
+  err = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
+  if (err < 0) return throw_error(env, "Failed to get callback info");
+
+  sampler_wrap_t *wrap;
+  err = js_get_value_external(env, argv[0], (void **)&wrap);
+  if (err < 0 || !wrap || !wrap->ptr) return throw_error(env, "Invalid sampler");
+  if (wrap->busy) return throw_error(env, "Sampler is busy");
+
+  llama_perf_sampler_reset(wrap->ptr);
+
+  js_value_t *null_val;
+  js_get_null(env, &null_val);
+  return null_val;
+}
+
+// Tokenize text with special tokens added and parsed, as tokenize() does.
+// Returns a malloc'd array, or NULL on failure.
+static llama_token *
+tokenize_text(const struct llama_vocab *vocab, const char *text, size_t text_len, bool add_special, size_t *n_out) {
+  int32_t max_tokens = (int32_t)text_len + 16;
+  llama_token *tokens = (llama_token *)malloc(max_tokens * sizeof(llama_token));
+  if (!tokens) return NULL;
+
+  int32_t n = llama_tokenize(vocab, text, (int32_t)text_len, tokens, max_tokens, add_special, true);
+  if (n < 0) {
+    max_tokens = -n;
+    llama_token *grown = (llama_token *)realloc(tokens, max_tokens * sizeof(llama_token));
+    if (!grown) {
+      free(tokens);
+      return NULL;
+    }
+    tokens = grown;
+    n = llama_tokenize(vocab, text, (int32_t)text_len, tokens, max_tokens, add_special, true);
+  }
+
+  if (n < 0) {
+    free(tokens);
+    return NULL;
+  }
+
+  *n_out = (size_t)n;
+  return tokens;
+}
+
+// tokenize(model: Model, text: string, addBos: boolean): Int32Array
+static js_value_t *
+fn_tokenize(js_env_t *env, js_callback_info_t *info) {
+  int err;
+  size_t argc = 3;
+  js_value_t *argv[3];
+
+  err = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
+  if (err < 0) return throw_error(env, "Failed to get callback info");
+
+  if (argc < 2) return throw_error(env, "Model and text required");
+
+  // Get model wrapper
+  model_wrap_t *model_wrap;
+  err = js_get_value_external(env, argv[0], (void **)&model_wrap);
+  if (err < 0 || !model_wrap || !model_wrap->ptr) return throw_error(env, "Invalid model");
+  
+  struct llama_model *model = model_wrap->ptr;
+
+  // Get text
+  size_t text_len;
+  err = js_get_value_string_utf8(env, argv[1], NULL, 0, &text_len);
+  if (err < 0) return throw_error(env, "Invalid text");
+
+  char *text = (char *)malloc(text_len + 1);
+  if (!text) return throw_error(env, "Memory allocation failed");
+
+  err = js_get_value_string_utf8(env, argv[1], (utf8_t *)text, text_len + 1, NULL);
+  if (err < 0) {
+    free(text);
+    return throw_error(env, "Failed to read text");
+  }
+
+  bool add_bos = true;
+  if (argc >= 3) {
+    js_get_value_bool(env, argv[2], &add_bos);
+  }
+
+  const struct llama_vocab *vocab = llama_model_get_vocab(model);
+
+  size_t n_tokens;
+  llama_token *tokens = tokenize_text(vocab, text, text_len, add_bos, &n_tokens);
+  free(text);
+
+  if (!tokens) return throw_error(env, "Tokenization failed");
+
+  metrics_record_tokenize(1, text_len, n_tokens);
+
+  // Create Int32Array
+  js_value_t *array_buffer;
+  void *data;
+  err = js_create_arraybuffer(env, n_tokens * sizeof(int32_t), &data, &array_buffer);
+  if (err < 0) {
+    free(tokens);
+    return throw_error(env, "Failed to create array buffer");
+  }
+
+  memcpy(data, tokens, n_tokens * sizeof(int32_t));
+  free(tokens);
+
+  js_value_t *result;
+  err = js_create_typedarray(env, js_int32array, n_tokens, array_buffer, 0, &result);
+  if (err < 0) return throw_error(env, "Failed to create typed array");
+
+  return result;
+}
+
+typedef struct {
+  const struct llama_vocab *vocab;
+  const char *text;
+  const size_t *text_offsets;
+  uint32_t *counts;
+  size_t begin;
+  size_t end;
+  bool add_special;
+  bool parse_special;
+  llama_token *tokens;
+  size_t n_tokens;
+  size_t cap_tokens;
+  bool failed;
+  uv_thread_t thread;
+} tokenize_worker_t;
+
+static bool
+tokenize_worker_reserve(tokenize_worker_t *w, size_t n) {
+  if (w->n_tokens + n <= w->cap_tokens) return true;
+  size_t cap = w->cap_tokens * 2;
+  if (cap < w->n_tokens + n) cap = w->n_tokens + n;
+  llama_token *tokens = (llama_token *)realloc(w->tokens, cap * sizeof(llama_token));
+  if (!tokens) return false;
+  w->tokens = tokens;
+  w->cap_tokens = cap;
+  return true;
+}
+
+// Tokenizes inputs [begin, end) back to back into the worker's own buffer.
+// Only reads the vocab, so workers can share one model.
+static void
+tokenize_worker_run(void *arg) {
+  tokenize_worker_t *w = (tokenize_worker_t *)arg;
+
+  for (size_t i = w->begin; i < w->end; i++) {
+    const char *text = w->text + w->text_offsets[i];
+    int32_t text_len = (int32_t)(w->text_offsets[i + 1] - w->text_offsets[i]);
+
+    if (!tokenize_worker_reserve(w, (size_t)text_len + 16)) {
+      w->failed = true;
+      return;
+    }
+
+    int32_t n = llama_tokenize(w->vocab, text, text_len, w->tokens + w->n_tokens, (int32_t)(w->cap_tokens - w->n_tokens), w->add_special, w->parse_special);
+    if (n < 0) {
+      if (!tokenize_worker_reserve(w, (size_t)-n)) {
+        w->failed = true;
+        return;
+      }
+      n = llama_tokenize(w->vocab, text, text_len, w->tokens + w->n_tokens, (int32_t)(w->cap_tokens - w->n_tokens), w->add_special, w->parse_special);
+    }
+    if (n < 0) {
+      w->failed = true;
+      return;
+    }
+
+    w->counts[i] = (uint32_t)n;
+    w->n_tokens += n;
+  }
+}
+
+// tokenizeBatch(model: Model, texts: string[], opts?: object): { tokens: Int32Array, offsets: Uint32Array }
+// Tokenizes every text into one flat array; text i is tokens[offsets[i]..offsets[i + 1]].
+// opts: { addSpecial?: boolean, parseSpecial?: boolean, threads?: number, out?: Int32Array }
+static js_value_t *
+fn_tokenize_batch(js_env_t *env, js_callback_info_t *info) {
+  int err;
+  size_t argc = 3;
+  js_value_t *argv[3];
+
+  err = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
+  if (err < 0) return throw_error(env, "Failed to get callback info");
+
+  if (argc < 2) return throw_error(env, "Model and texts required");
+
+  model_wrap_t *model_wrap;
+  err = js_get_value_external(env, argv[0], (void **)&model_wrap);
+  if (err < 0 || !model_wrap || !model_wrap->ptr) return throw_error(env, "Invalid model");
+
+  bool is_array;
+  err = js_is_array(env, argv[1], &is_array);
+  if (err < 0 || !is_array) return throw_error(env, "Texts must be an array of strings");
+
+  bool add_special = true;
+  bool parse_special = true;
+  uint32_t n_threads = 1;
+  js_value_t *out = NULL;
+
+  if (argc >= 3) {
+    js_value_t *opts = argv[2];
+    bool has_prop;
+    js_value_t *val;
+
+    js_has_named_property(env, opts, "addSpecial", &has_prop);
+    if (has_prop) {
+      js_get_named_property(env, opts, "addSpecial", &val);
+      js_get_value_bool(env, val, &add_special);
+    }
+
+    js_has_named_property(env, opts, "parseSpecial", &has_prop);
+    if (has_prop) {
+      js_get_named_property(env, opts, "parseSpecial", &val);
+      js_get_value_bool(env, val, &parse_special);
+    }
+
+    js_has_named_property(env, opts, "threads", &has_prop);
+    if (has_prop) {
+      js_get_named_property(env, opts, "threads", &val);
+      js_get_value_uint32(env, val, &n_threads);
+      if (n_threads < 1) n_threads = 1;
+    }
+
+    js_has_named_property(env, opts, "out", &has_prop);
+    if (has_prop) {
+      js_get_named_property(env, opts, "out", &val);
+      js_value_type_t type;
+      js_typeof(env, val, &type);
+      if (type != js_undefined && type != js_null) out = val;
+    }
+  }
+
+  // Read every text into one buffer on the JS thread
+  uint32_t n;
+  js_get_array_length(env, argv[1], &n);
+
+  size_t *text_offsets = (size_t *)malloc((n + 1) * sizeof(size_t));
+  uint32_t *counts = (uint32_t *)calloc(n ? n : 1, sizeof(uint32_t));
+  size_t cap_text = 4096;
+  char *text = (char *)malloc(cap_text);
+  if (!text_offsets || !counts || !text) {
+    free(text_offsets);
+    free(counts);
+    free(text);
+    return throw_error(env, "Memory allocation failed");
+  }
+
+  const char *error = NULL;
+  text_offsets[0] = 0;
+
+  for (uint32_t i = 0; i < n && !error; i++) {
+    js_value_t *item;
+    js_get_element(env, argv[1], i, &item);
+
+    size_t text_len;
+    err = js_get_value_string_utf8(env, item, NULL, 0, &text_len);
+    if (err < 0) {
+      error = "Texts must be an array of strings";
+      break;
+    }
+
+    size_t need = text_offsets[i] + text_len + 1;
+    if (need > cap_text) {
+      while (cap_text < need) cap_text *= 2;
+      char *grown = (char *)realloc(text, cap_text);
+      if (!grown) {
+        error = "Memory allocation failed";
+        break;
+      }
+      text = grown;
+    }
+
+    js_get_value_string_utf8(env, item, (utf8_t *)text + text_offsets[i], text_len + 1, NULL);
+    text_offsets[i + 1] = text_offsets[i] + text_len;
+  }
+
+  // Split the inputs into runs of roughly equal bytes, one per worker
+  size_t n_workers = n_threads < n ? n_threads : (n ? n : 1);
+  tokenize_worker_t *workers = NULL;
+
+  if (!error) {
+    workers = (tokenize_worker_t *)calloc(n_workers, sizeof(tokenize_worker_t));
+    if (!workers) error = "Memory allocation failed";
+  }
+
+  if (!error) {
+    size_t total_bytes = text_offsets[n];
+    size_t begin = 0;
+
+    for (size_t w = 0; w < n_workers; w++) {
+      size_t end = begin;
+      if (w == n_workers - 1) {
+        end = n;
+      } else {
+        size_t target = total_bytes * (w + 1) / n_workers;
+        // Leave at least one input for each remaining worker
+        while (end < n - (n_workers - w - 1) && (end == begin || text_offsets[end] < target)) end++;
+      }
+
+      tokenize_worker_t *worker = &workers[w];
+      worker->vocab = llama_model_get_vocab(model_wrap->ptr);
+      worker->text = text;
+      worker->text_offsets = text_offsets;
+      worker->counts = counts;
+      worker->begin = begin;
+      worker->end = end;
+      worker->add_special = add_special;
+      worker->parse_special = parse_special;
+      begin = end;
+    }
+
+    size_t n_started = 1;
+    for (size_t w = 1; w < n_workers; w++) {
+      if (uv_thread_create(&workers[w].thread, tokenize_worker_run, &workers[w]) != 0) break;
+      n_started++;
+    }
+
+    // Run the first worker here, and any that failed to start
+    tokenize_worker_run(&workers[0]);
+    for (size_t w = n_started; w < n_workers; w++) tokenize_worker_run(&workers[w]);
+    for (size_t w = 1; w < n_started; w++) uv_thread_join(&workers[w].thread);
+
+    for (size_t w = 0; w < n_workers; w++) {
+      if (workers[w].failed) error = "Tokenization failed";
+    }
+  }
+
+  free(text);
+
+  size_t total = 0;
+  if (!error) {
+    for (size_t w = 0; w < n_workers; w++) total += workers[w].n_tokens;
+  }
+
+  js_value_t *tokens_array = NULL;
+  int32_t *dest = NULL;
+  char message[96];
+
+  if (!error && out) {
+    bool is_typedarray = false;
+    js_is_typedarray(env, out, &is_typedarray);
+
+    js_typedarray_type_t type;
+    size_t length;
+    js_value_t *out_buffer;
+    size_t out_offset;
+    if (is_typedarray) {
+      err = js_get_typedarray_info(env, out, &type, (void **)&dest, &length, &out_buffer, &out_offset);
+    }
+
+    if (!is_typedarray || err < 0 || type != js_int32array) {
+      error = "out must be an Int32Array";
+    } else if (length < total) {
+      snprintf(message, sizeof(message), "Output array is too small (%zu tokens needed)", total);
+      error = message;
+    } else {
+      err = js_create_typedarray(env, js_int32array, total, out_buffer, out_offset, &tokens_array);
+      if (err < 0) error = "Failed to create typed array";
+    }
+  } else if (!error) {
+    js_value_t *array_buffer;
+    err = js_create_arraybuffer(env, total * sizeof(int32_t), (void **)&dest, &array_buffer);
+    if (err < 0) {
+      error = "Failed to create array buffer";
+    } else {
+      err = js_create_typedarray(env, js_int32array, total, array_buffer, 0, &tokens_array);
+      if (err < 0) error = "Failed to create typed array";
+    }
+  }
+
+  if (!error) {
+    size_t offset = 0;
+    for (size_t w = 0; w < n_workers; w++) {
+      memcpy(dest + offset, workers[w].tokens, workers[w].n_tokens * sizeof(int32_t));
+      offset += workers[w].n_tokens;
+    }
+    metrics_record_tokenize(n, text_offsets[n], total);
+  }
+
+  if (workers) {
+    for (size_t w = 0; w < n_workers; w++) free(workers[w].tokens);
+    free(workers);
+  }
+  free(text_offsets);
+
+  js_value_t *offsets_array = NULL;
+  if (!error) {
+    js_value_t *array_buffer;
+    uint32_t *offsets;
+    err = js_create_arraybuffer(env, (n + 1) * sizeof(uint32_t), (void **)&offsets, &array_buffer);
+    if (err < 0) {
+      error = "Failed to create array buffer";
+    } else {
+      offsets[0] = 0;
+      for (uint32_t i = 0; i < n; i++) offsets[i + 1] = offsets[i] + counts[i];
+      js_create_typedarray(env, js_uint32array, n + 1, array_buffer, 0, &offsets_array);
+    }
+  }
+
+  free(counts);
+
+  if (error) return throw_error(env, error);
+
+  js_value_t *result;
+  js_create_object(env, &result);
+  js_set_named_property(env, result, "tokens", tokens_array);
+  js_set_named_property(env, result, "offsets", offsets_array);
+
+  return result;
+}
+
+// detokenize(model: Model, tokens: Int32Array): string
+static js_value_t *
+fn_detokenize(js_env_t *env, js_callback_info_t *info) {
+  int err;
+  size_t argc = 2;
+  js_value_t *argv[2];
+
+  err = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
+  if (err < 0) return throw_error(env, "Failed to get callback info");
+
+  if (argc < 2) return throw_error(env, "Model and tokens required");
+
+  // Get model wrapper
+  model_wrap_t *model_wrap;
+  err = js_get_value_external(env, argv[0], (void **)&model_wrap);
+  if (err < 0 || !model_wrap || !model_wrap->ptr) return throw_error(env, "Invalid model");
+  
+  struct llama_model *model = model_wrap->ptr;
+
+  // Get tokens array
+  bool is_typedarray;
+  err = js_is_typedarray(env, argv[1], &is_typedarray);
+  if (err < 0 || !is_typedarray) return throw_error(env, "Tokens must be Int32Array");
+
+  js_typedarray_type_t type;
+  size_t length;
+  void *data;
+  err = js_get_typedarray_info(env, argv[1], &type, &data, &length, NULL, NULL);
+  if (err < 0 || type != js_int32array) return throw_error(env, "Tokens must be Int32Array");
+
+  llama_token *tokens = (llama_token *)data;
+
+  const struct llama_vocab *vocab = llama_model_get_vocab(model);
+
+  // Build output string
+  text_buf_t buf = {NULL, 0, 0};
+  if (!text_buf_reserve(&buf, length * 8)) return throw_error(env, "Memory allocation failed");
+
+  for (size_t i = 0; i < length; i++) {
+    if (!text_buf_append_token(&buf, vocab, tokens[i], true)) {
+      free(buf.data);
+      return throw_error(env, "Memory allocation failed");
+    }
+  }
+
+  js_value_t *result;
+  err = js_create_string_utf8(env, (utf8_t *)buf.data, buf.len, &result);
+  free(buf.data);
+
+  if (err < 0) return throw_error(env, "Failed to create string");
+
+  return result;
+}
+
+// Incremental detokenizer: pieces are appended to pending, and only the part
+// ending on a complete UTF-8 character is returned.
+typedef struct {
+  model_wrap_t *model;
+  js_ref_t *model_ref;  // Keeps the model alive while the detokenizer is alive
+  text_buf_t pending;
+  bool special;
+  bool strip_leading_space;
+  bool started;  // Some text has been produced since creation or flush
+} detokenizer_t;
+
+// createDetokenizer(model: Model, opts?: { special?: boolean, stripLeadingSpace?: boolean }): Detokenizer
+static js_value_t *
+fn_create_detokenizer(js_env_t *env, js_callback_info_t *info) {
+  int err;
+  size_t argc = 2;
+  js_value_t *argv[2];
+
+  err = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
+  if (err < 0) return throw_error(env, "Failed to get callback info");
+
+  if (argc < 1) return throw_error(env, "Model required");
+
+  model_wrap_t *model_wrap;
+  err = js_get_value_external(env, argv[0], (void **)&model_wrap);
+  if (err < 0 || !model_wrap || !model_wrap->ptr) return throw_error(env, "Invalid model");
+
+  bool special = true;
+  bool strip_leading_space = false;
+
+  if (argc >= 2) {
+    js_value_t *opts = argv[1];
+    bool has_prop;
+    js_value_t *val;
+
+    js_has_named_property(env, opts, "special", &has_prop);
+    if (has_prop) {
+      js_get_named_property(env, opts, "special", &val);
+      js_get_value_bool(env, val, &special);
+    }
+
+    js_has_named_property(env, opts, "stripLeadingSpace", &has_prop);
+    if (has_prop) {
+      js_get_named_property(env, opts, "stripLeadingSpace", &val);
+      js_get_value_bool(env, val, &strip_leading_space);
+    }
+  }
+
+  detokenizer_t *detok = (detokenizer_t *)calloc(1, sizeof(detokenizer_t));
+  if (!detok) return throw_error(env, "Memory allocation failed");
+
+  detok->model = model_wrap;
+  detok->special = special;
+  detok->strip_leading_space = strip_leading_space;
+
+  js_value_t *result;
+  err = js_create_external(env, detok, finalize_detokenizer, NULL, &result);
+  if (err < 0) {
+    free(detok);
+    return throw_error(env, "Failed to create external");
+  }
+
+  js_create_reference(env, argv[0], 1, &detok->model_ref);
+
+  return result;
+}
+
+// detokenizerPush(detok: Detokenizer, tokens: number | Int32Array): string
+// Returns the text completed by these tokens, which may be empty.
+static js_value_t *
+fn_detokenizer_push(js_env_t *env, js_callback_info_t *info) {
+  int err;
+  size_t argc = 2;
+  js_value_t *argv[2];
+
+  err = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
+  if (err < 0) return throw_error(env, "Failed to get callback info");
+
+  if (argc < 2) return throw_error(env, "Detokenizer and tokens required");
+
+  detokenizer_t *detok;
+  err = js_get_value_external(env, argv[0], (void **)&detok);
+  if (err < 0 || !detok || !detok->model_ref) return throw_error(env, "Invalid detokenizer");
+  if (!detok->model->ptr) return throw_error(env, "Model has been freed");
+
+  llama_token single;
+  llama_token *tokens = &single;
+  size_t length = 1;
+
+  bool is_typedarray = false;
+  js_is_typedarray(env, argv[1], &is_typedarray);
+
+  if (is_typedarray) {
+    js_typedarray_type_t type;
+    void *data;
+    err = js_get_typedarray_info(env, argv[1], &type, &data, &length, NULL, NULL);
+    if (err < 0 || type != js_int32array) return throw_error(env, "Tokens must be a number or Int32Array");
+    tokens = (llama_token *)data;
+  } else {
+    err = js_get_value_int32(env, argv[1], &single);
+    if (err < 0) return throw_error(env, "Tokens must be a number or Int32Array");
+  }
+
+  const struct llama_vocab *vocab = llama_model_get_vocab(detok->model->ptr);
+  text_buf_t *pending = &detok->pending;
+
+  for (size_t i = 0; i < length; i++) {
+    size_t start = pending->len;
+    if (!text_buf_append_token(pending, vocab, tokens[i], detok->special)) {
+      return throw_error(env, "Memory allocation failed");
+    }
+
+    // The first piece of a SentencePiece vocab carries the word's leading space
+    if (!detok->started && pending->len > start) {
+      if (detok->strip_leading_space && pending->data[start] == ' ') {
+        memmove(pending->data + start, pending->data + start + 1, pending->len - start - 1);
+        pending->len--;
+      }
+      detok->started = true;
+    }
+  }
+
+  size_t complete = pending->len ? utf8_complete_len(pending->data, pending->len) : 0;
+
+  js_value_t *result;
+  err = js_create_string_utf8(env, (utf8_t *)(complete ? pending->data : ""), complete, &result);
+  if (err < 0) return throw_error(env, "Failed to create string");
+
+  if (complete) {
+    memmove(pending->data, pending->data + complete, pending->len - complete);
+    pending->len -= complete;
+  }
+
+  return result;
+}
+
+// detokenizerFlush(detok: Detokenizer): string
+// Returns any held back bytes (invalid sequences become U+FFFD) and resets
+// the detokenizer for a new stream.
+static js_value_t *
+fn_detokenizer_flush(js_env_t *env, js_callback_info_t *info) {
+  int err;
+  size_t argc = 1;
+  js_value_t *argv[1];
+
+  err = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
+  if (err < 0) return throw_error(env, "Failed to get callback info");
+
+  detokenizer_t *detok;
+  err = js_get_value_external(env, argv[0], (void **)&detok);
+  if (err < 0 || !detok || !detok->model_ref) return throw_error(env, "Invalid detokenizer");
+
+  js_value_t *result;
+  err = js_create_string_utf8(env, (utf8_t *)(detok->pending.len ? detok->pending.data : ""), detok->pending.len, &result);
+  if (err < 0) return throw_error(env, "Failed to create string");
+
+  detok->pending.len = 0;
+  detok->started = false;
+
+  return result;
+}
+
+// freeDetokenizer(detok: Detokenizer): void
+static js_value_t *
+fn_free_detokenizer(js_env_t *env, js_callback_info_t *info) {
+  int err;
+  size_t argc = 1;
+  js_value_t *argv[1];
+
+  err = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
+  if (err < 0) return NULL;
+
+  detokenizer_t *detok;
+  err = js_get_value_external(env, argv[0], (void **)&detok);
+  if (err < 0 || !detok) return NULL;
+
+  if (detok->model_ref) {
+    js_delete_reference(env, detok->model_ref);
+    detok->model_ref = NULL;
+  }
+  free(detok->pending.data);
+  detok->pending = (text_buf_t){NULL, 0, 0};
+
+  js_value_t *null_val;
+  js_get_null(env, &null_val);
+  return null_val;
+}
+
+// llama_decode, serialized with other contexts on the same shared threadpool.
+// Time spent waiting for the pool is not counted as decode time.
+static int
+context_llama_decode(context_wrap_t *wrap, struct llama_batch batch) {
+  if (wrap->shared_pool) uv_mutex_lock(&wrap->shared_pool->lock);
+
+  uint64_t start = uv_hrtime();
+  int result = llama_decode(wrap->ptr, batch);
+  uint64_t ns = uv_hrtime() - start;
+
+  if (wrap->shared_pool) uv_mutex_unlock(&wrap->shared_pool->lock);
+
+  uint32_t n_tokens = batch.n_tokens > 0 ? (uint32_t)batch.n_tokens : 0;
+  wrap->decode_calls++;
+  wrap->decode_tokens += n_tokens;
+  wrap->decode_ns += ns;
+  if (n_tokens > wrap->decode_max_batch) wrap->decode_max_batch = n_tokens;
+  metrics_record_decode(n_tokens, ns);
+
+  return result;
+}
+
+// Record tokens appended to sequence 0. If the mirror can't grow, it is
+// dropped, which only costs a later cache miss.
+static void
+context_track(context_wrap_t *wrap, const llama_token *tokens, size_t n) {
+  // A mirror started over holds unshifted history
+  if (wrap->n_cached == 0) wrap->shift_offset = 0;
+
+  if (wrap->n_cached + n > wrap->cap_cached) {
+    size_t cap = wrap->cap_cached ? wrap->cap_cached : 256;
+    while (cap < wrap->n_cached + n) cap *= 2;
+    llama_token *cached = (llama_token *)realloc(wrap->cached, cap * sizeof(llama_token));
+    if (!cached) {
+      wrap->n_cached = 0;
+      return;
+    }
+    wrap->cached = cached;
+    wrap->cap_cached = cap;
+  }
+  memcpy(wrap->cached + wrap->n_cached, tokens, n * sizeof(llama_token));
+  wrap->n_cached += n;
+}
+
+// Make room for n_tokens more in sequence 0 by discarding a window of the
+// oldest tokens after the kept prefix and shifting the rest down, so later
+// tokens keep attending to a contiguous history without re-evaluation. No-op
+// unless context shift is enabled or there is room. Returns NULL or an error.
+static const char *
+context_shift(context_wrap_t *wrap, size_t n_tokens) {
+  if (!wrap->shift) return NULL;
+
+  struct llama_context *ctx = wrap->ptr;
+  llama_memory_t mem = llama_get_memory(ctx);
+  llama_pos n_ctx = (llama_pos)(llama_n_ctx(ctx) / llama_n_seq_max(ctx));
+  llama_pos n_past = llama_memory_seq_pos_max(mem, 0) + 1;
+
+  if (n_past + (llama_pos)n_tokens <= n_ctx) return NULL;
+
+  llama_pos n_keep = (llama_pos)wrap->shift_keep;
+  if (n_keep > n_past) n_keep = n_past;
+  llama_pos n_left = n_past - n_keep;
+
+  llama_pos n_needed = n_past + (llama_pos)n_tokens - n_ctx;
+  if (n_needed > n_left) return "Input doesn't fit in the context after the kept tokens";
+
+  llama_pos n_discard = wrap->shift_discard ? (llama_pos)wrap->shift_discard : n_left / 2;
+  if (n_discard < n_needed) n_discard = n_needed;
+  if (n_discard > n_left) n_discard = n_left;
+
+  if (!llama_memory_seq_rm(mem, 0, n_keep, n_keep + n_discard)) return "Context memory can't be shifted";
+  llama_memory_seq_add(mem, 0, n_keep + n_discard, n_past, -n_discard);
+
+  // The mirror is indexed by position, so it shifts the same way
+  if (wrap->n_cached == (size_t)n_past) {
+    memmove(wrap->cached + n_keep, wrap->cached + n_keep + n_discard, (n_past - n_keep - n_discard) * sizeof(llama_token));
+    wrap->n_cached -= (size_t)n_discard;
+    wrap->shift_offset += (size_t)n_discard;
+  } else {
+    if (wrap->n_cached > (size_t)n_keep) wrap->n_cached = (size_t)n_keep;
+    wrap->shift_offset = 0;
+  }
+
+  wrap->shifts++;
+  wrap->shifted_tokens += (uint64_t)n_discard;
+  return NULL;
+}
+
+// Decode tokens into sequence 0, splitting inputs longer than n_batch into
+// chunks. logits, if set, flags the tokens to compute logits for; all of them
+// must fall within the final n_batch tokens, which are decoded last. Otherwise
+// only the last token gets logits. Returns NULL or an error message. Safe to
+// call off the JS thread while the context is owned by async work.
+static const char *
+context_decode(context_wrap_t *wrap, llama_token *tokens, size_t n_tokens, const int8_t *logits) {
+  struct llama_context *ctx = wrap->ptr;
+  size_t n_batch = llama_n_batch(ctx);
+
+  const char *error = context_shift(wrap, n_tokens);
+  if (error) return error;
+
+  if (n_tokens <= n_batch && !logits) {
+    if (context_llama_decode(wrap, llama_batch_get_one(tokens, (int32_t)n_tokens)) != 0) {
+      wrap->n_cached = 0;
+      return "Decode failed";
+    }
+    context_track(wrap, tokens, n_tokens);
+    wrap->output_base = 0;
+    return NULL;
+  }
+
+  // Pooled embeddings are computed per decode, so they can't span chunks
+  if (wrap->embeddings && n_tokens > n_batch) {
+    return "Input exceeds batchSize; embedding contexts must decode in one batch";
+  }
+
+  size_t last = n_tokens > n_batch ? n_tokens - n_batch : 0;
+
+  if (logits) {
+    size_t first = 0;
+    while (first < n_tokens && !logits[first]) first++;
+    if (first < last) return "Requested logits span more than batchSize tokens";
+  }
+
+  for (size_t i = 0; i < last; i += n_batch) {
+    size_t n = last - i < n_batch ? last - i : n_batch;
+    if (context_llama_decode(wrap, llama_batch_get_one(tokens + i, (int32_t)n)) != 0) {
+      wrap->n_cached = 0;
+      return "Decode failed";
+    }
+    context_track(wrap, tokens + i, n);
+  }
+
+  size_t n = n_tokens - last;
+  int result;
+
+  if (!logits) {
+    result = context_llama_decode(wrap, llama_batch_get_one(tokens + last, (int32_t)n));
+  } else {
+    struct llama_batch batch = llama_batch_init((int32_t)n, 0, 1);
+    llama_pos pos = llama_memory_seq_pos_max(llama_get_memory(ctx), 0) + 1;
+
+    for (size_t i = 0; i < n; i++) {
+      batch.token[i] = tokens[last + i];
+      batch.pos[i] = pos + (llama_pos)i;
+      batch.n_seq_id[i] = 1;
+      batch.seq_id[i][0] = 0;
+      batch.logits[i] = logits[last + i];
+    }
+    batch.n_tokens = (int32_t)n;
+
+    result = context_llama_decode(wrap, batch);
+    llama_batch_free(batch);
+  }
+
+  if (result != 0) {
+    wrap->n_cached = 0;
+    return "Decode failed";
+  }
+  context_track(wrap, tokens + last, n);
+
+  wrap->output_base = last;
+  return NULL;
+}
+
+// Decode the full prompt in tokens, reusing the longest prefix already in
+// sequence 0. Only the divergent tail is dropped from the KV cache and only the
+// new suffix is decoded. On a full match the last token is decoded again so its
+// logits are fresh.
+//
+// After a context shift the cache holds the kept prefix followed by the later
+// part of the history. A prompt that continues that history is matched the
+// same way, skipping the tokens that were shifted out, so a conversation keeps
+// sliding instead of being decoded again from the kept prefix.
+static const char *
+context_decode_prefix(context_wrap_t *wrap, llama_token *tokens, size_t n_tokens, const int8_t *logits) {
+  if (n_tokens == 0) return "Tokens must not be empty";
+
+  size_t keep = wrap->shift_offset > 0 ? wrap->shift_keep : wrap->n_cached;
+  if (keep > wrap->n_cached) keep = wrap->n_cached;
+
+  size_t common = 0;
+  while (common < keep && common < n_tokens && wrap->cached[common] == tokens[common]) {
+    common++;
+  }
+
+  // Input tokens skipped for having been shifted out, used only if the prompt
+  // goes on to match the cached history after them
+  size_t skip = 0;
+  if (common == keep && wrap->shift_offset > 0) {
+    size_t offset = wrap->shift_offset;
+    size_t n = 0;
+    while (common + n < wrap->n_cached && common + n + offset < n_tokens && wrap->cached[common + n] == tokens[common + n + offset]) {
+      n++;
+    }
+    if (n > 0) {
+      skip = offset;
+      common += n;
+    }
+  }
+  if (common + skip == n_tokens && common > 0) common--;
+
+  // Requested outputs must be decoded again, and can't be skipped
+  if (logits) {
+    for (size_t i = 0; i < common + skip; i++) {
+      if (!logits[i]) continue;
+      if (i >= keep && i < keep + skip) return "Requested logits fall in the part of the prompt shifted out of the context";
+      common = i < keep ? i : i - skip;
+      break;
+    }
+    // Cut into the kept prefix: the prompt no longer continues the history
+    if (common < keep || common == 0) skip = 0;
+  }
+
+  llama_memory_t mem = llama_get_memory(wrap->ptr);
+  if (!llama_memory_seq_rm(mem, 0, (llama_pos)common, -1)) {
+    // Memory that can't be trimmed (e.g. recurrent state) starts over
+    llama_memory_seq_rm(mem, 0, -1, -1);
+    common = 0;
+    skip = 0;
+  }
+  if (wrap->n_cached > common) wrap->n_cached = common;
+  wrap->shift_offset = skip;
+
+  wrap->cache_hit_tokens += common + skip;
+  wrap->cache_miss_tokens += n_tokens - common - skip;
+
+  size_t start = common + skip;
+  const char *error = context_decode(wrap, tokens + start, n_tokens - start, logits ? logits + start : NULL);
+  if (!error) wrap->output_base += start;
+  return error;
+}
+
+// Parse the decode logits option: "all", or an array of token indices.
+// Sets *mask to NULL for the default (last token only). Throws on error.
+static bool
+parse_decode_logits(js_env_t *env, js_value_t *opts, size_t n_tokens, int8_t **mask) {
+  int err;
+  js_value_t *val;
+  bool has_prop;
+
+  *mask = NULL;
+
+  err = js_has_named_property(env, opts, "logits", &has_prop);
+  if (err < 0 || !has_prop) return true;
+
+  err = js_get_named_property(env, opts, "logits", &val);
+  if (err < 0) return true;
+
+  js_value_type_t type;
+  js_typeof(env, val, &type);
+  if (type == js_undefined) return true;
+
+  int8_t *flags = (int8_t *)calloc(n_tokens ? n_tokens : 1, sizeof(int8_t));
+  if (!flags) {
+    throw_error(env, "Memory allocation failed");
+    return false;
+  }
+
+  if (type == js_string) {
+    char mode[8];
+    js_get_value_string_utf8(env, val, (utf8_t *)mode, sizeof(mode), NULL);
+    if (strcmp(mode, "all") == 0) {
+      memset(flags, 1, n_tokens);
+    } else if (strcmp(mode, "last") == 0) {
+      if (n_tokens > 0) flags[n_tokens - 1] = 1;
+    } else {
+      free(flags);
+      throw_error(env, "logits must be 'all', 'last' or an array of token indices");
+      return false;
+    }
+    *mask = flags;
+    return true;
+  }
+
+  bool is_array;
+  js_is_array(env, val, &is_array);
+  if (!is_array) {
+    free(flags);
+    throw_error(env, "logits must be 'all', 'last' or an array of token indices");
+    return false;
+  }
+
+  uint32_t len;
+  js_get_array_length(env, val, &len);
+  for (uint32_t i = 0; i < len; i++) {
+    js_value_t *elem;
+    int32_t idx;
+    js_get_element(env, val, i, &elem);
+    js_get_value_int32(env, elem, &idx);
+    if (idx < 0 || (size_t)idx >= n_tokens) {
+      free(flags);
+      throw_error(env, "logits index out of range");
+      return false;
+    }
+    flags[idx] = 1;
+  }
+
+  *mask = flags;
+  return true;
+}
+
+static bool
+parse_reuse_prefix(js_env_t *env, js_value_t *opts) {
+  js_value_t *val;
+  bool has_prop;
+  bool reuse = false;
+  int err = js_has_named_property(env, opts, "reusePrefix", &has_prop);
+  if (err == 0 && has_prop) {
+    err = js_get_named_property(env, opts, "reusePrefix", &val);
+    if (err == 0) js_get_value_bool(env, val, &reuse);
+  }
+  return reuse;
+}
+
+// Map a sample index given relative to the last decode() input onto the
+// index within the final chunk. Negative indices count outputs from the end.
+static bool
+resolve_sample_index(context_wrap_t *wrap, int32_t *idx) {
+  if (*idx < 0) return true;
+  if ((size_t)*idx < wrap->output_base) return false;
+  *idx -= (int32_t)wrap->output_base;
+  return true;
+}
+
+// warmupContext(ctx: Context): void
+// Decodes BOS/EOS once in llama.cpp's warmup mode, which runs every weight
+// through the compute graph so mmap'd tensors are paged in and backend
+// buffers are touched before the first real request. The memory and perf
+// counters are then reset, leaving the context as if newly created.
+static js_value_t *
+fn_warmup_context(js_env_t *env, js_callback_info_t *info) {
+  int err;
+  size_t argc = 1;
+  js_value_t *argv[1];
+
+  err = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
+  if (err < 0) return throw_error(env, "Failed to get callback info");
+
+  context_wrap_t *wrap;
+  err = js_get_value_external(env, argv[0], (void **)&wrap);
+  if (err < 0 || !wrap || !wrap->ptr) return throw_error(env, "Invalid context");
+  if (wrap->busy) return throw_error(env, "Context is busy");
+  context_invalidate_views(env, wrap);
+
+  struct llama_context *ctx = wrap->ptr;
+  const struct llama_vocab *vocab = llama_model_get_vocab(llama_get_model(ctx));
+
+  llama_token tokens[2];
+  int32_t n_tokens = 0;
+  llama_token bos = llama_vocab_bos(vocab);
+  llama_token eos = llama_vocab_eos(vocab);
+  if (bos != LLAMA_TOKEN_NULL) tokens[n_tokens++] = bos;
+  if (eos != LLAMA_TOKEN_NULL) tokens[n_tokens++] = eos;
+  if (n_tokens == 0) tokens[n_tokens++] = 0;
+
+  llama_set_warmup(ctx, true);
+  int result = context_llama_decode(wrap, llama_batch_get_one(tokens, n_tokens));
+  llama_synchronize(ctx);
+  llama_set_warmup(ctx, false);
+
+  llama_memory_t mem = llama_get_memory(ctx);
+  if (mem) llama_memory_clear(mem, true);
+  wrap->n_cached = 0;
+  wrap->output_base = 0;
+
+  llama_perf_context_reset(ctx);
+  wrap->decode_calls = 0;
+  wrap->decode_tokens = 0;
+  wrap->decode_ns = 0;
+  wrap->decode_max_batch = 0;
+
+  if (result != 0) return throw_error(env, "Warmup decode failed");
+
+  js_value_t *undefined;
+  js_get_undefined(env, &undefined);
+  return undefined;
+}
+
+// decode(ctx: Context, tokens: Int32Array, opts?: object): void
+// Inputs longer than batchSize are decoded in chunks. opts.logits selects the
+// tokens to compute logits for ('last' by default, 'all', or an array of
+// indices); they must lie within the final batchSize tokens. With
+// opts.reusePrefix, tokens is the full prompt and only the part that differs
+// from what is already cached is decoded.
+static js_value_t *
+fn_decode(js_env_t *env, js_callback_info_t *info) {
+  int err;
+  size_t argc = 3;
+  js_value_t *argv[3];
+
+  err = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
+  if (err < 0) return throw_error(env, "Failed to get callback info");
+
+  if (argc < 2) return throw_error(env, "Context and tokens required");
+
+  // Get context wrapper
+  context_wrap_t *ctx_wrap;
+  err = js_get_value_external(env, argv[0], (void **)&ctx_wrap);
+  if (err < 0 || !ctx_wrap || !ctx_wrap->ptr) return throw_error(env, "Invalid context");
+  if (ctx_wrap->busy) return throw_error(env, "Context is busy");
+  context_invalidate_views(env, ctx_wrap);
+
+  // Get tokens
+  bool is_typedarray;
+  err = js_is_typedarray(env, argv[1], &is_typedarray);
+  if (err < 0 || !is_typedarray) return throw_error(env, "Tokens must be Int32Array");
+
+  js_typedarray_type_t type;
+  size_t length;
+  void *data;
+  err = js_get_typedarray_info(env, argv[1], &type, &data, &length, NULL, NULL);
+  if (err < 0 || type != js_int32array) return throw_error(env, "Tokens must be Int32Array");
+
+  // Checked before touching memory: a reusePrefix decode would clear the cache
+  if (length == 0) return throw_error(env, "Tokens must not be empty");
+
+  int8_t *logits = NULL;
+  bool reuse_prefix = false;
+  if (argc >= 3) {
+    if (!parse_decode_logits(env, argv[2], length, &logits)) return NULL;
+    reuse_prefix = parse_reuse_prefix(env, argv[2]);
+  }
+
+  const char *error = reuse_prefix
+    ? context_decode_prefix(ctx_wrap, (llama_token *)data, length, logits)
+    : context_decode(ctx_wrap, (llama_token *)data, length, logits);
+  free(logits);
+  if (error) return throw_error(env, error);
+
+  js_value_t *undefined;
+  js_get_undefined(env, &undefined);
+  return undefined;
+}
+
+typedef struct {
+  async_work_t base;
+  llama_token *tokens;
+  size_t n_tokens;
+  int8_t *logits;
+  bool reuse_prefix;
+} decode_work_t;
+
+static void
+decode_execute(async_work_t *work) {
+  decode_work_t *w = (decode_work_t *)work;
+  work->error = w->reuse_prefix
+    ? context_decode_prefix(work->ctx_wrap, w->tokens, w->n_tokens, w->logits)
+    : context_decode(work->ctx_wrap, w->tokens, w->n_tokens, w->logits);
+}
+
+static js_value_t *
+decode_complete(async_work_t *work) {
+  decode_work_t *w = (decode_work_t *)work;
+  free(w->tokens);
+  free(w->logits);
+
+  if (work->error) return NULL;
+
+  js_value_t *undefined;
+  js_get_undefined(work->env, &undefined);
+  return undefined;
+}
+
+// decodeAsync(ctx: Context, tokens: Int32Array, opts?: object): Promise<void>
+// Tokens are copied, so the array may be reused once the call returns.
+static js_value_t *
+fn_decode_async(js_env_t *env, js_callback_info_t *info) {
+  int err;
+  size_t argc = 3;
+  js_value_t *argv[3];
+
+  err = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
+  if (err < 0) return throw_error(env, "Failed to get callback info");
+
+  if (argc < 2) return throw_error(env, "Context and tokens required");
+
+  context_wrap_t *ctx_wrap;
+  err = js_get_value_external(env, argv[0], (void **)&ctx_wrap);
+  if (err < 0 || !ctx_wrap || !ctx_wrap->ptr) return throw_error(env, "Invalid context");
+  if (ctx_wrap->busy) return throw_error(env, "Context is busy");
+  context_invalidate_views(env, ctx_wrap);
+
+  bool is_typedarray;
+  err = js_is_typedarray(env, argv[1], &is_typedarray);
+  if (err < 0 || !is_typedarray) return throw_error(env, "Tokens must be Int32Array");
+
+  js_typedarray_type_t type;
+  size_t length;
+  void *data;
+  err = js_get_typedarray_info(env, argv[1], &type, &data, &length, NULL, NULL);
+  if (err < 0 || type != js_int32array) return throw_error(env, "Tokens must be Int32Array");
+
+  // Checked before touching memory: a reusePrefix decode would clear the cache
+  if (length == 0) return throw_error(env, "Tokens must not be empty");
+
+  int8_t *logits = NULL;
+  if (argc >= 3 && !parse_decode_logits(env, argv[2], length, &logits)) return NULL;
+
+  decode_work_t *work = (decode_work_t *)calloc(1, sizeof(decode_work_t));
+  if (!work) {
+    free(logits);
+    return throw_error(env, "Memory allocation failed");
+  }
+
+  work->logits = logits;
+  work->reuse_prefix = argc >= 3 && parse_reuse_prefix(env, argv[2]);
+  work->tokens = (llama_token *)malloc((length ? length : 1) * sizeof(llama_token));
+  if (!work->tokens) {
+    free(logits);
+    free(work);
+    return throw_error(env, "Memory allocation failed");
+  }
+  memcpy(work->tokens, data, length * sizeof(llama_token));
+  work->n_tokens = length;
+
+  work->base.ctx_wrap = ctx_wrap;
+  work->base.execute = decode_execute;
+  work->base.complete = decode_complete;
+
+  js_value_t *handles[2] = {argv[0], NULL};
+  return queue_async_work(env, &work->base, handles);
+}
+
+// Sequence selected by opts.sequence, or -1 for the whole context
+static int32_t
+parse_state_sequence(js_env_t *env, size_t argc, js_value_t *argv[], size_t idx) {
+  int32_t seq = -1;
+  if (argc > idx) {
+    js_value_t *val;
+    bool has_prop;
+    int err = js_has_named_property(env, argv[idx], "sequence", &has_prop);
+    if (err == 0 && has_prop) {
+      err = js_get_named_property(env, argv[idx], "sequence", &val);
+      if (err == 0) js_get_value_int32(env, val, &seq);
+    }
+  }
+  return seq;
+}
+
+// Replace the sequence 0 token mirror after restoring state
+static void
+context_set_cached(context_wrap_t *wrap, const llama_token *tokens, size_t n) {
+  wrap->n_cached = 0;
+  context_track(wrap, tokens, n);
+  wrap->output_base = 0;
+}
+
+// In-memory state layout: header, cached tokens, then llama.cpp state bytes.
+// The tokens let prefix reuse continue from a restored state.
+#define STATE_MAGIC 0x54534c42  // "BLST"
+#define STATE_VERSION 1
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  int32_t sequence;
+  uint32_t n_tokens;
+  uint64_t state_size;
+} state_header_t;
+
+// saveState(ctx: Context, opts?: { sequence?: number }): ArrayBuffer
+static js_value_t *
+fn_save_state(js_env_t *env, js_callback_info_t *info) {
+  int err;
+  size_t argc = 2;
+  js_value_t *argv[2];
+
+  err = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
+  if (err < 0) return throw_error(env, "Failed to get callback info");
+
+  if (argc < 1) return throw_error(env, "Context required");
+
+  context_wrap_t *wrap;
+  err = js_get_value_external(env, argv[0], (void **)&wrap);
+  if (err < 0 || !wrap || !wrap->ptr) return throw_error(env, "Invalid context");
+  if (wrap->busy) return throw_error(env, "Context is busy");
+
+  struct llama_context *ctx = wrap->ptr;
+  int32_t seq = parse_state_sequence(env, argc, argv, 1);
+
+  // The mirror only describes sequence 0
+  size_t n_tokens = seq <= 0 ? wrap->n_cached : 0;
+  size_t state_size = seq < 0 ? llama_state_get_size(ctx) : llama_state_seq_get_size(ctx, seq);
+  size_t offset = sizeof(state_header_t) + n_tokens * sizeof(llama_token);
+
+  js_value_t *result;
+  void *data;
+  err = js_create_arraybuffer(env, offset + state_size, &data, &result);
+  if (err < 0) return throw_error(env, "Failed to create array buffer");
+
+  uint8_t *dst = (uint8_t *)data;
+  size_t written = seq < 0
+    ? llama_state_get_data(ctx, dst + offset, state_size)
+    : llama_state_seq_get_data(ctx, dst + offset, state_size, seq);
+  if (written == 0 && state_size > 0) return throw_error(env, "Failed to save state");
+
+  state_header_t header = {STATE_MAGIC, STATE_VERSION, seq, (uint32_t)n_tokens, (uint64_t)written};
+  memcpy(dst, &header, sizeof(header));
+  if (n_tokens > 0) memcpy(dst + sizeof(header), wrap->cached, n_tokens * sizeof(llama_token));
+
+  return result;
+}
+
+// loadState(ctx: Context, state: ArrayBuffer | Uint8Array, opts?: { sequence?: number }): number
+// Returns the number of cached tokens restored. A sequence snapshot may be
+// loaded into a different sequence with opts.sequence.
+static js_value_t *
+fn_load_state(js_env_t *env, js_callback_info_t *info) {
+  int err;
+  size_t argc = 3;
+  js_value_t *argv[3];
+
+  err = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
+  if (err < 0) return throw_error(env, "Failed to get callback info");
+
+  if (argc < 2) return throw_error(env, "Context and state required");
+
+  context_wrap_t *wrap;
+  err = js_get_value_external(env, argv[0], (void **)&wrap);
+  if (err < 0 || !wrap || !wrap->ptr) return throw_error(env, "Invalid context");
+  if (wrap->busy) return throw_error(env, "Context is busy");
+  context_invalidate_views(env, wrap);
+
+  void *data = NULL;
+  size_t len = 0;
+  bool is_typedarray = false;
+  js_is_typedarray(env, argv[1], &is_typedarray);
+  if (is_typedarray) {
+    js_typedarray_type_t type;
+    err = js_get_typedarray_info(env, argv[1], &type, &data, &len, NULL, NULL);
+    if (err < 0 || type != js_uint8array) return throw_error(env, "State must be an ArrayBuffer or Uint8Array");
+  } else {
+    err = js_get_arraybuffer_info(env, argv[1], &data, &len);
+    if (err < 0) return throw_error(env, "State must be an ArrayBuffer or Uint8Array");
+  }
+
+  state_header_t header;
+  if (len < sizeof(header)) return throw_error(env, "Invalid state");
+  memcpy(&header, data, sizeof(header));
+  if (header.magic != STATE_MAGIC || header.version != STATE_VERSION) return throw_error(env, "Invalid state");
+
+  size_t offset = sizeof(header) + (size_t)header.n_tokens * sizeof(llama_token);
+  if (len < offset || len - offset < header.state_size) return throw_error(env, "Invalid state");
+
+  struct llama_context *ctx = wrap->ptr;
+  const uint8_t *src = (const uint8_t *)data;
+  int32_t seq = header.sequence;
+  if (seq >= 0) {
+    int32_t dest = parse_state_sequence(env, argc, argv, 2);
+    if (dest >= 0) seq = dest;
+  }
+
+  size_t read = seq < 0
+    ? llama_state_set_data(ctx, src + offset, header.state_size)
+    : llama_state_seq_set_data(ctx, src + offset, header.state_size, seq);
+  if (read == 0) {
+    wrap->n_cached = 0;
+    return throw_error(env, "Failed to load state (was it saved from this model and context size?)");
+  }
+
+  // Tokens are only recorded for snapshots of sequence 0
+  if (seq <= 0) {
+    llama_token *tokens = (llama_token *)malloc((header.n_tokens ? header.n_tokens : 1) * sizeof(llama_token));
+    if (!tokens) return throw_error(env, "Memory allocation failed");
+    memcpy(tokens, src + sizeof(header), header.n_tokens * sizeof(llama_token));
+    context_set_cached(wrap, tokens, header.n_tokens);
+    free(tokens);
+  }
+
+  js_value_t *result;
+  js_create_uint32(env, header.n_tokens, &result);
+  return result;
+}
+
+// saveStateFile(ctx: Context, path: string, opts?: { sequence?: number }): void
+// Streams the state to disk without copying it through JS.
+static js_value_t *
+fn_save_state_file(js_env_t *env, js_callback_info_t *info) {
+  int err;
+  size_t argc = 3;
+  js_value_t *argv[3];
+
+  err = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
+  if (err < 0) return throw_error(env, "Failed to get callback info");
+
+  if (argc < 2) return throw_error(env, "Context and path required");
+
+  context_wrap_t *wrap;
+  err = js_get_value_external(env, argv[0], (void **)&wrap);
+  if (err < 0 || !wrap || !wrap->ptr) return throw_error(env, "Invalid context");
+  if (wrap->busy) return throw_error(env, "Context is busy");
+
+  char *path = get_string_value(env, argv[1]);
+  if (!path) return throw_error(env, "Invalid path");
+
+  int32_t seq = parse_state_sequence(env, argc, argv, 2);
+  size_t n_tokens = seq <= 0 ? wrap->n_cached : 0;
+
+  bool ok = seq < 0
+    ? llama_state_save_file(wrap->ptr, path, wrap->cached, n_tokens)
+    : llama_state_seq_save_file(wrap->ptr, path, seq, wrap->cached, n_tokens) > 0;
+  free(path);
+
+  if (!ok) return throw_error(env, "Failed to save state file");
+
+  js_value_t *undefined;
+  js_get_undefined(env, &undefined);
+  return undefined;
+}
+
+// loadStateFile(ctx: Context, path: string, opts?: { sequence?: number }): number
+// Pass opts.sequence for files written by saveStateFile with a sequence.
+// Returns the number of cached tokens restored.
+static js_value_t *
+fn_load_state_file(js_env_t *env, js_callback_info_t *info) {
+  int err;
+  size_t argc = 3;
+  js_value_t *argv[3];
+
+  err = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
+  if (err < 0) return throw_error(env, "Failed to get callback info");
+
+  if (argc < 2) return throw_error(env, "Context and path required");
+
+  context_wrap_t *wrap;
+  err = js_get_value_external(env, argv[0], (void **)&wrap);
+  if (err < 0 || !wrap || !wrap->ptr) return throw_error(env, "Invalid context");
+  if (wrap->busy) return throw_error(env, "Context is busy");
+  context_invalidate_views(env, wrap);
+
+  char *path = get_string_value(env, argv[1]);
+  if (!path) return throw_error(env, "Invalid path");
+
+  int32_t seq = parse_state_sequence(env, argc, argv, 2);
+
+  size_t capacity = llama_n_ctx(wrap->ptr);
+  llama_token *tokens = (llama_token *)malloc(capacity * sizeof(llama_token));
+  if (!tokens) {
+    free(path);
+    return throw_error(env, "Memory allocation failed");
+  }
+
+  size_t n_tokens = 0;
+  bool ok = seq < 0
+    ? llama_state_load_file(wrap->ptr, path, tokens, capacity, &n_tokens)
+    : llama_state_seq_load_file(wrap->ptr, path, seq, tokens, capacity, &n_tokens) > 0;
+  free(path);
+
+  if (!ok) {
+    free(tokens);
+    wrap->n_cached = 0;
+    return throw_error(env, "Failed to load state file");
+  }
+
+  if (seq <= 0) context_set_cached(wrap, tokens, n_tokens);
+  free(tokens);
+
+  js_value_t *result;
+  js_create_uint32(env, (uint32_t)n_tokens, &result);
+  return result;
+}
+
+// sample(ctx: Context, sampler: Sampler, idx: number): number
+static js_value_t *
+fn_sample(js_env_t *env, js_callback_info_t *info) {
+  int err;
+  size_t argc = 3;
+  js_value_t *argv[3];
+
+  err = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
+  if (err < 0) return throw_error(env, "Failed to get callback info");
+
+  if (argc < 3) return throw_error(env, "Context, sampler, and index required");
+
+  // Get context wrapper
+  context_wrap_t *ctx_wrap;
+  err = js_get_value_external(env, argv[0], (void **)&ctx_wrap);
+  if (err < 0 || !ctx_wrap || !ctx_wrap->ptr) return throw_error(env, "Invalid context");
+  if (ctx_wrap->busy) return throw_error(env, "Context is busy");
+
+  struct llama_context *ctx = ctx_wrap->ptr;
+
+  // Get sampler wrapper
+  sampler_wrap_t *sampler_wrap;
+  err = js_get_value_external(env, argv[1], (void **)&sampler_wrap);
+  if (err < 0 || !sampler_wrap || !sampler_wrap->ptr) return throw_error(env, "Invalid sampler");
+  if (sampler_wrap->busy) return throw_error(env, "Sampler is busy");
+
+  struct llama_sampler *sampler = sampler_wrap->ptr;
+
+  int32_t idx;
+  err = js_get_value_int32(env, argv[2], &idx);
+  if (err < 0) return throw_error(env, "Invalid index");
+  if (!resolve_sample_index(ctx_wrap, &idx)) return throw_error(env, "No logits for that index; it was decoded in an earlier chunk");
+
+  llama_token token = llama_sampler_sample(sampler, ctx, idx);
+
+  js_value_t *result;
+  err = js_create_int32(env, token, &result);
+  if (err < 0) return throw_error(env, "Failed to create result");
+
+  return result;
+}
+
+typedef struct {
+  async_work_t base;
+  int32_t idx;
+  llama_token token;
+} sample_work_t;
+
+static void
+sample_execute(async_work_t *work) {
+  sample_work_t *w = (sample_work_t *)work;
+  w->token = llama_sampler_sample(work->sampler_wrap->ptr, work->ctx_wrap->ptr, w->idx);
+}
+
+static js_value_t *
+sample_complete(async_work_t *work) {
+  sample_work_t *w = (sample_work_t *)work;
+
+  if (work->error) return NULL;
+
+  js_value_t *result;
+  if (js_create_int32(work->env, w->token, &result) < 0) {
+    work->error = "Failed to create result";
+    return NULL;
+  }
+  return result;
+}
+
+// sampleAsync(ctx: Context, sampler: Sampler, idx: number): Promise<number>
+static js_value_t *
+fn_sample_async(js_env_t *env, js_callback_info_t *info) {
+  int err;
+  size_t argc = 3;
+  js_value_t *argv[3];
+
+  err = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
+  if (err < 0) return throw_error(env, "Failed to get callback info");
+
+  if (argc < 3) return throw_error(env, "Context, sampler, and index required");
+
+  context_wrap_t *ctx_wrap;
+  err = js_get_value_external(env, argv[0], (void **)&ctx_wrap);
+  if (err < 0 || !ctx_wrap || !ctx_wrap->ptr) return throw_error(env, "Invalid context");
+  if (ctx_wrap->busy) return throw_error(env, "Context is busy");
+
+  sampler_wrap_t *sampler_wrap;
+  err = js_get_value_external(env, argv[1], (void **)&sampler_wrap);
+  if (err < 0 || !sampler_wrap || !sampler_wrap->ptr) return throw_error(env, "Invalid sampler");
+  if (sampler_wrap->busy) return throw_error(env, "Sampler is busy");
+
+  int32_t idx;
+  err = js_get_value_int32(env, argv[2], &idx);
+  if (err < 0) return throw_error(env, "Invalid index");
+  if (!resolve_sample_index(ctx_wrap, &idx)) return throw_error(env, "No logits for that index; it was decoded in an earlier chunk");
+
+  sample_work_t *work = (sample_work_t *)calloc(1, sizeof(sample_work_t));
+  if (!work) return throw_error(env, "Memory allocation failed");
+
+  work->idx = idx;
+  work->base.ctx_wrap = ctx_wrap;
+  work->base.sampler_wrap = sampler_wrap;
+  work->base.execute = sample_execute;
+  work->base.complete = sample_complete;
+
+  js_value_t *handles[2] = {argv[0], argv[1]};
+  return queue_async_work(env, &work->base, handles);
+}
+
+// Fused generation loop shared by generate() and generateStream(). Runs the
+// whole sample -> check -> decode cycle natively so each token costs one
+// llama_decode and no JS round trips.
+struct stream_s {
+  uv_mutex_t lock;
+  text_buf_t pending;  // Text not yet delivered to JS
+  bool queued;         // A threadsafe call is already pending
+  bool cancelled;      // Set by generateCancel
+  js_threadsafe_function_t *tsfn;
+};
+
+typedef struct {
+  async_work_t base;
+  const struct llama_vocab *vocab;
+  llama_token *prompt;
+  size_t n_prompt;
+  int32_t max_tokens;
+  bool special;
+  bool reuse_prefix;
+  char **stop;
+  size_t n_stop;
+  // Speculative decoding
+  context_wrap_t *draft;
+  js_value_t *draft_handle;  // Valid during parse only
+  js_ref_t *draft_ref;       // Keeps the draft context alive (async only)
+  int32_t draft_tokens;
+  int32_t lookup_ngram;  // Prompt lookup n-gram size, 0 when disabled
+  int32_t n_drafted;
+  int32_t n_accepted;
+  // Output
+  llama_token *tokens;
+  size_t n_tokens;
+  size_t cap_tokens;
+  text_buf_t text;
+  size_t emitted;
+  const char *stop_reason;
+  // Streaming (async only)
+  stream_t *stream;
+  js_ref_t *on_chunk;
+} generate_job_t;
+
+static void
+generate_job_free(generate_job_t *job) {
+  free(job->prompt);
+  for (size_t i = 0; i < job->n_stop; i++) free(job->stop[i]);
+  free(job->stop);
+  free(job->tokens);
+  free(job->text.data);
+}
+
+// Truncate at the first stop sequence that appears in text added since
+// prev_len. Returns true if one was found.
+static bool
+generate_check_stop(generate_job_t *job, size_t prev_len) {
+  for (size_t i = 0; i < job->n_stop; i++) {
+    size_t n = strlen(job->stop[i]);
+    if (n == 0 || n > job->text.len) continue;
+    size_t from = prev_len >= n - 1 ? prev_len - (n - 1) : 0;
+    for (size_t p = from; p + n <= job->text.len; p++) {
+      if (memcmp(job->text.data + p, job->stop[i], n) == 0) {
+        job->text.len = p;
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+// Bytes of text that can be emitted without splitting a UTF-8 character or
+// leaking the start of a stop sequence that may complete on a later token.
+static size_t
+generate_safe_len(generate_job_t *job) {
+  size_t safe = utf8_complete_len(job->text.data, job->text.len);
+  for (size_t i = 0; i < job->n_stop; i++) {
+    size_t n = strlen(job->stop[i]);
+    for (size_t k = n > 0 ? n - 1 : 0; k > 0; k--) {
+      if (k <= job->text.len && memcmp(job->text.data + job->text.len - k, job->stop[i], k) == 0) {
+        if (job->text.len - k < safe) safe = job->text.len - k;
+        break;
+      }
+    }
+  }
+  return safe;
+}
+
+static void
+generate_emit(generate_job_t *job, size_t upto) {
+  if (upto <= job->emitted) return;
+  if (job->stream) {
+    stream_t *stream = job->stream;
+    uv_mutex_lock(&stream->lock);
+    text_buf_append(&stream->pending, job->text.data + job->emitted, upto - job->emitted);
+    bool queue = !stream->queued;
+    stream->queued = true;
+    uv_mutex_unlock(&stream->lock);
+    if (queue) js_call_threadsafe_function(stream->tsfn, NULL, js_threadsafe_function_nonblocking);
+  }
+  job->emitted = upto;
+}
+
+// Whether generateCancel was called. Checked before each token, while the KV
+// cache holds exactly the tokens output so far.
+static bool
+generate_cancelled(generate_job_t *job) {
+  if (!job->stream) return false;
+  uv_mutex_lock(&job->stream->lock);
+  bool cancelled = job->stream->cancelled;
+  uv_mutex_unlock(&job->stream->lock);
+  if (cancelled) job->stop_reason = "cancelled";
+  return cancelled;
+}
+
+enum {
+  GENERATE_CONTINUE,
+  GENERATE_EOG,
+  GENERATE_STOP,
+  GENERATE_ERROR
+};
+
+// Add a sampled token to the output. An EOG token ends generation without
+// being output; a completed stop sequence ends it after.
+static int
+generate_push(generate_job_t *job, llama_token token) {
+  if (llama_vocab_is_eog(job->vocab, token)) {
+    job->stop_reason = "eog";
+    return GENERATE_EOG;
+  }
+
+  if (job->n_tokens == job->cap_tokens) {
+    size_t cap = job->cap_tokens ? job->cap_tokens * 2 : 64;
+    llama_token *tokens = (llama_token *)realloc(job->tokens, cap * sizeof(llama_token));
+    if (!tokens) {
+      job->base.error = "Memory allocation failed";
+      return GENERATE_ERROR;
+    }
+    job->tokens = tokens;
+    job->cap_tokens = cap;
+  }
+  job->tokens[job->n_tokens++] = token;
+
+  size_t prev_len = job->text.len;
+  if (!text_buf_append_token(&job->text, job->vocab, token, job->special)) {
+    job->base.error = "Memory allocation failed";
+    return GENERATE_ERROR;
+  }
+
+  if (generate_check_stop(job, prev_len)) {
+    job->stop_reason = "stop";
+    return GENERATE_STOP;
+  }
+
+  return GENERATE_CONTINUE;
+}
+
+static const char *
+generate_decode_prompt(generate_job_t *job) {
+  context_wrap_t *ctx_wrap = job->base.ctx_wrap;
+  if (job->n_prompt == 0) return NULL;
+  return job->reuse_prefix
+    ? context_decode_prefix(ctx_wrap, job->prompt, job->n_prompt, NULL)
+    : context_decode(ctx_wrap, job->prompt, job->n_prompt, NULL);
+}
+
+// Greedy continuation of history from the draft context. The draft's cache
+// follows history through the prefix cache, so each call decodes only the
+// tokens accepted since the last one.
+static int32_t
+generate_draft(generate_job_t *job, llama_token *history, size_t n_history, llama_token *out, int32_t n_max) {
+  context_wrap_t *draft = job->draft;
+
+  job->base.error = context_decode_prefix(draft, history, n_history, NULL);
+  if (job->base.error) return -1;
+
+  // Vocabularies may differ in size; only tokens both know are proposed
+  int32_t n_vocab = llama_vocab_n_tokens(job->vocab);
+  int32_t n_draft_vocab = llama_vocab_n_tokens(llama_model_get_vocab(llama_get_model(draft->ptr)));
+  if (n_draft_vocab < n_vocab) n_vocab = n_draft_vocab;
+  int32_t n = 0;
+
+  while (n < n_max) {
+    const float *logits = llama_get_logits_ith(draft->ptr, -1);
+    llama_token best = 0;
+    for (llama_token t = 1; t < n_vocab; t++) {
+      if (logits[t] > logits[best]) best = t;
+    }
+    out[n++] = best;
+
+    if (n == n_max || llama_vocab_is_eog(job->vocab, best)) break;
+
+    job->base.error = context_decode(draft, &best, 1, NULL);
+    if (job->base.error) return -1;
+  }
+
+  return n;
+}
+
+// Prompt lookup: find the most recent earlier occurrence of the last n tokens
+// of history, trying n from lookup_ngram down to 2 (or 1 if that is the size),
+// and guess the tokens that followed it. Output that copies from the prompt
+// or repeats itself is guessed for free.
+static int32_t
+generate_lookup(generate_job_t *job, const llama_token *history, size_t n_history, llama_token *out, int32_t n_max) {
+  int32_t n_min = job->lookup_ngram > 1 ? 2 : 1;
+
+  for (int32_t n = job->lookup_ngram; n >= n_min; n--) {
+    if ((size_t)n >= n_history) continue;
+    const llama_token *pattern = history + n_history - n;
+
+    for (size_t j = n_history - n; j-- > 0;) {
+      if (memcmp(history + j, pattern, n * sizeof(llama_token)) != 0) continue;
+
+      size_t from = j + n;
+      int32_t count = 0;
+      while (count < n_max && from + count < n_history) {
+        out[count] = history[from + count];
+        count++;
+      }
+      return count;
+    }
+  }
+
+  return 0;
+}
+
+// Guess up to n_max tokens continuing history: from prompt lookup first, then
+// from the draft context. Returns -1 with base.error set on failure.
+static int32_t
+generate_propose(generate_job_t *job, llama_token *history, size_t n_history, llama_token *out, int32_t n_max) {
+  if (job->lookup_ngram > 0) {
+    int32_t n = generate_lookup(job, history, n_history, out, n_max);
+    if (n > 0 || !job->draft) return n;
+  }
+  return generate_draft(job, history, n_history, out, n_max);
+}
+
+// Speculative generation: each step decodes the last sampled token together
+// with a guess at the tokens that follow, then samples from the target at
+// every position and keeps guesses for as long as they match. The output is
+// the same as generate_run(); a correct guess saves one decode.
+static void
+generate_run_speculative(generate_job_t *job) {
+  async_work_t *work = &job->base;
+  context_wrap_t *ctx_wrap = work->ctx_wrap;
+  struct llama_context *ctx = ctx_wrap->ptr;
+  struct llama_sampler *sampler = work->sampler_wrap->ptr;
+  llama_memory_t mem = llama_get_memory(ctx);
+
+  job->stop_reason = "length";
+
+  if (job->n_prompt == 0) {
+    work->error = "Speculative generation needs a prompt";
+    return;
+  }
+
+  work->error = generate_decode_prompt(job);
+  if (work->error) return;
+
+  int32_t n_draft_max = job->draft_tokens;
+  if (n_draft_max > (int32_t)llama_n_batch(ctx) - 1) n_draft_max = (int32_t)llama_n_batch(ctx) - 1;
+  if (n_draft_max < 0) n_draft_max = 0;
+
+  // Prompt and output so far, which the draft continues
+  size_t n_history = job->n_prompt;
+  size_t cap_history = job->n_prompt + 256;
+  llama_token *history = (llama_token *)malloc(cap_history * sizeof(llama_token));
+  llama_token *batch = (llama_token *)malloc((n_draft_max + 1) * sizeof(llama_token));
+  int8_t *logits = (int8_t *)malloc(n_draft_max + 1);
+  if (!history || !batch || !logits) {
+    work->error = "Memory allocation failed";
+    goto done;
+  }
+  memcpy(history, job->prompt, job->n_prompt * sizeof(llama_token));
+  memset(logits, 1, n_draft_max + 1);
+
+  {
+    llama_token token = llama_sampler_sample(sampler, ctx, -1);
+
+    for (;;) {
+      if (generate_cancelled(job)) break;
+
+      int status = generate_push(job, token);
+      if (status == GENERATE_EOG || status == GENERATE_ERROR) break;
+
+      if (status == GENERATE_STOP || job->n_tokens >= (size_t)job->max_tokens) {
+        // Keep the KV cache in step with the returned tokens
+        work->error = context_decode(ctx_wrap, &token, 1, NULL);
+        break;
+      }
+
+      generate_emit(job, generate_safe_len(job));
+
+      if (n_history + n_draft_max + 1 > cap_history) {
+        cap_history = (n_history + n_draft_max + 1) * 2;
+        llama_token *grown = (llama_token *)realloc(history, cap_history * sizeof(llama_token));
+        if (!grown) {
+          work->error = "Memory allocation failed";
+          break;
+        }
+        history = grown;
+      }
+      history[n_history++] = token;
+
+      // Each step outputs the accepted guesses plus one sampled token
+      int32_t n_max = job->max_tokens - (int32_t)job->n_tokens - 1;
+      if (n_max > n_draft_max) n_max = n_draft_max;
+
+      int32_t n_draft = 0;
+      if (n_max > 0) {
+        n_draft = generate_propose(job, history, n_history, batch + 1, n_max);
+        if (n_draft < 0) break;
+      }
+
+      batch[0] = token;
+      work->error = context_decode(ctx_wrap, batch, n_draft + 1, logits);
+      if (work->error) break;
+
+      // Taken after the decode, which may have shifted the context
+      llama_pos n_past = llama_memory_seq_pos_max(mem, 0) + 1 - (n_draft + 1);
+
+      job->n_drafted += n_draft;
+
+      int32_t n_accepted = 0;
+      llama_token next;
+      status = GENERATE_CONTINUE;
+
+      for (;;) {
+        next = llama_sampler_sample(sampler, ctx, n_accepted);
+        if (n_accepted >= n_draft || next != batch[n_accepted + 1]) break;
+
+        n_accepted++;
+        status = generate_push(job, next);
+        if (status != GENERATE_CONTINUE) break;
+        history[n_history++] = next;
+      }
+
+      job->n_accepted += n_accepted;
+
+      // Drop the rejected guesses from the cache; an accepted EOG is not output
+      llama_pos keep = n_past + 1 + n_accepted - (status == GENERATE_EOG ? 1 : 0);
+      if (keep < n_past + 1 + n_draft) {
+        if (!llama_memory_seq_rm(mem, 0, keep, -1)) {
+          work->error = "Context memory can't be rolled back for speculative decoding";
+          break;
+        }
+        if (ctx_wrap->n_cached > (size_t)keep) ctx_wrap->n_cached = (size_t)keep;
+      }
+
+      if (status != GENERATE_CONTINUE) break;
+
+      token = next;
+    }
+  }
+
+  generate_emit(job, job->text.len);
+
+done:
+  free(history);
+  free(batch);
+  free(logits);
+}
+
+static void
+generate_run(generate_job_t *job) {
+  async_work_t *work = &job->base;
+  context_wrap_t *ctx_wrap = work->ctx_wrap;
+  struct llama_sampler *sampler = work->sampler_wrap->ptr;
+
+  if (job->draft || job->lookup_ngram > 0) {
+    generate_run_speculative(job);
+    return;
+  }
+
+  job->stop_reason = "length";
+
+  work->error = generate_decode_prompt(job);
+  if (work->error) return;
+
+  for (int32_t i = 0; i < job->max_tokens; i++) {
+    if (generate_cancelled(job)) break;
+
+    llama_token token = llama_sampler_sample(sampler, ctx_wrap->ptr, -1);
+
+    int status = generate_push(job, token);
+    if (status == GENERATE_EOG || status == GENERATE_ERROR) break;
+
+    // Keep the KV cache in step with the returned tokens
+    work->error = context_decode(ctx_wrap, &token, 1, NULL);
+    if (work->error) return;
+
+    if (status == GENERATE_STOP) break;
+
+    generate_emit(job, generate_safe_len(job));
+  }
+
+  generate_emit(job, job->text.len);
+}
+
+// Result object: { text: string, tokens: Int32Array, stopReason: string }
+static js_value_t *
+generate_result(js_env_t *env, generate_job_t *job) {
+  int err;
+  js_value_t *result, *val;
+
+  err = js_create_object(env, &result);
+  if (err < 0) return NULL;
+
+  err = js_create_string_utf8(env, (utf8_t *)job->text.data, job->text.len, &val);
+  if (err < 0) return NULL;
+  js_set_named_property(env, result, "text", val);
+
+  js_value_t *array_buffer;
+  void *data;
+  err = js_create_arraybuffer(env, job->n_tokens * sizeof(int32_t), &data, &array_buffer);
+  if (err < 0) return NULL;
+  if (job->n_tokens > 0) memcpy(data, job->tokens, job->n_tokens * sizeof(int32_t));
+
+  err = js_create_typedarray(env, js_int32array, job->n_tokens, array_buffer, 0, &val);
+  if (err < 0) return NULL;
+  js_set_named_property(env, result, "tokens", val);
+
+  err = js_create_string_utf8(env, (utf8_t *)job->stop_reason, strlen(job->stop_reason), &val);
+  if (err < 0) return NULL;
+  js_set_named_property(env, result, "stopReason", val);
+
+  if (job->draft || job->lookup_ngram > 0) {
+    js_create_int32(env, job->n_drafted, &val);
+    js_set_named_property(env, result, "drafted", val);
+    js_create_int32(env, job->n_accepted, &val);
+    js_set_named_property(env, result, "accepted", val);
+  }
+
+  return result;
+}
+
+// Whether a draft model's tokens mean the same as the target's, like
+// common_speculative_are_compatible in llama.cpp: same tokenizer and special
+// tokens, sizes within a few padding tokens, and the same token texts.
+#define DRAFT_VOCAB_MAX_SIZE_DIFF 128
+#define DRAFT_VOCAB_CHECK_START_ID 5
+
+static bool
+draft_vocab_compatible(const struct llama_vocab *target, const struct llama_vocab *draft) {
+  if (llama_vocab_type(target) != llama_vocab_type(draft)) return false;
+
+  if (llama_vocab_get_add_bos(target) != llama_vocab_get_add_bos(draft) ||
+      llama_vocab_get_add_eos(target) != llama_vocab_get_add_eos(draft)) {
+    return false;
+  }
+  if (llama_vocab_get_add_bos(target) && llama_vocab_bos(target) != llama_vocab_bos(draft)) return false;
+  if (llama_vocab_get_add_eos(target) && llama_vocab_eos(target) != llama_vocab_eos(draft)) return false;
+
+  int32_t n_target = llama_vocab_n_tokens(target);
+  int32_t n_draft = llama_vocab_n_tokens(draft);
+  int32_t diff = n_target > n_draft ? n_target - n_draft : n_draft - n_target;
+  if (diff > DRAFT_VOCAB_MAX_SIZE_DIFF) return false;
+
+  int32_t n = n_target < n_draft ? n_target : n_draft;
+  for (int32_t i = DRAFT_VOCAB_CHECK_START_ID; i < n; i++) {
+    if (strcmp(llama_vocab_get_text(target, i), llama_vocab_get_text(draft, i)) != 0) return false;
+  }
+
+  return true;
+}
+
+// Parse arguments shared by generate() and generateStream():
+// (ctx, sampler, tokens, opts?) with opts { maxTokens, stop, special,
+// reusePrefix, draft, lookup, draftTokens }
+static bool
+generate_parse(js_env_t *env, size_t argc, js_value_t *argv[], generate_job_t *job) {
+  int err;
+
+  if (argc < 3) {
+    throw_error(env, "Context, sampler and tokens required");
+    return false;
+  }
+
+  context_wrap_t *ctx_wrap;
+  err = js_get_value_external(env, argv[0], (void **)&ctx_wrap);
+  if (err < 0 || !ctx_wrap || !ctx_wrap->ptr) {
+    throw_error(env, "Invalid context");
+    return false;
+  }
+  if (ctx_wrap->busy) {
+    throw_error(env, "Context is busy");
+    return false;
+  }
+  context_invalidate_views(env, ctx_wrap);
+
+  sampler_wrap_t *sampler_wrap;
+  err = js_get_value_external(env, argv[1], (void **)&sampler_wrap);
+  if (err < 0 || !sampler_wrap || !sampler_wrap->ptr) {
+    throw_error(env, "Invalid sampler");
+    return false;
+  }
+  if (sampler_wrap->busy) {
+    throw_error(env, "Sampler is busy");
+    return false;
+  }
+
+  bool is_typedarray;
+  err = js_is_typedarray(env, argv[2], &is_typedarray);
+  if (err < 0 || !is_typedarray) {
+    throw_error(env, "Tokens must be Int32Array");
+    return false;
+  }
+
+  js_typedarray_type_t type;
+  size_t length;
+  void *data;
+  err = js_get_typedarray_info(env, argv[2], &type, &data, &length, NULL, NULL);
+  if (err < 0 || type != js_int32array) {
+    throw_error(env, "Tokens must be Int32Array");
+    return false;
+  }
+
+  job->base.ctx_wrap = ctx_wrap;
+  job->base.sampler_wrap = sampler_wrap;
+  job->vocab = llama_model_get_vocab(llama_get_model(ctx_wrap->ptr));
+  job->max_tokens = 128;
+  job->special = true;
+
+  job->prompt = (llama_token *)malloc((length ? length : 1) * sizeof(llama_token));
+  if (!job->prompt) {
+    throw_error(env, "Memory allocation failed");
+    return false;
+  }
+  memcpy(job->prompt, data, length * sizeof(llama_token));
+  job->n_prompt = length;
+
+  if (argc >= 4) {
+    js_value_t *opts = argv[3];
+    js_value_t *val;
+    bool has_prop;
+
+    err = js_has_named_property(env, opts, "maxTokens", &has_prop);
+    if (err == 0 && has_prop) {
+      err = js_get_named_property(env, opts, "maxTokens", &val);
+      if (err == 0) js_get_value_int32(env, val, &job->max_tokens);
+    }
+
+    err = js_has_named_property(env, opts, "special", &has_prop);
+    if (err == 0 && has_prop) {
+      err = js_get_named_property(env, opts, "special", &val);
+      if (err == 0) js_get_value_bool(env, val, &job->special);
+    }
+
+    job->reuse_prefix = parse_reuse_prefix(env, opts);
+
+    // draft: Context proposing tokens for speculative decoding
+    err = js_has_named_property(env, opts, "draft", &has_prop);
+    if (err == 0 && has_prop) {
+      err = js_get_named_property(env, opts, "draft", &val);
+      js_value_type_t type = js_undefined;
+      if (err == 0) js_typeof(env, val, &type);
+      if (type != js_undefined && type != js_null) {
+        context_wrap_t *draft;
+        err = js_get_value_external(env, val, (void **)&draft);
+        if (err < 0 || !draft || !draft->ptr) {
+          throw_error(env, "Invalid draft context");
+          return false;
+        }
+        if (draft == ctx_wrap) {
+          throw_error(env, "Draft context must differ from the target context");
+          return false;
+        }
+        if (draft->busy) {
+          throw_error(env, "Draft context is busy");
+          return false;
+        }
+        if (draft->embeddings) {
+          throw_error(env, "Draft context must not be an embedding context");
+          return false;
+        }
+        // The draft follows the target by prefix, which a shift breaks
+        if (ctx_wrap->shift || draft->shift) {
+          throw_error(env, "Draft speculation is not supported with contextShift");
+          return false;
+        }
+        const struct llama_vocab *draft_vocab = llama_model_get_vocab(llama_get_model(draft->ptr));
+        if (!draft_vocab_compatible(job->vocab, draft_vocab)) {
+          throw_error(env, "Draft model vocabulary does not match the target model");
+          return false;
+        }
+        context_invalidate_views(env, draft);
+        job->draft = draft;
+        job->draft_handle = val;
+      }
+    }
+
+    // lookup: true or the n-gram size for prompt lookup speculation
+    err = js_has_named_property(env, opts, "lookup", &has_prop);
+    if (err == 0 && has_prop) {
+      err = js_get_named_property(env, opts, "lookup", &val);
+      js_value_type_t type = js_undefined;
+      if (err == 0) js_typeof(env, val, &type);
+      if (type == js_boolean) {
+        bool lookup = false;
+        js_get_value_bool(env, val, &lookup);
+        job->lookup_ngram = lookup ? 3 : 0;
+      } else if (type == js_number) {
+        js_get_value_int32(env, val, &job->lookup_ngram);
+        if (job->lookup_ngram < 0) job->lookup_ngram = 0;
+      }
+    }
+
+    job->draft_tokens = 8;
+
+    err = js_has_named_property(env, opts, "draftTokens", &has_prop);
+    if (err == 0 && has_prop) {
+      err = js_get_named_property(env, opts, "draftTokens", &val);
+      if (err == 0) js_get_value_int32(env, val, &job->draft_tokens);
+    }
+
+    // stop: string[]
+    err = js_has_named_property(env, opts, "stop", &has_prop);
+    if (err == 0 && has_prop) {
+      err = js_get_named_property(env, opts, "stop", &val);
+      bool is_array = false;
+      if (err == 0) js_is_array(env, val, &is_array);
+      if (is_array) {
+        uint32_t n;
+        js_get_array_length(env, val, &n);
+        job->stop = (char **)calloc(n ? n : 1, sizeof(char *));
+        if (!job->stop) {
+          throw_error(env, "Memory allocation failed");
+          return false;
+        }
+        for (uint32_t i = 0; i < n; i++) {
+          js_value_t *item;
+          size_t len;
+          js_get_element(env, val, i, &item);
+          err = js_get_value_string_utf8(env, item, NULL, 0, &len);
+          if (err < 0) {
+            throw_error(env, "Stop sequences must be strings");
+            return false;
+          }
+          char *str = (char *)malloc(len + 1);
+          if (!str) {
+            throw_error(env, "Memory allocation failed");
+            return false;
+          }
+          js_get_value_string_utf8(env, item, (utf8_t *)str, len + 1, NULL);
+          job->stop[job->n_stop++] = str;
+        }
       }
     }
   }
 
-  struct llama_context *ctx = llama_init_from_model(model, params);
-  if (!ctx) return throw_error(env, "Failed to create context");
+  return true;
+}
 
-  // Create wrapper to prevent double-free
-  context_wrap_t *wrap = (context_wrap_t *)malloc(sizeof(context_wrap_t));
-  if (!wrap) {
-    llama_free(ctx);
-    return throw_error(env, "Failed to allocate wrapper");
+// generate(ctx: Context, sampler: Sampler, tokens: Int32Array, opts?: object): object
+// Decodes the prompt, then samples until EOG, a stop sequence or maxTokens.
+static js_value_t *
+fn_generate(js_env_t *env, js_callback_info_t *info) {
+  int err;
+  size_t argc = 4;
+  js_value_t *argv[4];
+
+  err = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
+  if (err < 0) return throw_error(env, "Failed to get callback info");
+
+  generate_job_t job;
+  memset(&job, 0, sizeof(job));
+
+  if (!generate_parse(env, argc, argv, &job)) {
+    generate_job_free(&job);
+    return NULL;
+  }
+
+  generate_run(&job);
+
+  if (job.base.error) {
+    generate_job_free(&job);
+    return throw_error(env, job.base.error);
+  }
+
+  js_value_t *result = generate_result(env, &job);
+  generate_job_free(&job);
+
+  if (!result) return throw_error(env, "Failed to create result");
+
+  return result;
+}
+
+static void
+stream_flush(js_env_t *env, js_value_t *function, stream_t *stream) {
+  uv_mutex_lock(&stream->lock);
+  text_buf_t pending = stream->pending;
+  memset(&stream->pending, 0, sizeof(stream->pending));
+  stream->queued = false;
+  uv_mutex_unlock(&stream->lock);
+
+  if (pending.len > 0) {
+    js_value_t *text, *global, *result;
+    js_create_string_utf8(env, (utf8_t *)pending.data, pending.len, &text);
+    js_get_global(env, &global);
+    js_call_function(env, global, function, 1, &text, &result);
+  }
+  free(pending.data);
+}
+
+// Runs on the JS thread; coalesces every piece produced since the last call
+static void
+stream_on_call(js_env_t *env, js_value_t *function, void *context, void *data) {
+  (void)data;
+  stream_flush(env, function, (stream_t *)context);
+}
+
+static void
+stream_finalize(js_env_t *env, void *data, void *hint) {
+  (void)env; (void)hint;
+  stream_t *stream = (stream_t *)data;
+  uv_mutex_destroy(&stream->lock);
+  free(stream->pending.data);
+  free(stream);
+}
+
+static void
+generate_execute(async_work_t *work) {
+  generate_run((generate_job_t *)work);
+}
+
+static js_value_t *
+generate_complete(async_work_t *work) {
+  generate_job_t *job = (generate_job_t *)work;
+  js_env_t *env = work->env;
+  js_value_t *result = NULL;
+
+  // Deliver any remaining text before the promise settles
+  if (job->on_chunk) {
+    js_value_t *function;
+    js_get_reference_value(env, job->on_chunk, &function);
+    if (job->stream) stream_flush(env, function, job->stream);
+    js_delete_reference(env, job->on_chunk);
+  }
+
+  if (job->draft) {
+    job->draft->busy = false;
+    if (job->draft->free_pending && job->draft->ptr) context_release(job->draft);
+    js_delete_reference(env, job->draft_ref);
+  }
+
+  // The stream is freed by stream_finalize once queued calls have drained
+  if (job->stream) {
+    if (work->ctx_wrap->stream == job->stream) work->ctx_wrap->stream = NULL;
+    js_release_threadsafe_function(job->stream->tsfn, js_threadsafe_function_release);
+  }
+
+  if (!work->error) {
+    result = generate_result(env, job);
+    if (!result) work->error = "Failed to create result";
+  }
+
+  generate_job_free(job);
+  return result;
+}
+
+// generateStream(ctx: Context, sampler: Sampler, tokens: Int32Array, opts: object,
+//                onChunk: (text: string) => void): Promise<object>
+// Runs generate() on a worker thread. Text is delivered to onChunk as it is
+// produced; pieces are batched when JS falls behind, and never split a UTF-8
+// character or a partially matched stop sequence.
+static js_value_t *
+fn_generate_stream(js_env_t *env, js_callback_info_t *info) {
+  int err;
+  size_t argc = 5;
+  js_value_t *argv[5];
+
+  err = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
+  if (err < 0) return throw_error(env, "Failed to get callback info");
+
+  generate_job_t *job = (generate_job_t *)calloc(1, sizeof(generate_job_t));
+  if (!job) return throw_error(env, "Memory allocation failed");
+
+  if (!generate_parse(env, argc < 4 ? argc : 4, argv, job)) {
+    generate_job_free(job);
+    free(job);
+    return NULL;
+  }
+
+  bool is_function = false;
+  if (argc >= 5) js_is_function(env, argv[4], &is_function);
+
+  if (is_function) {
+    stream_t *stream = (stream_t *)calloc(1, sizeof(stream_t));
+    if (!stream) {
+      generate_job_free(job);
+      free(job);
+      return throw_error(env, "Memory allocation failed");
+    }
+    uv_mutex_init(&stream->lock);
+
+    err = js_create_threadsafe_function(env, argv[4], 0, 1, stream_finalize, NULL, stream, stream_on_call, &stream->tsfn);
+    if (err < 0) {
+      uv_mutex_destroy(&stream->lock);
+      free(stream);
+      generate_job_free(job);
+      free(job);
+      return throw_error(env, "Failed to create stream callback");
+    }
+
+    job->stream = stream;
+    js_create_reference(env, argv[4], 1, &job->on_chunk);
+  }
+
+  if (job->draft) {
+    js_create_reference(env, job->draft_handle, 1, &job->draft_ref);
+    job->draft->busy = true;
+  }
+
+  job->base.execute = generate_execute;
+  job->base.complete = generate_complete;
+
+  context_wrap_t *ctx_wrap = job->base.ctx_wrap;
+  js_value_t *handles[2] = {argv[0], argv[1]};
+  js_value_t *promise = queue_async_work(env, &job->base, handles);
+
+  // Not busy if queueing failed and the job has already completed
+  if (promise && ctx_wrap->busy) ctx_wrap->stream = job->stream;
+  return promise;
+}
+
+// generateCancel(ctx: Context): boolean
+// Stop the generateStream running on ctx before its next token. Its promise
+// still resolves, with the output so far and stopReason 'cancelled'. Returns
+// false if no stream is running.
+static js_value_t *
+fn_generate_cancel(js_env_t *env, js_callback_info_t *info) {
+  int err;
+  size_t argc = 1;
+  js_value_t *argv[1];
+
+  err = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
+  if (err < 0) return throw_error(env, "Failed to get callback info");
+
+  context_wrap_t *ctx_wrap;
+  err = js_get_value_external(env, argv[0], (void **)&ctx_wrap);
+  if (err < 0 || !ctx_wrap) return throw_error(env, "Invalid context");
+
+  stream_t *stream = ctx_wrap->stream;
+  if (stream) {
+    uv_mutex_lock(&stream->lock);
+    stream->cancelled = true;
+    uv_mutex_unlock(&stream->lock);
+  }
+
+  js_value_t *result;
+  js_get_boolean(env, stream != NULL, &result);
+  return result;
+}
+
+// Continuous batching scheduler. Requests are assigned to free sequence slots
+// of a context created with `sequences > 1`; each step packs the next token of
+// every generating request plus as much pending prompt as fits into a single
+// llama_batch, then samples each request from its own output row. Requests
+// join and leave between steps.
+typedef struct {
+  int32_t id;
+  llama_seq_id seq;
+  sampler_wrap_t *sampler;
+  js_ref_t *sampler_ref;
+  llama_token *prompt;
+  size_t n_prompt;
+  size_t n_prefilled;
+  int32_t max_tokens;
+  int32_t n_generated;
+  llama_pos n_past;
+  llama_token next;    // Sampled token to feed on the next step
+  bool has_next;
+  int32_t batch_idx;   // Output row in the current batch, or -1
+} sched_request_t;
+
+typedef struct {
+  context_wrap_t *ctx_wrap;
+  js_ref_t *ctx_ref;
+  struct llama_batch batch;
+  int32_t n_batch;
+  llama_pos n_ctx_seq;
+  sched_request_t **slots;  // Indexed by sequence id
+  int32_t n_slots;
+  // Waiting for a free slot, FIFO. Guarded by lock, as submit may add to it
+  // while a step runs on a worker thread
+  uv_mutex_t lock;
+  sched_request_t **queue;
+  int32_t n_queue;
+  int32_t cap_queue;
+  int32_t next_id;
+  bool busy;
+  bool free_pending;
+  // Results of the last step
+  int32_t *out_ids;
+  llama_token *out_tokens;
+  int32_t n_out;
+  sched_request_t **finished;
+  int32_t n_finished;
+} scheduler_wrap_t;
+
+static void
+sched_request_release(js_env_t *env, sched_request_t *req) {
+  req->sampler->busy = false;
+  if (req->sampler->free_pending && req->sampler->ptr) {
+    llama_sampler_free(req->sampler->ptr);
+    req->sampler->ptr = NULL;
+  }
+  if (req->sampler_ref) js_delete_reference(env, req->sampler_ref);
+  free(req->prompt);
+  free(req);
+}
+
+static void
+sched_finish(scheduler_wrap_t *sched, sched_request_t *req) {
+  llama_memory_seq_rm(llama_get_memory(sched->ctx_wrap->ptr), req->seq, -1, -1);
+  sched->slots[req->seq] = NULL;
+  sched->finished[sched->n_finished++] = req;
+}
+
+// One scheduling step. Does not touch the JS environment.
+static const char *
+sched_step(scheduler_wrap_t *sched) {
+  struct llama_context *ctx = sched->ctx_wrap->ptr;
+  const struct llama_vocab *vocab = llama_model_get_vocab(llama_get_model(ctx));
+  struct llama_batch *batch = &sched->batch;
+
+  sched->n_out = 0;
+
+  // Admit waiting requests into free slots
+  uv_mutex_lock(&sched->lock);
+  for (int32_t s = 0; s < sched->n_slots && sched->n_queue > 0; s++) {
+    if (sched->slots[s]) continue;
+    sched_request_t *req = sched->queue[0];
+    memmove(sched->queue, sched->queue + 1, (sched->n_queue - 1) * sizeof(sched_request_t *));
+    sched->n_queue--;
+    req->seq = s;
+    llama_memory_seq_rm(llama_get_memory(ctx), s, -1, -1);
+    sched->slots[s] = req;
+  }
+  uv_mutex_unlock(&sched->lock);
+
+  batch->n_tokens = 0;
+
+  // Generation tokens first so running requests never stall behind prefill
+  for (int32_t s = 0; s < sched->n_slots; s++) {
+    sched_request_t *req = sched->slots[s];
+    if (!req) continue;
+    req->batch_idx = -1;
+    if (!req->has_next || batch->n_tokens >= sched->n_batch) continue;
+
+    int32_t i = batch->n_tokens++;
+    batch->token[i] = req->next;
+    batch->pos[i] = req->n_past++;
+    batch->n_seq_id[i] = 1;
+    batch->seq_id[i][0] = req->seq;
+    batch->logits[i] = true;
+    req->batch_idx = i;
+    req->has_next = false;
+  }
+
+  // Fill the rest of the batch with pending prompt chunks
+  for (int32_t s = 0; s < sched->n_slots; s++) {
+    sched_request_t *req = sched->slots[s];
+    if (!req || req->n_prefilled == req->n_prompt) continue;
+
+    while (req->n_prefilled < req->n_prompt && batch->n_tokens < sched->n_batch) {
+      int32_t i = batch->n_tokens++;
+      batch->token[i] = req->prompt[req->n_prefilled++];
+      batch->pos[i] = req->n_past++;
+      batch->n_seq_id[i] = 1;
+      batch->seq_id[i][0] = req->seq;
+      batch->logits[i] = req->n_prefilled == req->n_prompt;
+      if (batch->logits[i]) req->batch_idx = i;
+    }
+  }
+
+  if (batch->n_tokens == 0) return NULL;
+
+  if (context_llama_decode(sched->ctx_wrap, *batch) != 0) return "Decode failed";
+
+  for (int32_t s = 0; s < sched->n_slots; s++) {
+    sched_request_t *req = sched->slots[s];
+    if (!req || req->batch_idx < 0) continue;
+
+    llama_token token = llama_sampler_sample(req->sampler->ptr, ctx, req->batch_idx);
+
+    if (llama_vocab_is_eog(vocab, token)) {
+      sched_finish(sched, req);
+      continue;
+    }
+
+    sched->out_ids[sched->n_out] = req->id;
+    sched->out_tokens[sched->n_out] = token;
+    sched->n_out++;
+
+    req->n_generated++;
+    req->next = token;
+    req->has_next = true;
+
+    if (req->n_generated >= req->max_tokens || req->n_past >= sched->n_ctx_seq) {
+      sched_finish(sched, req);
+    }
+  }
+
+  return NULL;
+}
+
+// Step result: { ids: Int32Array, tokens: Int32Array, finished: Int32Array }
+// ids[i] produced tokens[i]; finished lists requests that left this step.
+// Frees finished requests, so must run on the JS thread.
+static js_value_t *
+sched_collect(js_env_t *env, scheduler_wrap_t *sched) {
+  js_value_t *result, *array_buffer, *val;
+  void *data;
+
+  js_create_object(env, &result);
+
+  js_create_arraybuffer(env, sched->n_out * sizeof(int32_t), &data, &array_buffer);
+  if (sched->n_out > 0) memcpy(data, sched->out_ids, sched->n_out * sizeof(int32_t));
+  js_create_typedarray(env, js_int32array, sched->n_out, array_buffer, 0, &val);
+  js_set_named_property(env, result, "ids", val);
+
+  js_create_arraybuffer(env, sched->n_out * sizeof(int32_t), &data, &array_buffer);
+  if (sched->n_out > 0) memcpy(data, sched->out_tokens, sched->n_out * sizeof(int32_t));
+  js_create_typedarray(env, js_int32array, sched->n_out, array_buffer, 0, &val);
+  js_set_named_property(env, result, "tokens", val);
+
+  js_create_arraybuffer(env, sched->n_finished * sizeof(int32_t), &data, &array_buffer);
+  for (int32_t i = 0; i < sched->n_finished; i++) {
+    ((int32_t *)data)[i] = sched->finished[i]->id;
+    sched_request_release(env, sched->finished[i]);
+  }
+  js_create_typedarray(env, js_int32array, sched->n_finished, array_buffer, 0, &val);
+  js_set_named_property(env, result, "finished", val);
+
+  sched->n_finished = 0;
+  sched->n_out = 0;
+
+  return result;
+}
+
+static void
+sched_destroy(js_env_t *env, scheduler_wrap_t *sched) {
+  for (int32_t s = 0; s < sched->n_slots; s++) {
+    if (sched->slots[s]) sched_request_release(env, sched->slots[s]);
+  }
+  for (int32_t i = 0; i < sched->n_queue; i++) sched_request_release(env, sched->queue[i]);
+  for (int32_t i = 0; i < sched->n_finished; i++) sched_request_release(env, sched->finished[i]);
+
+  if (sched->ctx_wrap) {
+    // Slots used sequence 0 too, so the prefix mirror is stale
+    sched->ctx_wrap->n_cached = 0;
+    sched->ctx_wrap->busy = false;
+    if (sched->ctx_wrap->free_pending && sched->ctx_wrap->ptr) {
+      context_release(sched->ctx_wrap);
+    }
+  }
+  if (sched->ctx_ref) js_delete_reference(env, sched->ctx_ref);
+
+  llama_batch_free(sched->batch);
+  free(sched->slots);
+  free(sched->queue);
+  free(sched->out_ids);
+  free(sched->out_tokens);
+  free(sched->finished);
+
+  sched->ctx_wrap = NULL;
+  sched->ctx_ref = NULL;
+  sched->slots = NULL;
+  sched->n_slots = 0;
+  sched->queue = NULL;
+  sched->n_queue = 0;
+  sched->n_finished = 0;
+}
+
+// createScheduler(ctx: Context): Scheduler
+// The scheduler owns the context until freeScheduler(); the context is busy
+// for any other use in the meantime.
+static js_value_t *
+fn_create_scheduler(js_env_t *env, js_callback_info_t *info) {
+  int err;
+  size_t argc = 1;
+  js_value_t *argv[1];
+
+  err = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
+  if (err < 0) return throw_error(env, "Failed to get callback info");
+
+  if (argc < 1) return throw_error(env, "Context required");
+
+  context_wrap_t *ctx_wrap;
+  err = js_get_value_external(env, argv[0], (void **)&ctx_wrap);
+  if (err < 0 || !ctx_wrap || !ctx_wrap->ptr) return throw_error(env, "Invalid context");
+  if (ctx_wrap->busy) return throw_error(env, "Context is busy");
+  context_invalidate_views(env, ctx_wrap);
+
+  struct llama_context *ctx = ctx_wrap->ptr;
+
+  scheduler_wrap_t *sched = (scheduler_wrap_t *)calloc(1, sizeof(scheduler_wrap_t));
+  if (!sched) return throw_error(env, "Memory allocation failed");
+  uv_mutex_init(&sched->lock);
+
+  sched->n_slots = (int32_t)llama_n_seq_max(ctx);
+  sched->n_batch = (int32_t)llama_n_batch(ctx);
+  sched->n_ctx_seq = (llama_pos)(llama_n_ctx(ctx) / llama_n_seq_max(ctx));
+  sched->batch = llama_batch_init(sched->n_batch, 0, 1);
+  sched->slots = (sched_request_t **)calloc(sched->n_slots, sizeof(sched_request_t *));
+  sched->out_ids = (int32_t *)malloc(sched->n_slots * sizeof(int32_t));
+  sched->out_tokens = (llama_token *)malloc(sched->n_slots * sizeof(llama_token));
+  sched->finished = (sched_request_t **)malloc(sched->n_slots * sizeof(sched_request_t *));
+
+  if (!sched->slots || !sched->out_ids || !sched->out_tokens || !sched->finished) {
+    sched_destroy(env, sched);
+    uv_mutex_destroy(&sched->lock);
+    free(sched);
+    return throw_error(env, "Memory allocation failed");
+  }
+
+  js_value_t *result;
+  err = js_create_external(env, sched, finalize_scheduler, NULL, &result);
+  if (err < 0) {
+    sched_destroy(env, sched);
+    uv_mutex_destroy(&sched->lock);
+    free(sched);
+    return throw_error(env, "Failed to create scheduler wrapper");
+  }
+
+  js_create_reference(env, argv[0], 1, &sched->ctx_ref);
+  sched->ctx_wrap = ctx_wrap;
+  ctx_wrap->busy = true;
+
+  // Start from clean sequences
+  llama_memory_clear(llama_get_memory(ctx), true);
+  ctx_wrap->n_cached = 0;
+
+  return result;
+}
+
+// freeScheduler(sched: Scheduler): void - releases the context and samplers
+static js_value_t *
+fn_free_scheduler(js_env_t *env, js_callback_info_t *info) {
+  int err;
+  size_t argc = 1;
+  js_value_t *argv[1];
+
+  err = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
+  if (err < 0) return NULL;
+
+  scheduler_wrap_t *sched;
+  err = js_get_value_external(env, argv[0], (void **)&sched);
+  if (err < 0 || !sched) return NULL;
+
+  if (sched->busy) {
+    sched->free_pending = true;
+  } else if (sched->ctx_wrap) {
+    sched_destroy(env, sched);
+  }
+
+  js_value_t *null_val;
+  js_get_null(env, &null_val);
+  return null_val;
+}
+
+// schedulerSubmit(sched: Scheduler, sampler: Sampler, tokens: Int32Array, opts?: object): number
+// Queues a request and returns its id. The sampler is busy until it finishes.
+// Allowed while a step is in flight; the request joins on a later step.
+static js_value_t *
+fn_scheduler_submit(js_env_t *env, js_callback_info_t *info) {
+  int err;
+  size_t argc = 4;
+  js_value_t *argv[4];
+
+  err = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
+  if (err < 0) return throw_error(env, "Failed to get callback info");
+
+  if (argc < 3) return throw_error(env, "Scheduler, sampler and tokens required");
+
+  scheduler_wrap_t *sched;
+  err = js_get_value_external(env, argv[0], (void **)&sched);
+  if (err < 0 || !sched || !sched->ctx_wrap || sched->free_pending) return throw_error(env, "Invalid scheduler");
+
+  sampler_wrap_t *sampler_wrap;
+  err = js_get_value_external(env, argv[1], (void **)&sampler_wrap);
+  if (err < 0 || !sampler_wrap || !sampler_wrap->ptr) return throw_error(env, "Invalid sampler");
+  if (sampler_wrap->busy) return throw_error(env, "Sampler is busy");
+
+  bool is_typedarray;
+  err = js_is_typedarray(env, argv[2], &is_typedarray);
+  if (err < 0 || !is_typedarray) return throw_error(env, "Tokens must be Int32Array");
+
+  js_typedarray_type_t type;
+  size_t length;
+  void *data;
+  err = js_get_typedarray_info(env, argv[2], &type, &data, &length, NULL, NULL);
+  if (err < 0 || type != js_int32array) return throw_error(env, "Tokens must be Int32Array");
+
+  if (length == 0) return throw_error(env, "Prompt must not be empty");
+  if ((llama_pos)length >= sched->n_ctx_seq) return throw_error(env, "Prompt exceeds per-sequence context size");
+
+  int32_t max_tokens = 128;
+  if (argc >= 4) {
+    js_value_t *val;
+    bool has_prop;
+    err = js_has_named_property(env, argv[3], "maxTokens", &has_prop);
+    if (err == 0 && has_prop) {
+      err = js_get_named_property(env, argv[3], "maxTokens", &val);
+      if (err == 0) js_get_value_int32(env, val, &max_tokens);
+    }
+  }
+
+  sched_request_t *req = (sched_request_t *)calloc(1, sizeof(sched_request_t));
+  if (!req) return throw_error(env, "Memory allocation failed");
+
+  req->prompt = (llama_token *)malloc(length * sizeof(llama_token));
+  if (!req->prompt) {
+    free(req);
+    return throw_error(env, "Memory allocation failed");
+  }
+  memcpy(req->prompt, data, length * sizeof(llama_token));
+  req->n_prompt = length;
+  req->max_tokens = max_tokens;
+  req->seq = -1;
+  req->batch_idx = -1;
+  req->sampler = sampler_wrap;
+
+  // A step may be running; it admits the request on the next one
+  uv_mutex_lock(&sched->lock);
+  if (sched->n_queue == sched->cap_queue) {
+    int32_t cap = sched->cap_queue ? sched->cap_queue * 2 : 16;
+    sched_request_t **queue = (sched_request_t **)realloc(sched->queue, cap * sizeof(sched_request_t *));
+    if (!queue) {
+      uv_mutex_unlock(&sched->lock);
+      free(req->prompt);
+      free(req);
+      return throw_error(env, "Memory allocation failed");
+    }
+    sched->queue = queue;
+    sched->cap_queue = cap;
   }
-  wrap->ptr = ctx;
+  req->id = sched->next_id++;
+  sched->queue[sched->n_queue++] = req;
+  uv_mutex_unlock(&sched->lock);
 
-  js_value_t *result;
-  err = js_create_external(env, wrap, finalize_context, NULL, &result);
-  if (err < 0) {
-    llama_free(ctx);
-    free(wrap);
-    return throw_error(env, "Failed to create context wrapper");
-  }
+  js_create_reference(env, argv[1], 1, &req->sampler_ref);
+  sampler_wrap->busy = true;
 
-  // Skip type tagging - js_add_type_tag crashes in Bare runtime
-  // err = js_add_type_tag(env, result, &llama_context_type_tag);
+  js_value_t *result;
+  err = js_create_int32(env, req->id, &result);
+  if (err < 0) return throw_error(env, "Failed to create result");
 
   return result;
 }
 
-// freeContext(ctx: Context): void
+// schedulerStep(sched: Scheduler): { ids, tokens, finished }
 static js_value_t *
-fn_free_context(js_env_t *env, js_callback_info_t *info) {
+fn_scheduler_step(js_env_t *env, js_callback_info_t *info) {
   int err;
   size_t argc = 1;
   js_value_t *argv[1];
 
   err = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
-  if (err < 0) return NULL;
+  if (err < 0) return throw_error(env, "Failed to get callback info");
 
-  // Get wrapper from external
-  context_wrap_t *wrap;
-  err = js_get_value_external(env, argv[0], (void **)&wrap);
-  if (err < 0 || !wrap) return NULL;
+  scheduler_wrap_t *sched;
+  err = js_get_value_external(env, argv[0], (void **)&sched);
+  if (err < 0 || !sched || !sched->ctx_wrap) return throw_error(env, "Invalid scheduler");
+  if (sched->busy) return throw_error(env, "Scheduler is busy");
 
-  // Free the context and nullify pointer to prevent double-free
-  if (wrap->ptr) {
-    llama_free(wrap->ptr);
-    wrap->ptr = NULL;
-  }
+  const char *error = sched_step(sched);
+  if (error) return throw_error(env, error);
 
-  js_value_t *null_val;
-  js_get_null(env, &null_val);
-  return null_val;
+  return sched_collect(env, sched);
+}
+
+typedef struct {
+  async_work_t base;
+  scheduler_wrap_t *sched;
+} sched_step_work_t;
+
+static void
+sched_step_execute(async_work_t *work) {
+  sched_step_work_t *w = (sched_step_work_t *)work;
+  work->error = sched_step(w->sched);
 }
 
-// clearMemory(ctx: Context): void - Clear context memory for reuse
 static js_value_t *
-fn_clear_memory(js_env_t *env, js_callback_info_t *info) {
+sched_step_complete(async_work_t *work) {
+  sched_step_work_t *w = (sched_step_work_t *)work;
+  scheduler_wrap_t *sched = w->sched;
+  js_value_t *result = NULL;
+
+  sched->busy = false;
+
+  if (!work->error) result = sched_collect(work->env, sched);
+
+  if (sched->free_pending && sched->ctx_wrap) sched_destroy(work->env, sched);
+
+  return result;
+}
+
+// schedulerStepAsync(sched: Scheduler): Promise<{ ids, tokens, finished }>
+static js_value_t *
+fn_scheduler_step_async(js_env_t *env, js_callback_info_t *info) {
   int err;
   size_t argc = 1;
   js_value_t *argv[1];
@@ -367,53 +6065,57 @@ fn_clear_memory(js_env_t *env, js_callback_info_t *info) {
   err = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
   if (err < 0) return throw_error(env, "Failed to get callback info");
 
-  context_wrap_t *wrap;
-  err = js_get_value_external(env, argv[0], (void **)&wrap);
-  if (err < 0 || !wrap || !wrap->ptr) return throw_error(env, "Invalid context");
-  
-  struct llama_context *ctx = wrap->ptr;
+  scheduler_wrap_t *sched;
+  err = js_get_value_external(env, argv[0], (void **)&sched);
+  if (err < 0 || !sched || !sched->ctx_wrap) return throw_error(env, "Invalid scheduler");
+  if (sched->busy) return throw_error(env, "Scheduler is busy");
 
-  llama_memory_t mem = llama_get_memory(ctx);
-  if (mem) {
-    llama_memory_clear(mem, true);
-  }
+  sched_step_work_t *work = (sched_step_work_t *)calloc(1, sizeof(sched_step_work_t));
+  if (!work) return throw_error(env, "Memory allocation failed");
 
-  js_value_t *undefined;
-  js_get_undefined(env, &undefined);
-  return undefined;
+  work->sched = sched;
+  work->base.execute = sched_step_execute;
+  work->base.complete = sched_step_complete;
+
+  sched->busy = true;
+
+  js_value_t *handles[2] = {argv[0], NULL};
+  js_value_t *promise = queue_async_work(env, &work->base, handles);
+  if (!promise) sched->busy = false;
+  return promise;
 }
 
-// Helper to get string property
-static char *get_string_property(js_env_t *env, js_value_t *opts, const char *name) {
+// acceptToken(sampler: Sampler, token: number): void
+static js_value_t *
+fn_accept_token(js_env_t *env, js_callback_info_t *info) {
   int err;
-  bool has_prop;
-  js_value_t *val;
+  size_t argc = 2;
+  js_value_t *argv[2];
 
-  err = js_has_named_property(env, opts, name, &has_prop);
-  if (err != 0 || !has_prop) return NULL;
+  err = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
+  if (err < 0) return throw_error(env, "Failed to get callback info");
 
-  err = js_get_named_property(env, opts, name, &val);
-  if (err != 0) return NULL;
+  // Get sampler wrapper
+  sampler_wrap_t *sampler_wrap;
+  err = js_get_value_external(env, argv[0], (void **)&sampler_wrap);
+  if (err < 0 || !sampler_wrap || !sampler_wrap->ptr) return throw_error(env, "Invalid sampler");
+  if (sampler_wrap->busy) return throw_error(env, "Sampler is busy");
 
-  size_t len;
-  err = js_get_value_string_utf8(env, val, NULL, 0, &len);
-  if (err != 0) return NULL;
+  struct llama_sampler *sampler = sampler_wrap->ptr;
 
-  char *str = (char *)malloc(len + 1);
-  if (!str) return NULL;
+  int32_t token;
+  js_get_value_int32(env, argv[1], &token);
 
-  err = js_get_value_string_utf8(env, val, (utf8_t *)str, len + 1, NULL);
-  if (err != 0) {
-    free(str);
-    return NULL;
-  }
+  llama_sampler_accept(sampler, token);
 
-  return str;
+  js_value_t *undefined;
+  js_get_undefined(env, &undefined);
+  return undefined;
 }
 
-// createSampler(model: Model, params?: object): Sampler
+// isEogToken(model: Model, token: number): boolean
 static js_value_t *
-fn_create_sampler(js_env_t *env, js_callback_info_t *info) {
+fn_is_eog_token(js_env_t *env, js_callback_info_t *info) {
   int err;
   size_t argc = 2;
   js_value_t *argv[2];
@@ -421,293 +6123,333 @@ fn_create_sampler(js_env_t *env, js_callback_info_t *info) {
   err = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
   if (err < 0) return throw_error(env, "Failed to get callback info");
 
-  if (argc < 1) return throw_error(env, "Model required");
-
-  // Get model for vocab access (needed for grammar)
+  // Skip type check - js_add_type_tag crashes in Bare runtime
   model_wrap_t *model_wrap;
   err = js_get_value_external(env, argv[0], (void **)&model_wrap);
   if (err < 0 || !model_wrap || !model_wrap->ptr) return throw_error(env, "Invalid model");
   
   struct llama_model *model = model_wrap->ptr;
 
+  int32_t token;
+  js_get_value_int32(env, argv[1], &token);
+
   const struct llama_vocab *vocab = llama_model_get_vocab(model);
+  bool is_eog = llama_vocab_is_eog(vocab, token);
 
-  struct llama_sampler_chain_params sparams = llama_sampler_chain_default_params();
-  struct llama_sampler *sampler = llama_sampler_chain_init(sparams);
+  js_value_t *result;
+  js_get_boolean(env, is_eog, &result);
+  return result;
+}
 
-  // Default: greedy sampling
-  float temp = 0.0f;
-  int32_t top_k = 40;
-  float top_p = 0.95f;
+// getEmbeddingDimension(model: Model): number
+static js_value_t *
+fn_get_embedding_dimension(js_env_t *env, js_callback_info_t *info) {
+  int err;
+  size_t argc = 1;
+  js_value_t *argv[1];
 
-  // Grammar options (llguidance)
-  char *json_grammar = NULL;
-  char *lark_grammar = NULL;
+  err = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
+  if (err < 0) return throw_error(env, "Failed to get callback info");
 
-  if (argc >= 2) {
-    js_value_t *opts = argv[1];
-    js_value_t *val;
-    bool has_prop;
+  model_wrap_t *model_wrap;
+  err = js_get_value_external(env, argv[0], (void **)&model_wrap);
+  if (err < 0 || !model_wrap || !model_wrap->ptr) return throw_error(env, "Invalid model");
+  
+  struct llama_model *model = model_wrap->ptr;
 
-    err = js_has_named_property(env, opts, "temp", &has_prop);
-    if (err == 0 && has_prop) {
-      err = js_get_named_property(env, opts, "temp", &val);
-      if (err == 0) {
-        double d;
-        js_get_value_double(env, val, &d);
-        temp = (float)d;
-      }
-    }
+  int32_t n_embd = llama_model_n_embd(model);
 
-    err = js_has_named_property(env, opts, "topK", &has_prop);
-    if (err == 0 && has_prop) {
-      err = js_get_named_property(env, opts, "topK", &val);
-      if (err == 0) {
-        js_get_value_int32(env, val, &top_k);
-      }
-    }
+  js_value_t *result;
+  err = js_create_int32(env, n_embd, &result);
+  if (err < 0) return throw_error(env, "Failed to create result");
 
-    err = js_has_named_property(env, opts, "topP", &has_prop);
-    if (err == 0 && has_prop) {
-      err = js_get_named_property(env, opts, "topP", &val);
-      if (err == 0) {
-        double d;
-        js_get_value_double(env, val, &d);
-        top_p = (float)d;
-      }
-    }
+  return result;
+}
 
-    // Grammar options (llguidance): json or lark
-    json_grammar = get_string_property(env, opts, "json");
-    lark_grammar = get_string_property(env, opts, "lark");
-  }
+// getModelMeta(model: Model, key: string): string | null
+static js_value_t *
+fn_get_model_meta(js_env_t *env, js_callback_info_t *info) {
+  int err;
+  size_t argc = 2;
+  js_value_t *argv[2];
 
-  // Add grammar sampler first if specified (must filter logits before sampling)
-  if (json_grammar) {
-    // Wrap JSON schema in Lark grammar format for llguidance
-    char *wrapped_grammar = (char *)malloc(strlen(json_grammar) + 64);
-    sprintf(wrapped_grammar, "%%llguidance {}\nstart: %%json %s", json_grammar);
-    struct llama_sampler *grammar = llama_sampler_init_llg(vocab, "lark", wrapped_grammar);
-    if (grammar) {
-      llama_sampler_chain_add(sampler, grammar);
-    }
-    free(wrapped_grammar);
-    free(json_grammar);
-  } else if (lark_grammar) {
-    struct llama_sampler *grammar = llama_sampler_init_llg(vocab, "lark", lark_grammar);
-    if (grammar) {
-      llama_sampler_chain_add(sampler, grammar);
-    }
-    free(lark_grammar);
-  }
+  err = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
+  if (err < 0) return throw_error(env, "Failed to get callback info");
 
-  // Build sampler chain (after grammar filtering)
-  if (temp > 0) {
-    llama_sampler_chain_add(sampler, llama_sampler_init_top_k(top_k));
-    llama_sampler_chain_add(sampler, llama_sampler_init_top_p(top_p, 1));
-    llama_sampler_chain_add(sampler, llama_sampler_init_temp(temp));
-    llama_sampler_chain_add(sampler, llama_sampler_init_dist(0));
-  } else {
-    llama_sampler_chain_add(sampler, llama_sampler_init_greedy());
+  if (argc < 2) return throw_error(env, "Model and key required");
+
+  model_wrap_t *model_wrap;
+  err = js_get_value_external(env, argv[0], (void **)&model_wrap);
+  if (err < 0 || !model_wrap || !model_wrap->ptr) return throw_error(env, "Invalid model");
+  
+  struct llama_model *model = model_wrap->ptr;
+
+  // Get key string
+  size_t key_len;
+  err = js_get_value_string_utf8(env, argv[1], NULL, 0, &key_len);
+  if (err < 0) return throw_error(env, "Invalid key");
+
+  char *key = (char *)malloc(key_len + 1);
+  if (!key) return throw_error(env, "Memory allocation failed");
+
+  err = js_get_value_string_utf8(env, argv[1], (utf8_t *)key, key_len + 1, NULL);
+  if (err < 0) {
+    free(key);
+    return throw_error(env, "Failed to read key");
   }
 
-  // Create wrapper to prevent double-free
-  sampler_wrap_t *wrap = (sampler_wrap_t *)malloc(sizeof(sampler_wrap_t));
-  if (!wrap) {
-    llama_sampler_free(sampler);
-    return throw_error(env, "Failed to allocate wrapper");
+  // Get metadata value
+  char buf[512];
+  int32_t len = llama_model_meta_val_str(model, key, buf, sizeof(buf));
+  free(key);
+
+  if (len < 0) {
+    // Key not found, return null
+    js_value_t *null_val;
+    js_get_null(env, &null_val);
+    return null_val;
   }
-  wrap->ptr = sampler;
 
   js_value_t *result;
-  err = js_create_external(env, wrap, finalize_sampler, NULL, &result);
-  if (err < 0) {
-    llama_sampler_free(sampler);
-    free(wrap);
-    return throw_error(env, "Failed to create sampler wrapper");
-  }
+  err = js_create_string_utf8(env, (utf8_t *)buf, len, &result);
+  if (err < 0) return throw_error(env, "Failed to create string");
+
+  return result;
+}
+
+// getTrainingContextSize(model: Model): number
+static js_value_t *
+fn_get_training_context_size(js_env_t *env, js_callback_info_t *info) {
+  int err;
+  size_t argc = 1;
+  js_value_t *argv[1];
+
+  err = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
+  if (err < 0) return throw_error(env, "Failed to get callback info");
+
+  model_wrap_t *model_wrap;
+  err = js_get_value_external(env, argv[0], (void **)&model_wrap);
+  if (err < 0 || !model_wrap || !model_wrap->ptr) return throw_error(env, "Invalid model");
+  
+  struct llama_model *model = model_wrap->ptr;
+
+  int32_t n_ctx_train = llama_model_n_ctx_train(model);
 
-  // Skip type tagging - js_add_type_tag crashes in Bare runtime
-  // err = js_add_type_tag(env, result, &llama_sampler_type_tag);
+  js_value_t *result;
+  err = js_create_int32(env, n_ctx_train, &result);
+  if (err < 0) return throw_error(env, "Failed to create result");
 
   return result;
 }
 
-// freeSampler(sampler: Sampler): void
+// getContextSize(ctx: Context): number
 static js_value_t *
-fn_free_sampler(js_env_t *env, js_callback_info_t *info) {
+fn_get_context_size(js_env_t *env, js_callback_info_t *info) {
   int err;
   size_t argc = 1;
   js_value_t *argv[1];
 
   err = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
-  if (err < 0) return NULL;
+  if (err < 0) return throw_error(env, "Failed to get callback info");
 
-  // Get wrapper from external
-  sampler_wrap_t *wrap;
-  err = js_get_value_external(env, argv[0], (void **)&wrap);
-  if (err < 0 || !wrap) return NULL;
+  context_wrap_t *ctx_wrap;
+  err = js_get_value_external(env, argv[0], (void **)&ctx_wrap);
+  if (err < 0 || !ctx_wrap || !ctx_wrap->ptr) return throw_error(env, "Invalid context");
 
-  // Free the sampler and nullify pointer to prevent double-free
-  if (wrap->ptr) {
-    llama_sampler_free(wrap->ptr);
-    wrap->ptr = NULL;
-  }
+  // Read-only, so allowed while async work runs
+  struct llama_context *ctx = ctx_wrap->ptr;
 
-  js_value_t *null_val;
-  js_get_null(env, &null_val);
-  return null_val;
-}
+  uint32_t n_ctx = llama_n_ctx(ctx);
 
-// tokenize(model: Model, text: string, addBos: boolean): Int32Array
-static js_value_t *
-fn_tokenize(js_env_t *env, js_callback_info_t *info) {
-  int err;
-  size_t argc = 3;
-  js_value_t *argv[3];
+  js_value_t *result;
+  err = js_create_uint32(env, n_ctx, &result);
+  if (err < 0) return throw_error(env, "Failed to create result");
 
-  err = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
-  if (err < 0) return throw_error(env, "Failed to get callback info");
+  return result;
+}
 
-  if (argc < 2) return throw_error(env, "Model and text required");
+// Embedding output for idx: the pooled embedding of sequence idx when pooling
+// is enabled, else the embedding of token idx. Sets *n_out to its length.
+static float *
+context_embeddings(struct llama_context *ctx, int32_t idx, int32_t *n_out) {
+  // Try sequence embeddings first (for pooled embeddings)
+  // then fall back to token embeddings
+  float *embeddings = llama_get_embeddings_seq(ctx, idx >= 0 ? idx : 0);
+  if (!embeddings) {
+    embeddings = llama_get_embeddings_ith(ctx, idx);
+  }
 
-  // Get model wrapper
-  model_wrap_t *model_wrap;
-  err = js_get_value_external(env, argv[0], (void **)&model_wrap);
-  if (err < 0 || !model_wrap || !model_wrap->ptr) return throw_error(env, "Invalid model");
-  
-  struct llama_model *model = model_wrap->ptr;
+  const struct llama_model *model = llama_get_model(ctx);
 
-  // Get text
-  size_t text_len;
-  err = js_get_value_string_utf8(env, argv[1], NULL, 0, &text_len);
-  if (err < 0) return throw_error(env, "Invalid text");
+  // For RANK pooling, the output is n_cls_out floats (typically 1 relevance score),
+  // not n_embd. Reading n_embd floats would be a buffer over-read.
+  if (llama_pooling_type(ctx) == LLAMA_POOLING_TYPE_RANK) {
+    *n_out = (int32_t)llama_model_n_cls_out(model);
+  } else {
+    *n_out = llama_model_n_embd(model);
+  }
 
-  char *text = (char *)malloc(text_len + 1);
-  if (!text) return throw_error(env, "Memory allocation failed");
+  return embeddings;
+}
 
-  err = js_get_value_string_utf8(env, argv[1], (utf8_t *)text, text_len + 1, NULL);
-  if (err < 0) {
-    free(text);
-    return throw_error(env, "Failed to read text");
-  }
+// Logits or embeddings for idx, as used by the view and into variants.
+// Returns an error message, or NULL with *data and *n_out set.
+static const char *
+context_output(context_wrap_t *wrap, bool logits, int32_t idx, float **data, int32_t *n_out) {
+  struct llama_context *ctx = wrap->ptr;
 
-  bool add_bos = true;
-  if (argc >= 3) {
-    js_get_value_bool(env, argv[2], &add_bos);
+  if (logits) {
+    if (!resolve_sample_index(wrap, &idx)) return "No logits for that index; it was decoded in an earlier chunk";
+    *data = llama_get_logits_ith(ctx, idx);
+    *n_out = llama_vocab_n_tokens(llama_model_get_vocab(llama_get_model(ctx)));
+    return *data ? NULL : "No logits for that index";
   }
 
-  const struct llama_vocab *vocab = llama_model_get_vocab(model);
+  *data = context_embeddings(ctx, idx, n_out);
+  return *data ? NULL : "Failed to get embeddings (context may not have embeddings enabled)";
+}
 
-  // Estimate token count (generous)
-  int32_t max_tokens = text_len + 16;
-  llama_token *tokens = (llama_token *)malloc(max_tokens * sizeof(llama_token));
-  if (!tokens) {
-    free(text);
-    return throw_error(env, "Memory allocation failed");
-  }
+typedef struct {
+  js_ref_t *ctx_ref;
+} output_view_t;
+
+static void
+finalize_output_view(js_env_t *env, void *data, void *hint) {
+  (void)data;
+  output_view_t *view = (output_view_t *)hint;
+  js_delete_reference(env, view->ctx_ref);
+  free(view);
+}
 
-  int32_t n_tokens = llama_tokenize(vocab, text, text_len, tokens, max_tokens, add_bos, true);
-  free(text);
+static js_value_t *
+output_view(js_env_t *env, js_callback_info_t *info, bool logits) {
+  int err;
+  size_t argc = 2;
+  js_value_t *argv[2];
 
-  if (n_tokens < 0) {
-    // Need more space
-    max_tokens = -n_tokens;
-    tokens = (llama_token *)realloc(tokens, max_tokens * sizeof(llama_token));
-    if (!tokens) return throw_error(env, "Memory allocation failed");
-    n_tokens = llama_tokenize(vocab, text, text_len, tokens, max_tokens, add_bos, true);
-  }
+  err = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
+  if (err < 0) return throw_error(env, "Failed to get callback info");
 
-  if (n_tokens < 0) {
-    free(tokens);
-    return throw_error(env, "Tokenization failed");
+  if (argc < 2) return throw_error(env, "Context and index required");
+
+  context_wrap_t *wrap;
+  err = js_get_value_external(env, argv[0], (void **)&wrap);
+  if (err < 0 || !wrap || !wrap->ptr) return throw_error(env, "Invalid context");
+  if (wrap->busy) return throw_error(env, "Context is busy");
+
+  int32_t idx;
+  err = js_get_value_int32(env, argv[1], &idx);
+  if (err < 0) return throw_error(env, "Invalid index");
+
+  float *data;
+  int32_t n_out;
+  const char *error = context_output(wrap, logits, idx, &data, &n_out);
+  if (error) return throw_error(env, error);
+
+  if (wrap->n_views == wrap->cap_views) {
+    size_t cap = wrap->cap_views ? wrap->cap_views * 2 : 8;
+    js_ref_t **views = (js_ref_t **)realloc(wrap->views, cap * sizeof(js_ref_t *));
+    if (!views) return throw_error(env, "Memory allocation failed");
+    wrap->views = views;
+    wrap->cap_views = cap;
   }
 
-  // Create Int32Array
+  // The view keeps the context alive so the memory it points into stays valid
+  output_view_t *view = (output_view_t *)malloc(sizeof(output_view_t));
+  if (!view) return throw_error(env, "Memory allocation failed");
+
   js_value_t *array_buffer;
-  void *data;
-  err = js_create_arraybuffer(env, n_tokens * sizeof(int32_t), &data, &array_buffer);
+  err = js_create_external_arraybuffer(env, data, n_out * sizeof(float), finalize_output_view, view, &array_buffer);
   if (err < 0) {
-    free(tokens);
+    free(view);
     return throw_error(env, "Failed to create array buffer");
   }
-
-  memcpy(data, tokens, n_tokens * sizeof(int32_t));
-  free(tokens);
+  js_create_reference(env, argv[0], 1, &view->ctx_ref);
+  js_create_reference(env, array_buffer, 0, &wrap->views[wrap->n_views++]);
 
   js_value_t *result;
-  err = js_create_typedarray(env, js_int32array, n_tokens, array_buffer, 0, &result);
+  err = js_create_typedarray(env, js_float32array, n_out, array_buffer, 0, &result);
   if (err < 0) return throw_error(env, "Failed to create typed array");
 
   return result;
 }
 
-// detokenize(model: Model, tokens: Int32Array): string
 static js_value_t *
-fn_detokenize(js_env_t *env, js_callback_info_t *info) {
+output_into(js_env_t *env, js_callback_info_t *info, bool logits) {
   int err;
-  size_t argc = 2;
-  js_value_t *argv[2];
+  size_t argc = 3;
+  js_value_t *argv[3];
 
   err = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
   if (err < 0) return throw_error(env, "Failed to get callback info");
 
-  if (argc < 2) return throw_error(env, "Model and tokens required");
+  if (argc < 3) return throw_error(env, "Context, index and output array required");
 
-  // Get model wrapper
-  model_wrap_t *model_wrap;
-  err = js_get_value_external(env, argv[0], (void **)&model_wrap);
-  if (err < 0 || !model_wrap || !model_wrap->ptr) return throw_error(env, "Invalid model");
-  
-  struct llama_model *model = model_wrap->ptr;
+  context_wrap_t *wrap;
+  err = js_get_value_external(env, argv[0], (void **)&wrap);
+  if (err < 0 || !wrap || !wrap->ptr) return throw_error(env, "Invalid context");
+  if (wrap->busy) return throw_error(env, "Context is busy");
+
+  int32_t idx;
+  err = js_get_value_int32(env, argv[1], &idx);
+  if (err < 0) return throw_error(env, "Invalid index");
 
-  // Get tokens array
   bool is_typedarray;
-  err = js_is_typedarray(env, argv[1], &is_typedarray);
-  if (err < 0 || !is_typedarray) return throw_error(env, "Tokens must be Int32Array");
+  err = js_is_typedarray(env, argv[2], &is_typedarray);
+  if (err < 0 || !is_typedarray) return throw_error(env, "Output must be a Float32Array");
 
   js_typedarray_type_t type;
   size_t length;
-  void *data;
-  err = js_get_typedarray_info(env, argv[1], &type, &data, &length, NULL, NULL);
-  if (err < 0 || type != js_int32array) return throw_error(env, "Tokens must be Int32Array");
+  void *out;
+  err = js_get_typedarray_info(env, argv[2], &type, &out, &length, NULL, NULL);
+  if (err < 0 || type != js_float32array) return throw_error(env, "Output must be a Float32Array");
 
-  llama_token *tokens = (llama_token *)data;
+  float *data;
+  int32_t n_out;
+  const char *error = context_output(wrap, logits, idx, &data, &n_out);
+  if (error) return throw_error(env, error);
 
-  const struct llama_vocab *vocab = llama_model_get_vocab(model);
+  if (length < (size_t)n_out) return throw_error(env, "Output array is too small");
+  memcpy(out, data, n_out * sizeof(float));
+  metrics_record_copy(n_out * sizeof(float));
 
-  // Build output string
-  size_t buf_size = length * 16;  // Estimate
-  char *buf = (char *)malloc(buf_size);
-  if (!buf) return throw_error(env, "Memory allocation failed");
+  js_value_t *result;
+  js_create_int32(env, n_out, &result);
+  return result;
+}
 
-  size_t offset = 0;
-  for (size_t i = 0; i < length; i++) {
-    char piece[256];
-    int32_t n = llama_token_to_piece(vocab, tokens[i], piece, sizeof(piece), 0, true);
-    if (n > 0) {
-      if (offset + n >= buf_size) {
-        buf_size *= 2;
-        buf = (char *)realloc(buf, buf_size);
-        if (!buf) return throw_error(env, "Memory allocation failed");
-      }
-      memcpy(buf + offset, piece, n);
-      offset += n;
-    }
-  }
+// getLogitsView(ctx: Context, idx: number): Float32Array
+// n_vocab logits for idx (as in sample()) without copying. The view is
+// detached by the next decode, clearMemory() or free().
+static js_value_t *
+fn_get_logits_view(js_env_t *env, js_callback_info_t *info) {
+  return output_view(env, info, true);
+}
 
-  js_value_t *result;
-  err = js_create_string_utf8(env, (utf8_t *)buf, offset, &result);
-  free(buf);
+// getEmbeddingsView(ctx: Context, idx: number): Float32Array
+// Like getEmbeddings() without copying, with the lifetime of getLogitsView().
+static js_value_t *
+fn_get_embeddings_view(js_env_t *env, js_callback_info_t *info) {
+  return output_view(env, info, false);
+}
 
-  if (err < 0) return throw_error(env, "Failed to create string");
+// getLogitsInto(ctx: Context, idx: number, out: Float32Array): number
+// Copies the logits for idx into out; returns the number of floats written.
+static js_value_t *
+fn_get_logits_into(js_env_t *env, js_callback_info_t *info) {
+  return output_into(env, info, true);
+}
 
-  return result;
+// getEmbeddingsInto(ctx: Context, idx: number, out: Float32Array): number
+static js_value_t *
+fn_get_embeddings_into(js_env_t *env, js_callback_info_t *info) {
+  return output_into(env, info, false);
 }
 
-// decode(ctx: Context, tokens: Int32Array): void
+// getEmbeddings(ctx: Context, idx: number): Float32Array
+// idx: sequence ID for pooled embeddings, or token index for non-pooled
 static js_value_t *
-fn_decode(js_env_t *env, js_callback_info_t *info) {
+fn_get_embeddings(js_env_t *env, js_callback_info_t *info) {
   int err;
   size_t argc = 2;
   js_value_t *argv[2];
@@ -715,315 +6457,514 @@ fn_decode(js_env_t *env, js_callback_info_t *info) {
   err = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
   if (err < 0) return throw_error(env, "Failed to get callback info");
 
-  if (argc < 2) return throw_error(env, "Context and tokens required");
+  if (argc < 2) return throw_error(env, "Context and index required");
 
-  // Get context wrapper
   context_wrap_t *ctx_wrap;
   err = js_get_value_external(env, argv[0], (void **)&ctx_wrap);
   if (err < 0 || !ctx_wrap || !ctx_wrap->ptr) return throw_error(env, "Invalid context");
-  
+  if (ctx_wrap->busy) return throw_error(env, "Context is busy");
+
   struct llama_context *ctx = ctx_wrap->ptr;
 
-  // Get tokens
-  bool is_typedarray;
-  err = js_is_typedarray(env, argv[1], &is_typedarray);
-  if (err < 0 || !is_typedarray) return throw_error(env, "Tokens must be Int32Array");
+  int32_t idx;
+  err = js_get_value_int32(env, argv[1], &idx);
+  if (err < 0) return throw_error(env, "Invalid index");
 
-  js_typedarray_type_t type;
-  size_t length;
+  int32_t n_out;
+  float *embeddings = context_embeddings(ctx, idx, &n_out);
+  if (!embeddings) return throw_error(env, "Failed to get embeddings (context may not have embeddings enabled)");
+
+  // Create Float32Array
+  js_value_t *array_buffer;
   void *data;
-  err = js_get_typedarray_info(env, argv[1], &type, &data, &length, NULL, NULL);
-  if (err < 0 || type != js_int32array) return throw_error(env, "Tokens must be Int32Array");
+  err = js_create_arraybuffer(env, n_out * sizeof(float), &data, &array_buffer);
+  if (err < 0) return throw_error(env, "Failed to create array buffer");
 
-  struct llama_batch batch = llama_batch_get_one((llama_token *)data, length);
+  memcpy(data, embeddings, n_out * sizeof(float));
+  metrics_record_copy(n_out * sizeof(float));
 
-  int decode_result = llama_decode(ctx, batch);
-  if (decode_result != 0) {
-    return throw_error(env, "Decode failed");
-  }
+  js_value_t *result;
+  err = js_create_typedarray(env, js_float32array, n_out, array_buffer, 0, &result);
+  if (err < 0) return throw_error(env, "Failed to create typed array");
 
-  js_value_t *undefined;
-  js_get_undefined(env, &undefined);
-  return undefined;
+  return result;
 }
 
-// sample(ctx: Context, sampler: Sampler, idx: number): number
-static js_value_t *
-fn_sample(js_env_t *env, js_callback_info_t *info) {
-  int err;
-  size_t argc = 3;
-  js_value_t *argv[3];
+// Number of floats produced per pooled sequence: a relevance score for RANK
+// pooling (n_cls_out), otherwise the embedding dimension.
+static int32_t
+pooled_output_size(struct llama_context *ctx) {
+  const struct llama_model *model = llama_get_model(ctx);
+  if (llama_pooling_type(ctx) == LLAMA_POOLING_TYPE_RANK) {
+    return (int32_t)llama_model_n_cls_out(model);
+  }
+  return llama_model_n_embd(model);
+}
 
-  err = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
-  if (err < 0) return throw_error(env, "Failed to get callback info");
+// Decode many token sequences with as few llama_decode calls as possible. Each
+// sequence gets its own seq_id within a batch; batches are filled up to
+// min(n_batch, n_ubatch) tokens and n_seq_max sequences, and memory is cleared
+// between them. Writes n_out pooled floats per sequence to out.
+static const char *
+embed_sequences(context_wrap_t *wrap, llama_token **seqs, const size_t *lens, size_t n_seqs, float *out, int32_t n_out) {
+  struct llama_context *ctx = wrap->ptr;
+  llama_memory_t mem = llama_get_memory(ctx);
 
-  if (argc < 3) return throw_error(env, "Context, sampler, and index required");
+  size_t cap = llama_n_batch(ctx) < llama_n_ubatch(ctx) ? llama_n_batch(ctx) : llama_n_ubatch(ctx);
+  size_t max_seqs = llama_n_seq_max(ctx);
 
-  // Get context wrapper
-  context_wrap_t *ctx_wrap;
-  err = js_get_value_external(env, argv[0], (void **)&ctx_wrap);
-  if (err < 0 || !ctx_wrap || !ctx_wrap->ptr) return throw_error(env, "Invalid context");
-  
-  struct llama_context *ctx = ctx_wrap->ptr;
+  for (size_t i = 0; i < n_seqs; i++) {
+    if (lens[i] == 0) return "Inputs must not be empty";
+    if (lens[i] > cap) return "Input exceeds batch size (increase batchSize/ubatchSize)";
+  }
 
-  // Get sampler wrapper
-  sampler_wrap_t *sampler_wrap;
-  err = js_get_value_external(env, argv[1], (void **)&sampler_wrap);
-  if (err < 0 || !sampler_wrap || !sampler_wrap->ptr) return throw_error(env, "Invalid sampler");
-  
-  struct llama_sampler *sampler = sampler_wrap->ptr;
+  struct llama_batch batch = llama_batch_init((int32_t)cap, 0, 1);
+  const char *error = NULL;
+
+  size_t first = 0;
+  while (first < n_seqs && !error) {
+    if (mem) llama_memory_clear(mem, true);
+
+    // Pack as many whole sequences as fit
+    size_t last = first;
+    batch.n_tokens = 0;
+    while (last < n_seqs && last - first < max_seqs && batch.n_tokens + lens[last] <= cap) {
+      for (size_t j = 0; j < lens[last]; j++) {
+        int32_t k = batch.n_tokens++;
+        batch.token[k] = seqs[last][j];
+        batch.pos[k] = (llama_pos)j;
+        batch.n_seq_id[k] = 1;
+        batch.seq_id[k][0] = (llama_seq_id)(last - first);
+        batch.logits[k] = true;
+      }
+      last++;
+    }
 
-  int32_t idx;
-  err = js_get_value_int32(env, argv[2], &idx);
-  if (err < 0) return throw_error(env, "Invalid index");
+    if (context_llama_decode(wrap, batch) != 0) {
+      error = "Decode failed";
+      break;
+    }
 
-  llama_token token = llama_sampler_sample(sampler, ctx, idx);
+    for (size_t i = first; i < last; i++) {
+      const float *embd = llama_get_embeddings_seq(ctx, (llama_seq_id)(i - first));
+      if (!embd) {
+        error = "Failed to get pooled embeddings (context needs embeddings and a pooling type)";
+        break;
+      }
+      memcpy(out + i * n_out, embd, n_out * sizeof(float));
+    }
+
+    first = last;
+  }
+
+  if (mem) llama_memory_clear(mem, true);
+  wrap->n_cached = 0;
+  llama_batch_free(batch);
+
+  return error;
+}
+
+static void
+free_token_lists(llama_token **seqs, size_t n) {
+  if (!seqs) return;
+  for (size_t i = 0; i < n; i++) free(seqs[i]);
+  free(seqs);
+}
+
+// Read an array of strings or Int32Arrays into malloc'd token lists
+static bool
+read_token_lists(js_env_t *env, js_value_t *array, const struct llama_vocab *vocab, bool add_special, llama_token ***seqs_out, size_t **lens_out, size_t *n_out) {
+  int err;
+
+  bool is_array;
+  err = js_is_array(env, array, &is_array);
+  if (err < 0 || !is_array) {
+    throw_error(env, "Inputs must be an array of strings or Int32Arrays");
+    return false;
+  }
+
+  uint32_t n;
+  js_get_array_length(env, array, &n);
+
+  llama_token **seqs = (llama_token **)calloc(n ? n : 1, sizeof(llama_token *));
+  size_t *lens = (size_t *)calloc(n ? n : 1, sizeof(size_t));
+  if (!seqs || !lens) {
+    free(seqs);
+    free(lens);
+    throw_error(env, "Memory allocation failed");
+    return false;
+  }
+
+  for (uint32_t i = 0; i < n; i++) {
+    js_value_t *item;
+    js_get_element(env, array, i, &item);
+
+    bool is_typedarray = false;
+    js_is_typedarray(env, item, &is_typedarray);
+
+    if (is_typedarray) {
+      js_typedarray_type_t type;
+      size_t length;
+      void *data;
+      err = js_get_typedarray_info(env, item, &type, &data, &length, NULL, NULL);
+      if (err < 0 || type != js_int32array) {
+        free_token_lists(seqs, n);
+        free(lens);
+        throw_error(env, "Token inputs must be Int32Array");
+        return false;
+      }
+      seqs[i] = (llama_token *)malloc((length ? length : 1) * sizeof(llama_token));
+      if (seqs[i]) memcpy(seqs[i], data, length * sizeof(llama_token));
+      lens[i] = length;
+    } else {
+      size_t text_len;
+      err = js_get_value_string_utf8(env, item, NULL, 0, &text_len);
+      if (err < 0) {
+        free_token_lists(seqs, n);
+        free(lens);
+        throw_error(env, "Inputs must be strings or Int32Arrays");
+        return false;
+      }
+      char *text = (char *)malloc(text_len + 1);
+      if (text) {
+        js_get_value_string_utf8(env, item, (utf8_t *)text, text_len + 1, NULL);
+        seqs[i] = tokenize_text(vocab, text, text_len, add_special, &lens[i]);
+        free(text);
+      }
+    }
 
-  js_value_t *result;
-  err = js_create_int32(env, token, &result);
-  if (err < 0) return throw_error(env, "Failed to create result");
+    if (!seqs[i]) {
+      free_token_lists(seqs, n);
+      free(lens);
+      throw_error(env, "Tokenization failed");
+      return false;
+    }
+  }
 
-  return result;
+  *seqs_out = seqs;
+  *lens_out = lens;
+  *n_out = n;
+  return true;
 }
 
-// acceptToken(sampler: Sampler, token: number): void
+// embedBatch(ctx: Context, inputs: (string | Int32Array)[], opts?: object): Float32Array
+// Returns N x n_embd pooled embeddings in one contiguous array. Options:
+// addSpecial (default true) when tokenizing strings, normalize (L2, default false).
 static js_value_t *
-fn_accept_token(js_env_t *env, js_callback_info_t *info) {
+fn_embed_batch(js_env_t *env, js_callback_info_t *info) {
   int err;
-  size_t argc = 2;
-  js_value_t *argv[2];
+  size_t argc = 3;
+  js_value_t *argv[3];
 
   err = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
   if (err < 0) return throw_error(env, "Failed to get callback info");
 
-  // Get sampler wrapper
-  sampler_wrap_t *sampler_wrap;
-  err = js_get_value_external(env, argv[0], (void **)&sampler_wrap);
-  if (err < 0 || !sampler_wrap || !sampler_wrap->ptr) return throw_error(env, "Invalid sampler");
-  
-  struct llama_sampler *sampler = sampler_wrap->ptr;
+  if (argc < 2) return throw_error(env, "Context and inputs required");
 
-  int32_t token;
-  js_get_value_int32(env, argv[1], &token);
+  context_wrap_t *ctx_wrap;
+  err = js_get_value_external(env, argv[0], (void **)&ctx_wrap);
+  if (err < 0 || !ctx_wrap || !ctx_wrap->ptr) return throw_error(env, "Invalid context");
+  if (ctx_wrap->busy) return throw_error(env, "Context is busy");
+  context_invalidate_views(env, ctx_wrap);
 
-  llama_sampler_accept(sampler, token);
+  struct llama_context *ctx = ctx_wrap->ptr;
+  const struct llama_vocab *vocab = llama_model_get_vocab(llama_get_model(ctx));
 
-  js_value_t *undefined;
-  js_get_undefined(env, &undefined);
-  return undefined;
-}
+  bool add_special = true;
+  bool normalize = false;
 
-// isEogToken(model: Model, token: number): boolean
-static js_value_t *
-fn_is_eog_token(js_env_t *env, js_callback_info_t *info) {
-  int err;
-  size_t argc = 2;
-  js_value_t *argv[2];
+  if (argc >= 3) {
+    js_value_t *opts = argv[2];
+    js_value_t *val;
+    bool has_prop;
 
-  err = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
-  if (err < 0) return throw_error(env, "Failed to get callback info");
+    err = js_has_named_property(env, opts, "addSpecial", &has_prop);
+    if (err == 0 && has_prop) {
+      err = js_get_named_property(env, opts, "addSpecial", &val);
+      if (err == 0) js_get_value_bool(env, val, &add_special);
+    }
 
-  // Skip type check - js_add_type_tag crashes in Bare runtime
-  model_wrap_t *model_wrap;
-  err = js_get_value_external(env, argv[0], (void **)&model_wrap);
-  if (err < 0 || !model_wrap || !model_wrap->ptr) return throw_error(env, "Invalid model");
-  
-  struct llama_model *model = model_wrap->ptr;
+    err = js_has_named_property(env, opts, "normalize", &has_prop);
+    if (err == 0 && has_prop) {
+      err = js_get_named_property(env, opts, "normalize", &val);
+      if (err == 0) js_get_value_bool(env, val, &normalize);
+    }
+  }
 
-  int32_t token;
-  js_get_value_int32(env, argv[1], &token);
+  llama_token **seqs;
+  size_t *lens;
+  size_t n_seqs;
+  if (!read_token_lists(env, argv[1], vocab, add_special, &seqs, &lens, &n_seqs)) return NULL;
 
-  const struct llama_vocab *vocab = llama_model_get_vocab(model);
-  bool is_eog = llama_vocab_is_eog(vocab, token);
+  int32_t n_out = pooled_output_size(ctx);
 
-  js_value_t *result;
-  js_get_boolean(env, is_eog, &result);
-  return result;
-}
+  js_value_t *array_buffer;
+  void *data;
+  err = js_create_arraybuffer(env, n_seqs * n_out * sizeof(float), &data, &array_buffer);
+  if (err < 0) {
+    free_token_lists(seqs, n_seqs);
+    free(lens);
+    return throw_error(env, "Failed to create array buffer");
+  }
 
-// getEmbeddingDimension(model: Model): number
-static js_value_t *
-fn_get_embedding_dimension(js_env_t *env, js_callback_info_t *info) {
-  int err;
-  size_t argc = 1;
-  js_value_t *argv[1];
+  const char *error = embed_sequences(ctx_wrap, seqs, lens, n_seqs, (float *)data, n_out);
+  free_token_lists(seqs, n_seqs);
+  free(lens);
 
-  err = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
-  if (err < 0) return throw_error(env, "Failed to get callback info");
+  if (error) return throw_error(env, error);
 
-  model_wrap_t *model_wrap;
-  err = js_get_value_external(env, argv[0], (void **)&model_wrap);
-  if (err < 0 || !model_wrap || !model_wrap->ptr) return throw_error(env, "Invalid model");
-  
-  struct llama_model *model = model_wrap->ptr;
+  metrics_record_copy(n_seqs * n_out * sizeof(float));
 
-  int32_t n_embd = llama_model_n_embd(model);
+  if (normalize) {
+    float *out = (float *)data;
+    for (size_t i = 0; i < n_seqs; i++) {
+      float *v = out + i * n_out;
+      double sum = 0.0;
+      for (int32_t j = 0; j < n_out; j++) sum += (double)v[j] * v[j];
+      if (sum > 0.0) {
+        float scale = (float)(1.0 / sqrt(sum));
+        for (int32_t j = 0; j < n_out; j++) v[j] *= scale;
+      }
+    }
+  }
 
   js_value_t *result;
-  err = js_create_int32(env, n_embd, &result);
-  if (err < 0) return throw_error(env, "Failed to create result");
+  err = js_create_typedarray(env, js_float32array, n_seqs * n_out, array_buffer, 0, &result);
+  if (err < 0) return throw_error(env, "Failed to create typed array");
 
   return result;
 }
 
-// getModelMeta(model: Model, key: string): string | null
+// rerank(ctx: Context, query: string, documents: string[], opts?: object): Float32Array | object
+// Scores every (query, document) pair with a cross-encoder in as few decodes as
+// possible. Pairs use the llama-server layout: [BOS] query [EOS] [SEP] doc [EOS],
+// with each special token added only if the vocab asks for it. The query is
+// tokenized once. With opts.topK, returns { indices: Uint32Array, scores:
+// Float32Array } for the best k documents, highest first.
 static js_value_t *
-fn_get_model_meta(js_env_t *env, js_callback_info_t *info) {
+fn_rerank(js_env_t *env, js_callback_info_t *info) {
   int err;
-  size_t argc = 2;
-  js_value_t *argv[2];
+  size_t argc = 4;
+  js_value_t *argv[4];
 
   err = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
   if (err < 0) return throw_error(env, "Failed to get callback info");
 
-  if (argc < 2) return throw_error(env, "Model and key required");
+  if (argc < 3) return throw_error(env, "Context, query and documents required");
 
-  model_wrap_t *model_wrap;
-  err = js_get_value_external(env, argv[0], (void **)&model_wrap);
-  if (err < 0 || !model_wrap || !model_wrap->ptr) return throw_error(env, "Invalid model");
-  
-  struct llama_model *model = model_wrap->ptr;
+  context_wrap_t *ctx_wrap;
+  err = js_get_value_external(env, argv[0], (void **)&ctx_wrap);
+  if (err < 0 || !ctx_wrap || !ctx_wrap->ptr) return throw_error(env, "Invalid context");
+  if (ctx_wrap->busy) return throw_error(env, "Context is busy");
+  context_invalidate_views(env, ctx_wrap);
 
-  // Get key string
-  size_t key_len;
-  err = js_get_value_string_utf8(env, argv[1], NULL, 0, &key_len);
-  if (err < 0) return throw_error(env, "Invalid key");
+  struct llama_context *ctx = ctx_wrap->ptr;
+  if (llama_pooling_type(ctx) != LLAMA_POOLING_TYPE_RANK) {
+    return throw_error(env, "rerank requires a context with poolingType 4 (rank)");
+  }
 
-  char *key = (char *)malloc(key_len + 1);
-  if (!key) return throw_error(env, "Memory allocation failed");
+  const struct llama_vocab *vocab = llama_model_get_vocab(llama_get_model(ctx));
 
-  err = js_get_value_string_utf8(env, argv[1], (utf8_t *)key, key_len + 1, NULL);
-  if (err < 0) {
-    free(key);
-    return throw_error(env, "Failed to read key");
+  int32_t top_k = -1;
+  if (argc >= 4) {
+    js_value_t *val;
+    bool has_prop;
+    err = js_has_named_property(env, argv[3], "topK", &has_prop);
+    if (err == 0 && has_prop) {
+      err = js_get_named_property(env, argv[3], "topK", &val);
+      if (err == 0) js_get_value_int32(env, val, &top_k);
+    }
   }
 
-  // Get metadata value
-  char buf[512];
-  int32_t len = llama_model_meta_val_str(model, key, buf, sizeof(buf));
-  free(key);
+  // Query tokens, shared by every pair
+  size_t query_len;
+  err = js_get_value_string_utf8(env, argv[1], NULL, 0, &query_len);
+  if (err < 0) return throw_error(env, "Invalid query");
+
+  char *query = (char *)malloc(query_len + 1);
+  if (!query) return throw_error(env, "Memory allocation failed");
+  js_get_value_string_utf8(env, argv[1], (utf8_t *)query, query_len + 1, NULL);
+
+  size_t n_query;
+  llama_token *query_tokens = tokenize_text(vocab, query, query_len, false, &n_query);
+  free(query);
+  if (!query_tokens) return throw_error(env, "Tokenization failed");
+
+  llama_token **docs;
+  size_t *doc_lens;
+  size_t n_docs;
+  if (!read_token_lists(env, argv[2], vocab, false, &docs, &doc_lens, &n_docs)) {
+    free(query_tokens);
+    return NULL;
+  }
 
-  if (len < 0) {
-    // Key not found, return null
-    js_value_t *null_val;
-    js_get_null(env, &null_val);
-    return null_val;
+  // Assemble pairs
+  bool add_bos = llama_vocab_get_add_bos(vocab);
+  bool add_eos = llama_vocab_get_add_eos(vocab);
+  bool add_sep = llama_vocab_get_add_sep(vocab);
+
+  llama_token **pairs = (llama_token **)calloc(n_docs ? n_docs : 1, sizeof(llama_token *));
+  size_t *pair_lens = (size_t *)calloc(n_docs ? n_docs : 1, sizeof(size_t));
+  bool ok = pairs && pair_lens;
+
+  for (size_t i = 0; ok && i < n_docs; i++) {
+    llama_token *pair = (llama_token *)malloc((n_query + doc_lens[i] + 4) * sizeof(llama_token));
+    if (!pair) {
+      ok = false;
+      break;
+    }
+    size_t n = 0;
+    if (add_bos) pair[n++] = llama_vocab_bos(vocab);
+    memcpy(pair + n, query_tokens, n_query * sizeof(llama_token));
+    n += n_query;
+    if (add_eos) pair[n++] = llama_vocab_eos(vocab);
+    if (add_sep) pair[n++] = llama_vocab_sep(vocab);
+    memcpy(pair + n, docs[i], doc_lens[i] * sizeof(llama_token));
+    n += doc_lens[i];
+    if (add_eos) pair[n++] = llama_vocab_eos(vocab);
+    pairs[i] = pair;
+    pair_lens[i] = n;
   }
 
-  js_value_t *result;
-  err = js_create_string_utf8(env, (utf8_t *)buf, len, &result);
-  if (err < 0) return throw_error(env, "Failed to create string");
+  free(query_tokens);
+  free_token_lists(docs, n_docs);
+  free(doc_lens);
 
-  return result;
-}
+  int32_t n_out = pooled_output_size(ctx);
+  float *scores = ok ? (float *)malloc((n_docs ? n_docs : 1) * n_out * sizeof(float)) : NULL;
 
-// getTrainingContextSize(model: Model): number
-static js_value_t *
-fn_get_training_context_size(js_env_t *env, js_callback_info_t *info) {
-  int err;
-  size_t argc = 1;
-  js_value_t *argv[1];
+  if (!scores) {
+    free_token_lists(pairs, n_docs);
+    free(pair_lens);
+    return throw_error(env, "Memory allocation failed");
+  }
 
-  err = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
-  if (err < 0) return throw_error(env, "Failed to get callback info");
+  const char *error = embed_sequences(ctx_wrap, pairs, pair_lens, n_docs, scores, n_out);
+  free_token_lists(pairs, n_docs);
+  free(pair_lens);
 
-  model_wrap_t *model_wrap;
-  err = js_get_value_external(env, argv[0], (void **)&model_wrap);
-  if (err < 0 || !model_wrap || !model_wrap->ptr) return throw_error(env, "Invalid model");
-  
-  struct llama_model *model = model_wrap->ptr;
+  if (error) {
+    free(scores);
+    return throw_error(env, error);
+  }
 
-  int32_t n_ctx_train = llama_model_n_ctx_train(model);
+  // Keep the first classifier output per pair
+  for (size_t i = 1; i < n_docs && n_out > 1; i++) scores[i] = scores[i * n_out];
 
   js_value_t *result;
-  err = js_create_int32(env, n_ctx_train, &result);
-  if (err < 0) return throw_error(env, "Failed to create result");
+  js_value_t *array_buffer;
+  void *data;
 
-  return result;
-}
+  if (top_k < 0) {
+    err = js_create_arraybuffer(env, n_docs * sizeof(float), &data, &array_buffer);
+    if (err < 0) {
+      free(scores);
+      return throw_error(env, "Failed to create array buffer");
+    }
+    memcpy(data, scores, n_docs * sizeof(float));
+    free(scores);
 
-// getContextSize(ctx: Context): number
-static js_value_t *
-fn_get_context_size(js_env_t *env, js_callback_info_t *info) {
-  int err;
-  size_t argc = 1;
-  js_value_t *argv[1];
+    err = js_create_typedarray(env, js_float32array, n_docs, array_buffer, 0, &result);
+    if (err < 0) return throw_error(env, "Failed to create typed array");
+    return result;
+  }
 
-  err = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
-  if (err < 0) return throw_error(env, "Failed to get callback info");
+  // Partial selection sort for the best k
+  size_t k = (size_t)top_k < n_docs ? (size_t)top_k : n_docs;
+  uint32_t *order = (uint32_t *)malloc((n_docs ? n_docs : 1) * sizeof(uint32_t));
+  if (!order) {
+    free(scores);
+    return throw_error(env, "Memory allocation failed");
+  }
+  for (size_t i = 0; i < n_docs; i++) order[i] = (uint32_t)i;
+  for (size_t i = 0; i < k; i++) {
+    size_t best = i;
+    for (size_t j = i + 1; j < n_docs; j++) {
+      if (scores[order[j]] > scores[order[best]]) best = j;
+    }
+    uint32_t tmp = order[i];
+    order[i] = order[best];
+    order[best] = tmp;
+  }
 
-  context_wrap_t *ctx_wrap;
-  err = js_get_value_external(env, argv[0], (void **)&ctx_wrap);
-  if (err < 0 || !ctx_wrap || !ctx_wrap->ptr) return throw_error(env, "Invalid context");
-  
-  struct llama_context *ctx = ctx_wrap->ptr;
+  js_value_t *indices, *top_scores;
+  err = js_create_arraybuffer(env, k * sizeof(uint32_t), &data, &array_buffer);
+  if (err == 0) {
+    memcpy(data, order, k * sizeof(uint32_t));
+    err = js_create_typedarray(env, js_uint32array, k, array_buffer, 0, &indices);
+  }
+  if (err == 0) {
+    err = js_create_arraybuffer(env, k * sizeof(float), &data, &array_buffer);
+  }
+  if (err == 0) {
+    for (size_t i = 0; i < k; i++) ((float *)data)[i] = scores[order[i]];
+    err = js_create_typedarray(env, js_float32array, k, array_buffer, 0, &top_scores);
+  }
 
-  uint32_t n_ctx = llama_n_ctx(ctx);
+  free(order);
+  free(scores);
+  if (err < 0) return throw_error(env, "Failed to create typed array");
 
-  js_value_t *result;
-  err = js_create_uint32(env, n_ctx, &result);
-  if (err < 0) return throw_error(env, "Failed to create result");
+  js_create_object(env, &result);
+  js_set_named_property(env, result, "indices", indices);
+  js_set_named_property(env, result, "scores", top_scores);
 
   return result;
 }
 
-// getEmbeddings(ctx: Context, idx: number): Float32Array
-// idx: sequence ID for pooled embeddings, or token index for non-pooled
+// getMetrics(): object
+// Process-wide totals across all contexts and models since startup.
 static js_value_t *
-fn_get_embeddings(js_env_t *env, js_callback_info_t *info) {
-  int err;
-  size_t argc = 2;
-  js_value_t *argv[2];
+fn_get_metrics(js_env_t *env, js_callback_info_t *info) {
+  (void)info;
+  uv_once(&metrics_once, metrics_init);
+  uv_mutex_lock(&metrics.lock);
 
-  err = js_get_callback_info(env, info, &argc, argv, NULL, NULL);
-  if (err < 0) return throw_error(env, "Failed to get callback info");
+  js_value_t *result, *val;
+  js_create_object(env, &result);
 
-  if (argc < 2) return throw_error(env, "Context and index required");
+  js_create_int64(env, (int64_t)metrics.decode_calls, &val);
+  js_set_named_property(env, result, "decodeCalls", val);
 
-  context_wrap_t *ctx_wrap;
-  err = js_get_value_external(env, argv[0], (void **)&ctx_wrap);
-  if (err < 0 || !ctx_wrap || !ctx_wrap->ptr) return throw_error(env, "Invalid context");
-  
-  struct llama_context *ctx = ctx_wrap->ptr;
+  js_create_int64(env, (int64_t)metrics.decode_tokens, &val);
+  js_set_named_property(env, result, "decodeTokens", val);
 
-  int32_t idx;
-  err = js_get_value_int32(env, argv[1], &idx);
-  if (err < 0) return throw_error(env, "Invalid index");
+  js_create_double(env, (double)metrics.decode_ns / 1e6, &val);
+  js_set_named_property(env, result, "decodeMs", val);
 
-  // Try sequence embeddings first (for pooled embeddings)
-  // then fall back to token embeddings
-  float *embeddings = llama_get_embeddings_seq(ctx, idx >= 0 ? idx : 0);
-  if (!embeddings) {
-    embeddings = llama_get_embeddings_ith(ctx, idx);
-  }
-  if (!embeddings) return throw_error(env, "Failed to get embeddings (context may not have embeddings enabled)");
+  js_create_int64(env, (int64_t)metrics.tokenize_calls, &val);
+  js_set_named_property(env, result, "tokenizeCalls", val);
 
-  const struct llama_model *model = llama_get_model(ctx);
+  js_create_int64(env, (int64_t)metrics.tokenize_texts, &val);
+  js_set_named_property(env, result, "tokenizeTexts", val);
 
-  // For RANK pooling, the output is n_cls_out floats (typically 1 relevance score),
-  // not n_embd. Reading n_embd floats would be a buffer over-read.
-  int32_t n_out;
-  if (llama_pooling_type(ctx) == LLAMA_POOLING_TYPE_RANK) {
-    n_out = (int32_t)llama_model_n_cls_out(model);
-  } else {
-    n_out = llama_model_n_embd(model);
-  }
+  js_create_int64(env, (int64_t)metrics.tokenize_bytes, &val);
+  js_set_named_property(env, result, "tokenizeBytes", val);
 
-  // Create Float32Array
-  js_value_t *array_buffer;
-  void *data;
-  err = js_create_arraybuffer(env, n_out * sizeof(float), &data, &array_buffer);
-  if (err < 0) return throw_error(env, "Failed to create array buffer");
+  js_create_int64(env, (int64_t)metrics.tokenize_tokens, &val);
+  js_set_named_property(env, result, "tokenizeTokens", val);
 
-  memcpy(data, embeddings, n_out * sizeof(float));
+  js_create_int64(env, (int64_t)metrics.output_copies, &val);
+  js_set_named_property(env, result, "outputCopies", val);
 
-  js_value_t *result;
-  err = js_create_typedarray(env, js_float32array, n_out, array_buffer, 0, &result);
-  if (err < 0) return throw_error(env, "Failed to create typed array");
+  js_create_int64(env, (int64_t)metrics.output_bytes, &val);
+  js_set_named_property(env, result, "outputBytes", val);
+
+  uv_mutex_unlock(&metrics.lock);
 
   return result;
 }
 
+// hrtime(): number
+// Monotonic clock in milliseconds with sub-microsecond resolution
+static js_value_t *
+fn_hrtime(js_env_t *env, js_callback_info_t *info) {
+  (void)info;
+  js_value_t *result;
+  js_create_double(env, (double)uv_hrtime() / 1e6, &result);
+  return result;
+}
+
 // systemInfo(): string - Get system info from llama.cpp
 static js_value_t *
 fn_system_info(js_env_t *env, js_callback_info_t *info) {
@@ -1086,20 +7027,29 @@ static void finalize_model(js_env_t *env, void *data, void *hint) {
   (void)env; (void)hint;
   if (data) {
     model_wrap_t *wrap = (model_wrap_t *)data;
-    if (wrap->ptr) {
-      llama_model_free(wrap->ptr);
-    }
+    model_release(wrap);
     free(wrap);
   }
 }
 
-static void finalize_context(js_env_t *env, void *data, void *hint) {
+static void finalize_thread_pool(js_env_t *env, void *data, void *hint) {
   (void)env; (void)hint;
+  if (data) {
+    threadpool_wrap_t *pool = (threadpool_wrap_t *)data;
+    pool->finalized = true;
+    threadpool_maybe_free(pool);
+  }
+}
+
+static void finalize_context(js_env_t *env, void *data, void *hint) {
+  (void)hint;
   if (data) {
     context_wrap_t *wrap = (context_wrap_t *)data;
-    if (wrap->ptr) {
-      llama_free(wrap->ptr);
-    }
+    context_release(wrap);
+    // Views keep the context alive, so none are reachable any more
+    for (size_t i = 0; i < wrap->n_views; i++) js_delete_reference(env, wrap->views[i]);
+    free(wrap->views);
+    free(wrap->cached);
     free(wrap);
   }
 }
@@ -1115,6 +7065,51 @@ static void finalize_sampler(js_env_t *env, void *data, void *hint) {
   }
 }
 
+static void finalize_adapter(js_env_t *env, void *data, void *hint) {
+  (void)hint;
+  if (data) {
+    adapter_wrap_t *adapter = (adapter_wrap_t *)data;
+    adapter->released = true;
+    adapter_maybe_free(adapter);
+    // Past this point an unshared model may be freed, taking a still used
+    // adapter with it
+    adapter->owner = NULL;
+    if (adapter->model_ref) js_delete_reference(env, adapter->model_ref);
+    adapter->finalized = true;
+    adapter_maybe_free(adapter);
+  }
+}
+
+static void finalize_grammar(js_env_t *env, void *data, void *hint) {
+  (void)hint;
+  if (data) {
+    grammar_wrap_t *wrap = (grammar_wrap_t *)data;
+    if (wrap->ptr) llama_sampler_free(wrap->ptr);
+    if (wrap->model_ref) js_delete_reference(env, wrap->model_ref);
+    free(wrap);
+  }
+}
+
+static void finalize_detokenizer(js_env_t *env, void *data, void *hint) {
+  (void)hint;
+  if (data) {
+    detokenizer_t *detok = (detokenizer_t *)data;
+    if (detok->model_ref) js_delete_reference(env, detok->model_ref);
+    free(detok->pending.data);
+    free(detok);
+  }
+}
+
+static void finalize_scheduler(js_env_t *env, void *data, void *hint) {
+  (void)hint;
+  if (data) {
+    scheduler_wrap_t *sched = (scheduler_wrap_t *)data;
+    if (sched->ctx_wrap) sched_destroy(env, sched);
+    uv_mutex_destroy(&sched->lock);
+    free(sched);
+  }
+}
+
 // Helper macro for defining functions
 #define EXPORT_FUNCTION(name, fn) do { \
   js_value_t *func; \
@@ -1133,17 +7128,58 @@ addon_exports(js_env_t *env, js_value_t *exports) {
   llama_log_set(quiet_log_callback, NULL);
 
   EXPORT_FUNCTION("readGgufMeta", fn_read_gguf_meta);
+  EXPORT_FUNCTION("readGgufMetaAll", fn_read_gguf_meta_all);
   EXPORT_FUNCTION("loadModel", fn_load_model);
+  EXPORT_FUNCTION("loadModelAsync", fn_load_model_async);
   EXPORT_FUNCTION("freeModel", fn_free_model);
+  EXPORT_FUNCTION("getModelCacheStats", fn_get_model_cache_stats);
+  EXPORT_FUNCTION("setModelCacheBudget", fn_set_model_cache_budget);
+  EXPORT_FUNCTION("clearModelCache", fn_clear_model_cache);
+  EXPORT_FUNCTION("loadAdapter", fn_load_adapter);
+  EXPORT_FUNCTION("freeAdapter", fn_free_adapter);
+  EXPORT_FUNCTION("setAdapters", fn_set_adapters);
+  EXPORT_FUNCTION("createThreadPool", fn_create_thread_pool);
+  EXPORT_FUNCTION("freeThreadPool", fn_free_thread_pool);
   EXPORT_FUNCTION("createContext", fn_create_context);
   EXPORT_FUNCTION("freeContext", fn_free_context);
   EXPORT_FUNCTION("clearMemory", fn_clear_memory);
+  EXPORT_FUNCTION("warmupContext", fn_warmup_context);
+  EXPORT_FUNCTION("getCacheStats", fn_get_cache_stats);
+  EXPORT_FUNCTION("getPerf", fn_get_perf);
+  EXPORT_FUNCTION("resetPerf", fn_reset_perf);
+  EXPORT_FUNCTION("setThreads", fn_set_threads);
+  EXPORT_FUNCTION("getKvCacheSize", fn_get_kv_cache_size);
+  EXPORT_FUNCTION("getThreads", fn_get_threads);
+  EXPORT_FUNCTION("saveState", fn_save_state);
+  EXPORT_FUNCTION("loadState", fn_load_state);
+  EXPORT_FUNCTION("saveStateFile", fn_save_state_file);
+  EXPORT_FUNCTION("loadStateFile", fn_load_state_file);
   EXPORT_FUNCTION("createSampler", fn_create_sampler);
+  EXPORT_FUNCTION("compileGrammar", fn_compile_grammar);
+  EXPORT_FUNCTION("freeGrammar", fn_free_grammar);
+  EXPORT_FUNCTION("getGrammarCacheStats", fn_get_grammar_cache_stats);
   EXPORT_FUNCTION("freeSampler", fn_free_sampler);
+  EXPORT_FUNCTION("getSamplerPerf", fn_get_sampler_perf);
+  EXPORT_FUNCTION("resetSamplerPerf", fn_reset_sampler_perf);
   EXPORT_FUNCTION("tokenize", fn_tokenize);
+  EXPORT_FUNCTION("tokenizeBatch", fn_tokenize_batch);
   EXPORT_FUNCTION("detokenize", fn_detokenize);
+  EXPORT_FUNCTION("createDetokenizer", fn_create_detokenizer);
+  EXPORT_FUNCTION("detokenizerPush", fn_detokenizer_push);
+  EXPORT_FUNCTION("detokenizerFlush", fn_detokenizer_flush);
+  EXPORT_FUNCTION("freeDetokenizer", fn_free_detokenizer);
   EXPORT_FUNCTION("decode", fn_decode);
+  EXPORT_FUNCTION("decodeAsync", fn_decode_async);
   EXPORT_FUNCTION("sample", fn_sample);
+  EXPORT_FUNCTION("sampleAsync", fn_sample_async);
+  EXPORT_FUNCTION("generate", fn_generate);
+  EXPORT_FUNCTION("generateStream", fn_generate_stream);
+  EXPORT_FUNCTION("generateCancel", fn_generate_cancel);
+  EXPORT_FUNCTION("createScheduler", fn_create_scheduler);
+  EXPORT_FUNCTION("freeScheduler", fn_free_scheduler);
+  EXPORT_FUNCTION("schedulerSubmit", fn_scheduler_submit);
+  EXPORT_FUNCTION("schedulerStep", fn_scheduler_step);
+  EXPORT_FUNCTION("schedulerStepAsync", fn_scheduler_step_async);
   EXPORT_FUNCTION("acceptToken", fn_accept_token);
   EXPORT_FUNCTION("isEogToken", fn_is_eog_token);
   EXPORT_FUNCTION("getEmbeddingDimension", fn_get_embedding_dimension);
@@ -1151,8 +7187,16 @@ addon_exports(js_env_t *env, js_value_t *exports) {
   EXPORT_FUNCTION("getTrainingContextSize", fn_get_training_context_size);
   EXPORT_FUNCTION("getContextSize", fn_get_context_size);
   EXPORT_FUNCTION("getEmbeddings", fn_get_embeddings);
+  EXPORT_FUNCTION("getEmbeddingsView", fn_get_embeddings_view);
+  EXPORT_FUNCTION("getEmbeddingsInto", fn_get_embeddings_into);
+  EXPORT_FUNCTION("getLogitsView", fn_get_logits_view);
+  EXPORT_FUNCTION("getLogitsInto", fn_get_logits_into);
+  EXPORT_FUNCTION("embedBatch", fn_embed_batch);
+  EXPORT_FUNCTION("rerank", fn_rerank);
   EXPORT_FUNCTION("setLogLevel", fn_set_log_level);
   EXPORT_FUNCTION("systemInfo", fn_system_info);
+  EXPORT_FUNCTION("getMetrics", fn_get_metrics);
+  EXPORT_FUNCTION("hrtime", fn_hrtime);
 
   return exports;
 }
@@ -5,10 +5,29 @@ class LlamaModel {
     this._handle = binding.loadModel(path, opts)
   }
 
+  // Load on a worker thread without blocking the event loop
+  static async load (path, opts = {}) {
+    const handle = await binding.loadModelAsync(path, opts)
+    const model = Object.create(LlamaModel.prototype)
+    model._handle = handle
+    return model
+  }
+
   tokenize (text, addBos = true) {
     return binding.tokenize(this._handle, text, addBos)
   }
 
+  // Tokenize many texts into one Int32Array. Text i is
+  // tokens.subarray(offsets[i], offsets[i + 1]).
+  tokenizeBatch (texts, opts = {}) {
+    return binding.tokenizeBatch(this._handle, texts, opts)
+  }
+
+  // LoRA adapter for this model; apply it with ctx.setAdapters()
+  loadAdapter (path) {
+    return new LoraAdapter(this, path)
+  }
+
   detokenize (tokens) {
     return binding.detokenize(this._handle, tokens)
   }
@@ -41,11 +60,77 @@ class LlamaModel {
   }
 }
 
+class LoraAdapter {
+  constructor (model, path) {
+    if (!(model instanceof LlamaModel)) {
+      throw new Error('First argument must be a LlamaModel')
+    }
+    this._model = model
+    this._handle = binding.loadAdapter(model._handle, path)
+  }
+
+  // Contexts still using the adapter keep it until they change adapters
+  free () {
+    if (this._handle) {
+      binding.freeAdapter(this._handle)
+      this._handle = null
+    }
+  }
+}
+
+// Turns a stream of tokens into text one token at a time. push() returns only
+// complete UTF-8 characters; bytes of a split character wait for the next push.
+class Detokenizer {
+  constructor (model, opts = {}) {
+    if (!(model instanceof LlamaModel)) {
+      throw new Error('First argument must be a LlamaModel')
+    }
+    this._handle = binding.createDetokenizer(model._handle, opts)
+  }
+
+  push (tokens) {
+    return binding.detokenizerPush(this._handle, tokens)
+  }
+
+  // Remaining text; the detokenizer can then be reused for a new stream
+  flush () {
+    return binding.detokenizerFlush(this._handle)
+  }
+
+  free () {
+    if (this._handle) {
+      binding.freeDetokenizer(this._handle)
+      this._handle = null
+    }
+  }
+}
+
+// CPU threads shared by every context created with { threadPool }
+class ThreadPool {
+  constructor (opts = {}) {
+    this._handle = binding.createThreadPool(opts)
+  }
+
+  free () {
+    if (this._handle) {
+      binding.freeThreadPool(this._handle)
+      this._handle = null
+    }
+  }
+}
+
 class LlamaContext {
   constructor (model, opts = {}) {
     if (!(model instanceof LlamaModel)) {
       throw new Error('First argument must be a LlamaModel')
     }
+    if (opts.threadPool) {
+      if (!(opts.threadPool instanceof ThreadPool)) {
+        throw new Error('threadPool must be a ThreadPool')
+      }
+      if (!opts.threadPool._handle) throw new Error('ThreadPool has been freed')
+      opts = { ...opts, threadPool: opts.threadPool._handle }
+    }
     this._model = model
     this._handle = binding.createContext(model._handle, opts)
   }
@@ -54,18 +139,123 @@ class LlamaContext {
     return binding.getContextSize(this._handle)
   }
 
-  decode (tokens) {
-    binding.decode(this._handle, tokens)
+  // { threads, threadsBatch }
+  get threads () {
+    return binding.getThreads(this._handle)
+  }
+
+  setThreads (threads, threadsBatch) {
+    binding.setThreads(this._handle, threads, threadsBatch)
+  }
+
+  // Estimated KV cache size in bytes from model metadata: { k, v, total }
+  get kvCacheSize () {
+    return binding.getKvCacheSize(this._handle)
+  }
+
+  decode (tokens, opts = {}) {
+    binding.decode(this._handle, tokens, opts)
+  }
+
+  decodeAsync (tokens, opts = {}) {
+    return binding.decodeAsync(this._handle, tokens, opts)
   }
 
   getEmbeddings (idx = -1) {
     return binding.getEmbeddings(this._handle, idx)
   }
 
+  // Views read the context's output directly. They are detached (length 0)
+  // by the next decode, clearMemory() or free(); copy with slice() to keep.
+  getEmbeddingsView (idx = -1) {
+    return binding.getEmbeddingsView(this._handle, idx)
+  }
+
+  getEmbeddingsInto (out, idx = -1) {
+    return binding.getEmbeddingsInto(this._handle, idx, out)
+  }
+
+  getLogits (idx = -1) {
+    return this.getLogitsView(idx).slice()
+  }
+
+  getLogitsView (idx = -1) {
+    return binding.getLogitsView(this._handle, idx)
+  }
+
+  getLogitsInto (out, idx = -1) {
+    return binding.getLogitsInto(this._handle, idx, out)
+  }
+
+  // Pooled embeddings for many inputs in one Float32Array (N x dimension).
+  // Row i is out.subarray(i * dim, (i + 1) * dim).
+  embedBatch (inputs, opts = {}) {
+    return binding.embedBatch(this._handle, inputs, opts)
+  }
+
+  // Cross-encoder scores for each document against the query. With
+  // opts.topK, returns { indices, scores } for the best k, highest first.
+  rerank (query, documents, opts = {}) {
+    return binding.rerank(this._handle, query, documents, opts)
+  }
+
+  // Apply LoRA adapters, each a LoraAdapter or { adapter, scale }. Changing
+  // them clears the context memory; returns whether they changed.
+  setAdapters (adapters) {
+    const entries = adapters.map((entry) => {
+      const { adapter, scale = 1 } = entry instanceof LoraAdapter ? { adapter: entry } : entry
+      if (!(adapter instanceof LoraAdapter)) throw new Error('adapter must be a LoraAdapter')
+      if (!adapter._handle) throw new Error('LoraAdapter has been freed')
+      return { adapter: adapter._handle, scale }
+    })
+    const changed = binding.setAdapters(this._handle, entries)
+    this._adapters = adapters
+    return changed
+  }
+
   clearMemory () {
     binding.clearMemory(this._handle)
   }
 
+  // Run one throwaway decode so the first real request doesn't pay for
+  // paging in weights; leaves the context empty.
+  warmup () {
+    binding.warmupContext(this._handle)
+  }
+
+  // { cachedTokens, hitTokens, missTokens } for reusePrefix decodes, and
+  // { shifts, shiftedTokens } for contextShift
+  getCacheStats () {
+    return binding.getCacheStats(this._handle)
+  }
+
+  // llama.cpp timings and decode counts since creation or resetPerf()
+  getPerf () {
+    return binding.getPerf(this._handle)
+  }
+
+  resetPerf () {
+    binding.resetPerf(this._handle)
+  }
+
+  // Snapshot of the KV cache (whole context, or opts.sequence) as an
+  // ArrayBuffer. Restoring it lets reusePrefix continue from the snapshot.
+  saveState (opts = {}) {
+    return binding.saveState(this._handle, opts)
+  }
+
+  loadState (state, opts = {}) {
+    return binding.loadState(this._handle, state, opts)
+  }
+
+  saveStateFile (path, opts = {}) {
+    binding.saveStateFile(this._handle, path, opts)
+  }
+
+  loadStateFile (path, opts = {}) {
+    return binding.loadStateFile(this._handle, path, opts)
+  }
+
   free () {
     if (this._handle) {
       binding.freeContext(this._handle)
@@ -74,11 +264,36 @@ class LlamaContext {
   }
 }
 
+// A json or lark grammar compiled once. Samplers created with { grammar }
+// share the compiled state instead of compiling their own.
+class Grammar {
+  constructor (model, opts) {
+    if (!(model instanceof LlamaModel)) {
+      throw new Error('First argument must be a LlamaModel')
+    }
+    this._handle = binding.compileGrammar(model._handle, opts)
+  }
+
+  free () {
+    if (this._handle) {
+      binding.freeGrammar(this._handle)
+      this._handle = null
+    }
+  }
+}
+
 class LlamaSampler {
   constructor (model, opts = {}) {
     if (!(model instanceof LlamaModel)) {
       throw new Error('First argument must be a LlamaModel')
     }
+    if (opts.grammar) {
+      if (!(opts.grammar instanceof Grammar)) {
+        throw new Error('grammar must be a Grammar')
+      }
+      if (!opts.grammar._handle) throw new Error('Grammar has been freed')
+      opts = { ...opts, grammar: opts.grammar._handle }
+    }
     this._handle = binding.createSampler(model._handle, opts)
   }
 
@@ -89,10 +304,25 @@ class LlamaSampler {
     return binding.sample(ctx._handle, this._handle, idx)
   }
 
+  sampleAsync (ctx, idx = -1) {
+    if (!(ctx instanceof LlamaContext)) {
+      throw new Error('First argument must be a LlamaContext')
+    }
+    return binding.sampleAsync(ctx._handle, this._handle, idx)
+  }
+
   accept (token) {
     binding.acceptToken(this._handle, token)
   }
 
+  getPerf () {
+    return binding.getSamplerPerf(this._handle)
+  }
+
+  resetPerf () {
+    binding.resetSamplerPerf(this._handle)
+  }
+
   free () {
     if (this._handle) {
       binding.freeSampler(this._handle)
@@ -101,25 +331,383 @@ class LlamaSampler {
   }
 }
 
-function generate (model, ctx, sampler, prompt, maxTokens = 128) {
+// Serves many concurrent generation requests from one model by batching
+// them across the sequences of a single context.
+class Scheduler {
+  constructor (model, opts = {}) {
+    if (!(model instanceof LlamaModel)) {
+      throw new Error('First argument must be a LlamaModel')
+    }
+    this._model = model
+    this._ctx = new LlamaContext(model, { ...opts, sequences: opts.sequences || 4 })
+    this._handle = binding.createScheduler(this._ctx._handle)
+    this._requests = new Map()
+    this._running = false
+  }
+
+  // Resolves to { text, tokens } once the request finishes. opts.onToken is
+  // called with each generated token as it is sampled.
+  submit (sampler, prompt, opts = {}) {
+    if (!(sampler instanceof LlamaSampler)) {
+      throw new Error('First argument must be a LlamaSampler')
+    }
+    const tokens = typeof prompt === 'string' ? this._model.tokenize(prompt, true) : prompt
+    const id = binding.schedulerSubmit(this._handle, sampler._handle, tokens, opts)
+
+    return new Promise((resolve, reject) => {
+      this._requests.set(id, { sampler, tokens: [], onToken: opts.onToken || null, resolve, reject })
+      this._pump()
+    })
+  }
+
+  async _pump () {
+    if (this._running) return
+    this._running = true
+
+    try {
+      while (this._requests.size > 0 && this._handle) {
+        const { ids, tokens, finished } = await binding.schedulerStepAsync(this._handle)
+        // free() during the step has already rejected every request
+        if (!this._handle) break
+
+        for (let i = 0; i < ids.length; i++) {
+          const req = this._requests.get(ids[i])
+          req.tokens.push(tokens[i])
+          if (req.onToken) req.onToken(tokens[i])
+        }
+
+        for (const id of finished) {
+          const req = this._requests.get(id)
+          this._requests.delete(id)
+          const out = Int32Array.from(req.tokens)
+          req.resolve({ text: this._model.detokenize(out), tokens: out })
+        }
+      }
+    } catch (err) {
+      // A failed step leaves sequences in an unknown state
+      for (const req of this._requests.values()) req.reject(err)
+      this._requests.clear()
+      this.free()
+    }
+
+    this._running = false
+  }
+
+  get pending () {
+    return this._requests.size
+  }
+
+  // Pending requests are rejected
+  free () {
+    if (this._handle) {
+      binding.freeScheduler(this._handle)
+      this._handle = null
+      this._ctx.free()
+    }
+    const err = new Error('Scheduler has been freed')
+    for (const req of this._requests.values()) req.reject(err)
+    this._requests.clear()
+  }
+}
+
+// Keeps warmed-up contexts per (model, params) key for reuse across requests.
+// Idle contexts are freed least recently used first when a new one would
+// exceed the budget (estimated KV cache bytes); acquire() waits when every
+// context within the budget is checked out.
+class ContextPool {
+  constructor (opts = {}) {
+    this._budget = opts.budget === undefined ? Infinity : opts.budget
+    this._max = opts.max === undefined ? Infinity : opts.max
+    this._clear = opts.clear !== false
+    this._warmup = opts.warmup !== false
+    this._keys = new Map() // key -> { model, params, idle: [], size }
+    this._inUse = new Map() // ctx -> key
+    this._ids = new WeakMap()
+    this._nextId = 1
+    this._size = 0
+    this._count = 0
+    this._waiters = []
+    this._closed = false
+  }
+
+  // Handles are compared by identity; everything else by value
+  _key (model, params) {
+    const id = (obj) => {
+      if (!this._ids.has(obj)) this._ids.set(obj, this._nextId++)
+      return this._ids.get(obj)
+    }
+    const entries = Object.keys(params).sort().map((name) => {
+      const value = params[name]
+      return [name, value !== null && typeof value === 'object' && value._handle !== undefined ? `#${id(value)}` : value]
+    })
+    return id(model) + ':' + JSON.stringify(entries)
+  }
+
+  _entry (model, params) {
+    const key = this._key(model, params)
+    let entry = this._keys.get(key)
+    if (!entry) {
+      entry = { key, model, params, idle: [], size: 0, lastUsed: 0 }
+      this._keys.set(key, entry)
+    }
+    return entry
+  }
+
+  // A new context for entry, making room by freeing idle contexts of other
+  // keys. Contexts with the same key have the same size, so it is known
+  // up front after the first.
+  _create (entry) {
+    while (this._count >= this._max || (entry.size > 0 && this._size + entry.size > this._budget)) {
+      if (!this._evictOne(entry)) return null
+    }
+
+    const ctx = new LlamaContext(entry.model, entry.params)
+    entry.size = ctx.kvCacheSize.total
+    entry.threads = ctx.threads
+
+    // Checked before evicting anything for a context that can never fit
+    if (entry.size > this._budget) {
+      ctx.free()
+      throw new Error('A single context exceeds the pool budget')
+    }
+
+    while (this._size + entry.size > this._budget) {
+      if (this._evictOne(entry)) continue
+      ctx.free()
+      return null
+    }
+
+    if (this._warmup) {
+      try {
+        ctx.warmup()
+      } catch (err) {
+        ctx.free()
+        throw err
+      }
+    }
+    this._size += entry.size
+    this._count++
+    return ctx
+  }
+
+  // Free the least recently used idle context of any key but exclude
+  _evictOne (exclude) {
+    let victim = null
+    for (const entry of this._keys.values()) {
+      if (entry === exclude || entry.idle.length === 0) continue
+      if (!victim || entry.lastUsed < victim.lastUsed) victim = entry
+    }
+    if (!victim) return false
+    this._destroy(victim, victim.idle.shift())
+    return true
+  }
+
+  _destroy (entry, ctx) {
+    this._size -= entry.size
+    this._count--
+    ctx.free()
+  }
+
+  _take (entry) {
+    const ctx = entry.idle.pop() || this._create(entry)
+    if (!ctx) return null
+    entry.lastUsed = Date.now()
+    this._inUse.set(ctx, entry)
+    return ctx
+  }
+
+  // A context for model and params, created if none is idle. Returns null
+  // instead of waiting when the pool is full.
+  tryAcquire (model, params = {}) {
+    if (this._closed) throw new Error('ContextPool has been freed')
+    if (!(model instanceof LlamaModel)) {
+      throw new Error('First argument must be a LlamaModel')
+    }
+    return this._take(this._entry(model, params))
+  }
+
+  // Resolves to a context once one is idle or fits in the budget
+  acquire (model, params = {}) {
+    let ctx
+    try {
+      ctx = this.tryAcquire(model, params)
+    } catch (err) {
+      return Promise.reject(err)
+    }
+    if (ctx) return Promise.resolve(ctx)
+
+    const entry = this._entry(model, params)
+    return new Promise((resolve, reject) => {
+      this._waiters.push({ entry, resolve, reject })
+    })
+  }
+
+  // Return a context. Its memory is cleared unless the pool was created with
+  // clear: false (or opts.clear is false), so reusePrefix decodes can pick up
+  // where the last request left off. Adapters and thread counts are reset to
+  // how the context was created. Throws, leaving the context checked out, if
+  // it is still busy (e.g. with a running generateStream).
+  release (ctx, opts = {}) {
+    const entry = this._inUse.get(ctx)
+    if (!entry) throw new Error('Context does not belong to this pool')
+
+    if (this._closed) {
+      this._inUse.delete(ctx)
+      this._destroy(entry, ctx)
+      return
+    }
+
+    // setThreads rejects busy contexts, so this also checks for clear: false
+    ctx.setThreads(entry.threads.threads, entry.threads.threadsBatch)
+    const clear = opts.clear === undefined ? this._clear : opts.clear
+    if (clear) ctx.clearMemory()
+    if (ctx._adapters && ctx._adapters.length > 0) ctx.setAdapters([])
+
+    this._inUse.delete(ctx)
+    entry.idle.push(ctx)
+    this._drain()
+  }
+
+  // Hand released or freed capacity to waiting acquire() calls in order
+  _drain () {
+    while (this._waiters.length > 0) {
+      const waiter = this._waiters[0]
+      let ctx
+      try {
+        ctx = this._take(waiter.entry)
+      } catch (err) {
+        this._waiters.shift()
+        waiter.reject(err)
+        continue
+      }
+      if (!ctx) return
+      this._waiters.shift()
+      waiter.resolve(ctx)
+    }
+  }
+
+  // Run fn with a context, releasing it afterwards
+  async use (model, params, fn) {
+    const ctx = await this.acquire(model, params)
+    try {
+      return await fn(ctx)
+    } finally {
+      this.release(ctx)
+    }
+  }
+
+  // Create and warm up contexts for model and params until n are idle
+  prewarm (model, params = {}, n = 1) {
+    const entry = this._entry(model, params)
+    while (entry.idle.length < n) {
+      const ctx = this._create(entry)
+      if (!ctx) break
+      entry.idle.push(ctx)
+    }
+    return entry.idle.length
+  }
+
+  // Free idle contexts until the pool uses at most `bytes`
+  shrink (bytes = 0) {
+    while (this._size > bytes) {
+      if (!this._evictOne(null)) break
+    }
+    this._drain()
+  }
+
+  get budget () {
+    return this._budget
+  }
+
+  set budget (bytes) {
+    this._budget = bytes
+    this.shrink(bytes)
+  }
+
+  // { contexts, inUse, idle, size, budget, waiting }
+  get stats () {
+    let idle = 0
+    for (const entry of this._keys.values()) idle += entry.idle.length
+    return {
+      contexts: this._count,
+      inUse: this._inUse.size,
+      idle,
+      size: this._size,
+      budget: this._budget,
+      waiting: this._waiters.length
+    }
+  }
+
+  // Free idle contexts now and checked-out ones as they are released
+  free () {
+    this._closed = true
+    for (const entry of this._keys.values()) {
+      for (const ctx of entry.idle) this._destroy(entry, ctx)
+      entry.idle = []
+    }
+    this._keys.clear()
+    for (const waiter of this._waiters) waiter.reject(new Error('ContextPool has been freed'))
+    this._waiters = []
+  }
+}
+
+function generate (model, ctx, sampler, prompt, opts = 128) {
+  if (typeof opts === 'number') opts = { maxTokens: opts }
   const tokens = model.tokenize(prompt, true)
-  ctx.decode(tokens)
+  const result = binding.generate(ctx._handle, sampler._handle, tokens, generateOptions(opts))
+  return opts.result ? result : result.text
+}
+
+function generateOptions (opts) {
+  if (!opts.draft) return opts
+  if (!(opts.draft instanceof LlamaContext)) {
+    throw new Error('draft must be a LlamaContext')
+  }
+  return { ...opts, draft: opts.draft._handle }
+}
 
-  const generated = []
-  for (let i = 0; i < maxTokens; i++) {
-    const token = sampler.sample(ctx, -1)
-    if (model.isEogToken(token)) break
+// Async iterator over generated text. Generation runs natively on a worker
+// thread; the iterator's return value is { text, tokens, stopReason }.
+// Leaving the iterator early cancels generation and waits for it to stop, so
+// the context and sampler are free again once the loop exits.
+async function * generateStream (model, ctx, sampler, prompt, opts = {}) {
+  const tokens = model.tokenize(prompt, true)
+  const chunks = []
+  let notify = null
+  let finished = false
 
-    sampler.accept(token)
-    generated.push(token)
+  const done = binding.generateStream(ctx._handle, sampler._handle, tokens, generateOptions(opts), function (text) {
+    chunks.push(text)
+    if (notify) notify()
+  }).finally(function () {
+    finished = true
+    if (notify) notify()
+  })
+  done.catch(noop)
 
-    // Decode single token for next iteration
-    ctx.decode(new Int32Array([token]))
+  try {
+    while (true) {
+      if (chunks.length > 0) {
+        yield chunks.shift()
+      } else if (finished) {
+        break
+      } else {
+        await new Promise((resolve) => { notify = resolve })
+        notify = null
+      }
+    }
+  } finally {
+    if (!finished) {
+      binding.generateCancel(ctx._handle)
+      await done.catch(noop)
+    }
   }
 
-  return model.detokenize(new Int32Array(generated))
+  return done
 }
 
+function noop () {}
+
 // Log level: 0=off, 1=errors only, 2=all (default)
 function setLogLevel (level) {
   binding.setLogLevel(level)
@@ -135,6 +723,13 @@ function readGgufMeta (path, key) {
   return binding.readGgufMeta(path, key)
 }
 
+// Read all GGUF metadata as typed values. Arrays longer than
+// opts.maxArrayLength (default 64) are left out unless listed in opts.keys;
+// with keys only those are returned. Parsed headers are cached per file.
+function readGgufMetaAll (path, opts = {}) {
+  return binding.readGgufMetaAll(path, opts)
+}
+
 // Get model name from GGUF file
 function getModelName (path) {
   return readGgufMeta(path, 'general.name')
@@ -144,15 +739,65 @@ function systemInfo () {
   return binding.systemInfo()
 }
 
+// Monotonic clock in milliseconds, with sub-microsecond resolution
+function hrtime () {
+  return binding.hrtime()
+}
+
+// Process-wide counters (decodes, tokenization, output copies) since startup
+function getMetrics () {
+  return binding.getMetrics()
+}
+
+// Models are shared process-wide: loading the same file with the same options
+// returns the already loaded weights. Idle models are kept while the cache
+// fits the budget (bytes, default 0).
+function getModelCacheStats () {
+  return binding.getModelCacheStats()
+}
+
+function setModelCacheBudget (bytes) {
+  binding.setModelCacheBudget(bytes)
+}
+
+function clearModelCache () {
+  binding.clearModelCache()
+}
+
+function compileGrammar (model, opts) {
+  return new Grammar(model, opts)
+}
+
+// Grammars from json/lark options are compiled once per model and cached:
+// { entries, hits, misses }
+function getGrammarCacheStats () {
+  return binding.getGrammarCacheStats()
+}
+
 module.exports = {
   LlamaModel,
   LlamaContext,
   LlamaSampler,
+  Grammar,
+  Detokenizer,
+  LoraAdapter,
+  ThreadPool,
+  Scheduler,
+  ContextPool,
   generate,
+  generateStream,
   setLogLevel,
   setQuiet,
   readGgufMeta,
+  readGgufMetaAll,
   getModelName,
   systemInfo,
+  getMetrics,
+  hrtime,
+  getModelCacheStats,
+  setModelCacheBudget,
+  clearModelCache,
+  compileGrammar,
+  getGrammarCacheStats,
   binding
 }
@@ -99,6 +99,19 @@ function getModelPath (modelName) {
   return blobPath
 }
 
+// Get the GGUF paths of any LoRA adapter layers of an Ollama model
+function getAdapterPaths (modelName) {
+  const manifest = getManifest(modelName)
+  if (!manifest) {
+    throw new Error(`Model "${modelName}" not found in Ollama`)
+  }
+
+  return manifest.layers
+    .filter(layer => layer.mediaType === 'application/vnd.ollama.image.adapter')
+    .map(layer => path.join(getOllamaDir(), 'blobs', layer.digest.replace(':', '-')))
+    .filter(blobPath => fs.existsSync(blobPath))
+}
+
 // Format a model name for display (omit :latest since it's just noise)
 function formatModelName (namespace, model, tag) {
   const prefix = namespace === 'library' ? '' : namespace + '/'
@@ -178,6 +191,7 @@ module.exports = {
   getOllamaDir,
   getManifest,
   getModelPath,
+  getAdapterPaths,
   listModels,
   getModelInfo
 }
@@ -1,47 +1,13 @@
 const { Template } = require('@huggingface/jinja')
 const os = require('os')
 const fs = require('fs')
+const { readGgufMetaAll } = require('..')
 
-// Read GGUF metadata from model file
-function readGGUFMetadata (path) {
-  const fd = fs.openSync(path, 'r')
-  const buf = Buffer.alloc(32 * 1024 * 1024)
-  fs.readSync(fd, buf, 0, buf.length, 0)
-  fs.closeSync(fd)
-
-  let offset = 0
-  const read = (n) => { const v = buf.subarray(offset, offset + n); offset += n; return v }
-  const u32 = () => read(4).readUInt32LE(0)
-  const u64 = () => Number(read(8).readBigUInt64LE(0))
-  const str = () => { const len = u64(); return read(len).toString('utf-8') }
-
-  if (read(4).toString('ascii') !== 'GGUF') throw new Error('Not a GGUF file')
-  u32(); u64() // version, tensor count
-  const kvCount = u64()
-
-  const metadata = {}
-  const readValue = (type) => {
-    switch (type) {
-      case 0: return read(1).readUInt8(0)
-      case 1: return read(1).readInt8(0)
-      case 2: return read(2).readUInt16LE(0)
-      case 3: return read(2).readInt16LE(0)
-      case 4: return read(4).readUInt32LE(0)
-      case 5: return read(4).readInt32LE(0)
-      case 6: return read(4).readFloatLE(0)
-      case 7: return read(1).readUInt8(0) !== 0
-      case 8: return str()
-      case 9: { const t = u32(), n = u64(), a = []; for (let i = 0; i < n; i++) a.push(readValue(t)); return a }
-      case 10: return u64()
-      case 11: return Number(read(8).readBigInt64LE(0))
-      case 12: return read(8).readDoubleLE(0)
-      default: return null
-    }
-  }
-
-  for (let i = 0; i < kvCount; i++) {
-    metadata[str()] = readValue(u32())
-  }
+// Read GGUF metadata from model file. Arrays are returned in full unless
+// opts limits them; see readGgufMetaAll.
+function readGGUFMetadata (path, opts = { maxArrayLength: 0xffffffff }) {
+  const metadata = readGgufMetaAll(path, opts)
+  if (metadata === null) throw new Error('Not a GGUF file')
   return metadata
 }
 
@@ -64,7 +30,9 @@ function loadModel (name) {
   if (!modelLayer) throw new Error(`No model layer in ${name}`)
 
   const modelPath = blobPath(modelLayer.digest)
-  const metadata = readGGUFMetadata(modelPath)
+  const metadata = readGGUFMetadata(modelPath, {
+    keys: ['tokenizer.chat_template', 'tokenizer.ggml.tokens', 'tokenizer.ggml.bos_token_id', 'tokenizer.ggml.eos_token_id']
+  })
   const tokens = metadata['tokenizer.ggml.tokens'] || []
 
   return {
@@ -0,0 +1,76 @@
+const test = require('brittle')
+const { LlamaModel, LlamaContext, LlamaSampler } = require('..')
+const { GENERATION_MODEL, resolveModel, tryLoadModel } = require('./helpers')
+
+const loaded = tryLoadModel(GENERATION_MODEL)
+
+test('LlamaModel.load rejects on bad path', async function (t) {
+  await t.exception(LlamaModel.load('/nonexistent/model.gguf'), 'rejects on bad path')
+})
+
+test('LlamaModel.load resolves to a usable model', { skip: !loaded }, async function (t) {
+  const model = await LlamaModel.load(resolveModel(GENERATION_MODEL), { nGpuLayers: 0 })
+  t.ok(model instanceof LlamaModel, 'is a LlamaModel')
+  t.ok(model.tokenize('Hello', true).length > 0, 'can tokenize')
+  model.free()
+})
+
+test('LlamaModel.load reports progress on the event loop', { skip: !loaded }, async function (t) {
+  let last = -1
+  let ordered = true
+  const model = await LlamaModel.load(resolveModel(GENERATION_MODEL), {
+    tensorOverrides: { '.*': 'CPU' },
+    onProgress (p) {
+      if (p < last) ordered = false
+      last = p
+    }
+  })
+  t.ok(ordered, 'progress is non-decreasing')
+  t.is(last, 1, 'final progress delivered before resolve')
+  model.free()
+})
+
+test('decodeAsync + sampleAsync match sync path', { skip: !loaded }, async function (t) {
+  const ctx = new LlamaContext(loaded.model, { contextSize: 512 })
+  const sampler = new LlamaSampler(loaded.model, { temp: 0 })
+  const tokens = loaded.model.tokenize('The capital of France is', true)
+
+  ctx.decode(tokens)
+  const expected = sampler.sample(ctx, -1)
+
+  ctx.clearMemory()
+  await ctx.decodeAsync(tokens)
+  const token = await sampler.sampleAsync(ctx, -1)
+
+  t.is(token, expected, 'same token as synchronous decode/sample')
+
+  sampler.free()
+  ctx.free()
+})
+
+test('context is busy while async work is in flight', { skip: !loaded }, async function (t) {
+  const ctx = new LlamaContext(loaded.model, { contextSize: 512 })
+  const tokens = loaded.model.tokenize('Hello', true)
+
+  const pending = ctx.decodeAsync(tokens)
+  t.exception(() => ctx.decode(tokens), /busy/, 'sync decode throws while busy')
+  t.ok(ctx.contextSize > 0, 'read-only queries still work')
+  await pending
+
+  ctx.decode(loaded.model.tokenize(' world', false))
+  t.pass('usable again after completion')
+  ctx.free()
+})
+
+test('free() during async work is deferred', { skip: !loaded }, async function (t) {
+  const ctx = new LlamaContext(loaded.model, { contextSize: 512 })
+  const pending = ctx.decodeAsync(loaded.model.tokenize('Hello', true))
+  ctx.free()
+  await pending
+  t.pass('no crash')
+})
+
+test('cleanup', { skip: !loaded }, function (t) {
+  loaded.model.free()
+  t.pass('model freed')
+})
@@ -35,6 +35,35 @@ test('JSON schema produces parseable JSON with correct fields', { skip: !loaded
   t.ok(output.includes('"age"'), 'output contains age field')
 })
 
+test('compiled grammars are shared by samplers', { skip: !loaded }, function (t) {
+  const { compileGrammar, getGrammarCacheStats } = require('..')
+  const schema = JSON.stringify({ type: 'object', properties: { ok: { type: 'boolean' } }, required: ['ok'] })
+
+  let grammar
+  try {
+    grammar = compileGrammar(loaded.model, { json: schema })
+  } catch {
+    t.comment('llguidance not available, skipping')
+    return
+  }
+
+  const before = getGrammarCacheStats()
+  const a = new LlamaSampler(loaded.model, { temp: 0, json: schema })
+  const b = new LlamaSampler(loaded.model, { temp: 0, grammar })
+  const after = getGrammarCacheStats()
+  t.is(after.hits, before.hits + 1, 'json option reuses the compiled schema')
+  t.is(after.misses, before.misses, 'nothing compiled again')
+
+  const ctx = new LlamaContext(loaded.model, { contextSize: 2048 })
+  const output = generate(loaded.model, ctx, b, 'JSON:', 16)
+  t.ok(output.includes('"ok"'), `output ${output} follows the grammar`)
+
+  ctx.free()
+  a.free()
+  b.free()
+  grammar.free()
+})
+
 test('Lark grammar constrains to yes/no', { skip: true }, function (t) {
   const ctx = new LlamaContext(loaded.model, { contextSize: 2048 })
 
@@ -1,6 +1,6 @@
 const test = require('brittle')
 const { LlamaContext } = require('..')
-const { GENERATION_MODEL, tryLoadModel } = require('./helpers')
+const { GENERATION_MODEL, tryLoadModel, findAdapterModel } = require('./helpers')
 
 const loaded = tryLoadModel(GENERATION_MODEL)
 
@@ -15,6 +15,72 @@ test('contextSize getter', { skip: !loaded }, function (t) {
   ctx.free()
 })
 
+test('thread counts can be set at creation and at runtime', { skip: !loaded }, function (t) {
+  const ctx = new LlamaContext(loaded.model, { contextSize: 512, threads: 2, threadsBatch: 3 })
+  t.alike(ctx.threads, { threads: 2, threadsBatch: 3 }, 'creation options applied')
+
+  ctx.setThreads(1)
+  t.alike(ctx.threads, { threads: 1, threadsBatch: 1 }, 'threadsBatch follows threads')
+
+  ctx.setThreads(2, 4)
+  t.alike(ctx.threads, { threads: 2, threadsBatch: 4 }, 'both set at runtime')
+  t.exception(() => ctx.setThreads(0), 'rejects zero threads')
+  ctx.free()
+})
+
+test('context with its own threadpool decodes', { skip: !loaded }, function (t) {
+  const ctx = new LlamaContext(loaded.model, { contextSize: 512, threads: 2, threadsBatch: 4, cpus: [0, 1, 2, 3], poll: 0 })
+  ctx.decode(loaded.model.tokenize('Hello world', true))
+  t.pass('decode with attached threadpool did not throw')
+  ctx.free()
+})
+
+test('contexts share a ThreadPool', { skip: !loaded }, async function (t) {
+  const { ThreadPool, LlamaSampler } = require('..')
+  const pool = new ThreadPool({ threads: 2 })
+  const a = new LlamaContext(loaded.model, { contextSize: 512, threadPool: pool })
+  const b = new LlamaContext(loaded.model, { contextSize: 512, threadPool: pool })
+  const sampler = new LlamaSampler(loaded.model, { temp: 0 })
+
+  t.is(a.threads.threads, 2, 'context uses the pool size')
+
+  const tokens = loaded.model.tokenize('The capital of France is', true)
+  await Promise.all([a.decodeAsync(tokens), b.decodeAsync(tokens)])
+  t.is(sampler.sample(a, -1), sampler.sample(b, -1), 'concurrent decodes on one pool agree')
+
+  // The pool stays usable by attached contexts after free()
+  pool.free()
+  a.clearMemory()
+  a.decode(tokens)
+  t.pass('decode after pool.free() with a live context')
+  t.exception(() => new LlamaContext(loaded.model, { threadPool: pool }), 'freed pool cannot be attached')
+
+  a.free()
+  b.free()
+  sampler.free()
+})
+
+test('quantized KV cache shrinks the cache and still decodes', { skip: !loaded }, function (t) {
+  const f16 = new LlamaContext(loaded.model, { contextSize: 1024 })
+  const q8 = new LlamaContext(loaded.model, { contextSize: 1024, kvCacheTypeK: 'q8_0', kvCacheTypeV: 'q8_0', flashAttention: true, ubatchSize: 256 })
+
+  const full = f16.kvCacheSize
+  const small = q8.kvCacheSize
+  t.ok(full.total > 0, 'f16 size is positive')
+  t.is(full.total, full.k + full.v, 'total is k + v')
+  t.ok(small.total < full.total * 0.6, 'q8_0 cache is about half the size')
+
+  q8.decode(loaded.model.tokenize('Hello world', true))
+  t.pass('decode with quantized cache')
+
+  t.exception(() => new LlamaContext(loaded.model, { kvCacheTypeK: 'q3_k' }), /KV cache type/, 'rejects unsupported types')
+  t.exception(() => new LlamaContext(loaded.model, { kvCacheTypeV: 'q4_0', flashAttention: false }), /flashAttention/, 'quantized V needs flash attention')
+  t.exception(() => new LlamaContext(loaded.model, { flashAttention: 'on' }), /flashAttention must be/, 'unknown flashAttention value')
+
+  f16.free()
+  q8.free()
+})
+
 test('decode accepts Int32Array', { skip: !loaded }, function (t) {
   const ctx = new LlamaContext(loaded.model, { contextSize: 512 })
   const tokens = loaded.model.tokenize('Hello', true)
@@ -23,6 +89,225 @@ test('decode accepts Int32Array', { skip: !loaded }, function (t) {
   ctx.free()
 })
 
+test('empty decode is rejected without touching the cache', { skip: !loaded }, function (t) {
+  const ctx = new LlamaContext(loaded.model, { contextSize: 512 })
+  const tokens = loaded.model.tokenize('Hello world', true)
+  ctx.decode(tokens, { reusePrefix: true })
+
+  t.exception(() => ctx.decode(new Int32Array(0), { reusePrefix: true }), /empty/, 'sync decode throws')
+  t.exception(() => ctx.decodeAsync(new Int32Array(0)), /empty/, 'async decode throws')
+  t.is(ctx.getCacheStats().cachedTokens, tokens.length, 'cache intact')
+  ctx.free()
+})
+
+test('logits views match copies and detach on the next decode', { skip: !loaded }, function (t) {
+  const ctx = new LlamaContext(loaded.model, { contextSize: 512 })
+  ctx.decode(loaded.model.tokenize('Hello', true))
+
+  const view = ctx.getLogitsView(-1)
+  const copy = ctx.getLogits(-1)
+  const out = new Float32Array(view.length)
+  t.is(ctx.getLogitsInto(out, -1), view.length, 'into returns count')
+  t.alike(Array.from(view), Array.from(copy), 'view matches copy')
+  t.alike(Array.from(out), Array.from(copy), 'into matches copy')
+  t.exception(() => ctx.getLogitsInto(new Float32Array(1), -1), 'rejects short output')
+
+  ctx.decode(loaded.model.tokenize(' world', false))
+  t.is(view.length, 0, 'view detached by decode')
+  t.is(copy.length, out.length, 'copy survives')
+  ctx.free()
+})
+
+test('decode chunks inputs longer than batchSize', { skip: !loaded }, function (t) {
+  const { LlamaSampler } = require('..')
+  const prompt = 'The quick brown fox jumps over the lazy dog. '.repeat(8)
+  const tokens = loaded.model.tokenize(prompt, true)
+  t.ok(tokens.length > 16, 'prompt is longer than the batch')
+
+  const whole = new LlamaContext(loaded.model, { contextSize: 512 })
+  const chunked = new LlamaContext(loaded.model, { contextSize: 512, batchSize: 16 })
+  const sampler = new LlamaSampler(loaded.model, { temp: 0 })
+
+  whole.decode(tokens)
+  chunked.decode(tokens)
+  t.is(sampler.sample(chunked, -1), sampler.sample(whole, -1), 'same next token as a single batch')
+
+  chunked.clearMemory()
+  chunked.decode(tokens, { logits: [tokens.length - 2, tokens.length - 1] })
+  t.is(sampler.sample(chunked, tokens.length - 1), sampler.sample(whole, -1), 'index into the input array')
+  t.exception(() => sampler.sample(chunked, 0), 'earlier chunk has no logits')
+
+  chunked.clearMemory()
+  t.exception(() => chunked.decode(tokens, { logits: 'all' }), /batchSize/, 'all logits must fit in one batch')
+
+  whole.free()
+  chunked.free()
+  sampler.free()
+})
+
+test('getPerf counts decodes and resetPerf clears them', { skip: !loaded }, function (t) {
+  const { getMetrics } = require('..')
+  const ctx = new LlamaContext(loaded.model, { contextSize: 512, batchSize: 16 })
+  const tokens = loaded.model.tokenize('The quick brown fox jumps over the lazy dog. '.repeat(4), true)
+  const before = getMetrics()
+
+  ctx.decode(tokens)
+  ctx.decode(new Int32Array([tokens[1]]))
+
+  const perf = ctx.getPerf()
+  const chunks = Math.ceil(tokens.length / 16)
+  t.is(perf.decodeCalls, chunks + 1, 'one call per chunk plus the single token')
+  t.is(perf.decodeTokens, tokens.length + 1, 'every token counted')
+  t.is(perf.maxBatch, 16, 'largest batch is the batch size')
+  t.is(perf.evalTokens, 1, 'single-token decode counted as eval')
+  t.ok(perf.promptTokens > 0 && perf.promptMs > 0, 'prompt timed')
+
+  const after = getMetrics()
+  t.ok(after.decodeCalls - before.decodeCalls >= chunks + 1, 'process-wide decode calls grow')
+
+  ctx.resetPerf()
+  const reset = ctx.getPerf()
+  t.is(reset.decodeCalls, 0, 'decode calls reset')
+  t.is(reset.evalTokens, 0, 'llama.cpp counters reset')
+  ctx.free()
+})
+
+test('reusePrefix decodes only the new suffix', { skip: !loaded }, function (t) {
+  const { LlamaSampler } = require('..')
+  const ctx = new LlamaContext(loaded.model, { contextSize: 512 })
+  const fresh = new LlamaContext(loaded.model, { contextSize: 512 })
+  const sampler = new LlamaSampler(loaded.model, { temp: 0 })
+
+  const system = loaded.model.tokenize('You are a helpful assistant. Answer briefly.', true)
+  const turn = loaded.model.tokenize(' The capital of France is', false)
+  const full = new Int32Array([...system, ...turn])
+
+  ctx.decode(system, { reusePrefix: true })
+  t.is(ctx.getCacheStats().missTokens, system.length, 'first decode is all misses')
+
+  ctx.decode(full, { reusePrefix: true })
+  const stats = ctx.getCacheStats()
+  t.is(stats.hitTokens, system.length, 'system prompt reused')
+  t.is(stats.missTokens, system.length + turn.length, 'only the suffix decoded')
+  t.is(stats.cachedTokens, full.length, 'cache holds the full prompt')
+
+  fresh.decode(full)
+  t.is(sampler.sample(ctx, -1), sampler.sample(fresh, -1), 'same next token as a fresh decode')
+
+  // Identical prompt re-evaluates just the last token
+  ctx.decode(full, { reusePrefix: true })
+  t.is(ctx.getCacheStats().missTokens, system.length + turn.length + 1, 'full match decodes one token')
+
+  ctx.clearMemory()
+  t.is(ctx.getCacheStats().cachedTokens, 0, 'clearMemory empties the cache')
+
+  ctx.free()
+  fresh.free()
+  sampler.free()
+})
+
+test('contextShift keeps decoding past contextSize', { skip: !loaded }, function (t) {
+  const ctx = new LlamaContext(loaded.model, { contextSize: 64, batchSize: 64, contextShift: { keep: 4 } })
+  const plain = new LlamaContext(loaded.model, { contextSize: 64, batchSize: 64 })
+  const size = ctx.contextSize
+
+  const tokens = loaded.model.tokenize(' the quick brown fox jumps over the lazy dog'.repeat(4), false).subarray(0, 16)
+  const rounds = Math.ceil((size * 3) / tokens.length)
+
+  for (let i = 0; i < rounds; i++) ctx.decode(tokens)
+  const stats = ctx.getCacheStats()
+  t.ok(stats.shifts > 0, 'context shifted')
+  t.ok(stats.shiftedTokens >= tokens.length * rounds - size, 'discarded the overflow')
+  t.ok(stats.cachedTokens <= size, 'cache stays within the context')
+
+  t.exception(() => {
+    for (let i = 0; i < rounds; i++) plain.decode(tokens)
+  }, 'overflows without contextShift')
+
+  t.exception(() => ctx.decode(new Int32Array(size).fill(tokens[0])), 'input larger than the context still fails')
+
+  ctx.free()
+  plain.free()
+})
+
+test('reusePrefix keeps matching a conversation across context shifts', { skip: !loaded }, function (t) {
+  const ctx = new LlamaContext(loaded.model, { contextSize: 64, batchSize: 64, contextShift: { keep: 4 } })
+  const { LlamaSampler } = require('..')
+  const sampler = new LlamaSampler(loaded.model, { temp: 0 })
+
+  let history = loaded.model.tokenize('A long conversation.', true)
+  ctx.decode(history, { reusePrefix: true })
+
+  const rounds = Math.ceil((ctx.contextSize * 3) / 8)
+  for (let i = 0; i < rounds; i++) {
+    const turn = loaded.model.tokenize(` Turn ${i}: the fox jumps.`, false).subarray(0, 8)
+    history = new Int32Array([...history, ...turn])
+
+    const before = ctx.getCacheStats()
+    ctx.decode(history, { reusePrefix: true })
+    const after = ctx.getCacheStats()
+    t.is(after.missTokens - before.missTokens, turn.length, `turn ${i} decodes only the new tokens`)
+    t.ok(after.cachedTokens <= ctx.contextSize, `turn ${i} stays within the context`)
+  }
+
+  t.ok(ctx.getCacheStats().shifts > 0, 'context shifted')
+  t.ok(Number.isInteger(sampler.sample(ctx, -1)), 'logits available after the last turn')
+
+  sampler.free()
+  ctx.free()
+})
+
+test('saveState/loadState restores the KV cache', { skip: !loaded }, function (t) {
+  const { LlamaSampler } = require('..')
+  const ctx = new LlamaContext(loaded.model, { contextSize: 512 })
+  const other = new LlamaContext(loaded.model, { contextSize: 512 })
+  const sampler = new LlamaSampler(loaded.model, { temp: 0 })
+
+  const tokens = loaded.model.tokenize('The capital of France is', true)
+  ctx.decode(tokens, { reusePrefix: true })
+  const expected = sampler.sample(ctx, -1)
+
+  const state = ctx.saveState()
+  t.ok(state instanceof ArrayBuffer, 'returns ArrayBuffer')
+
+  t.is(other.loadState(state), tokens.length, 'restores cached tokens')
+  t.is(sampler.sample(other, -1), expected, 'restored logits give the same token')
+
+  other.decode(tokens, { reusePrefix: true })
+  t.is(other.getCacheStats().hitTokens, tokens.length - 1, 'prefix reuse continues from the snapshot')
+
+  t.exception(() => other.loadState(new ArrayBuffer(8)), /Invalid state/, 'rejects garbage')
+
+  ctx.free()
+  other.free()
+  sampler.free()
+})
+
+test('saveStateFile/loadStateFile round trip', { skip: !loaded }, function (t) {
+  const os = require('os')
+  const path = require('path')
+  const fs = require('fs')
+  const { LlamaSampler } = require('..')
+  const file = path.join(os.tmpdir(), 'bare-llama-state-test.bin')
+
+  const ctx = new LlamaContext(loaded.model, { contextSize: 512 })
+  const other = new LlamaContext(loaded.model, { contextSize: 512 })
+  const sampler = new LlamaSampler(loaded.model, { temp: 0 })
+
+  const tokens = loaded.model.tokenize('One, two, three,', true)
+  ctx.decode(tokens)
+  const expected = sampler.sample(ctx, -1)
+
+  ctx.saveStateFile(file)
+  t.is(other.loadStateFile(file), tokens.length, 'restores cached tokens')
+  t.is(sampler.sample(other, -1), expected, 'same next token')
+
+  fs.unlinkSync(file)
+  ctx.free()
+  other.free()
+  sampler.free()
+})
+
 test('clearMemory() resets context for fresh prompt', { skip: !loaded }, function (t) {
   const { LlamaSampler } = require('..')
   const ctx = new LlamaContext(loaded.model, { contextSize: 2048 })
@@ -45,6 +330,140 @@ test('clearMemory() resets context for fresh prompt', { skip: !loaded }, functio
   ctx.free()
 })
 
+test('warmup() leaves an empty context', { skip: !loaded }, function (t) {
+  const { LlamaSampler } = require('..')
+  const ctx = new LlamaContext(loaded.model, { contextSize: 512 })
+  const fresh = new LlamaContext(loaded.model, { contextSize: 512 })
+  const sampler = new LlamaSampler(loaded.model, { temp: 0 })
+  const tokens = loaded.model.tokenize('The capital of France is', true)
+
+  ctx.warmup()
+  t.is(ctx.getCacheStats().cachedTokens, 0, 'nothing cached')
+  t.is(ctx.getPerf().decodeCalls, 0, 'perf counters reset')
+
+  ctx.decode(tokens)
+  fresh.decode(tokens)
+  t.is(sampler.sample(ctx, -1), sampler.sample(fresh, -1), 'same output as a new context')
+
+  sampler.free()
+  fresh.free()
+  ctx.free()
+})
+
+test('ContextPool reuses contexts per key', { skip: !loaded }, async function (t) {
+  const { ContextPool } = require('..')
+  const pool = new ContextPool()
+  const params = { contextSize: 256 }
+
+  const a = await pool.acquire(loaded.model, params)
+  a.decode(loaded.model.tokenize('Hello', true))
+  pool.release(a)
+
+  const b = await pool.acquire(loaded.model, { contextSize: 256 })
+  t.is(b, a, 'same key gets the idle context back')
+  t.is(b.getCacheStats().cachedTokens, 0, 'memory cleared on release')
+
+  const c = pool.tryAcquire(loaded.model, { contextSize: 512 })
+  t.not(c, a, 'different params get another context')
+  t.is(pool.stats.inUse, 2, 'two checked out')
+
+  pool.release(b, { clear: false })
+  const d = pool.tryAcquire(loaded.model, params)
+  t.is(d, b, 'kept context returned')
+
+  pool.release(c)
+  pool.release(d)
+  t.is(pool.prewarm(loaded.model, params, 2), 2, 'prewarm fills the idle list')
+  t.is(pool.stats.contexts, 3, 'three contexts')
+
+  pool.shrink()
+  t.is(pool.stats.contexts, 0, 'shrink frees idle contexts')
+  pool.free()
+})
+
+test('ContextPool waits when the budget is used', { skip: !loaded }, async function (t) {
+  const { ContextPool } = require('..')
+  const probe = new LlamaContext(loaded.model, { contextSize: 256 })
+  const size = probe.kvCacheSize.total
+  probe.free()
+
+  const pool = new ContextPool({ budget: size })
+  const a = await pool.acquire(loaded.model, { contextSize: 256 })
+  t.is(pool.tryAcquire(loaded.model, { contextSize: 256 }), null, 'no room for a second context')
+
+  const waiting = pool.acquire(loaded.model, { contextSize: 256 })
+  t.is(pool.stats.waiting, 1, 'acquire waits')
+  pool.release(a)
+  t.is(await waiting, a, 'released context handed to the waiter')
+
+  pool.release(a)
+  await t.exception(pool.acquire(loaded.model, { contextSize: 4096 }), /budget/, 'a context larger than the budget is rejected')
+  t.is(pool.stats.idle, 1, 'without evicting idle contexts first')
+  pool.free()
+})
+
+test('ContextPool release resets the context and refuses busy ones', { skip: !loaded }, async function (t) {
+  const { ContextPool } = require('..')
+  const pool = new ContextPool()
+  const params = { contextSize: 256, threads: 2, threadsBatch: 2 }
+
+  const ctx = await pool.acquire(loaded.model, params)
+  ctx.setThreads(1, 1)
+  const pending = ctx.decodeAsync(loaded.model.tokenize('Hello', true))
+  t.exception(() => pool.release(ctx), /busy/, 'busy context is not released')
+  t.is(pool.stats.inUse, 1, 'still checked out')
+  await pending
+
+  pool.release(ctx)
+  t.is(pool.stats.idle, 1, 'released once idle')
+  const again = await pool.acquire(loaded.model, params)
+  t.is(again, ctx, 'same context reused')
+  t.alike(again.threads, { threads: 2, threadsBatch: 2 }, 'thread counts restored')
+  pool.release(again)
+  pool.free()
+})
+
+test('setAdapters validates adapters', { skip: !loaded }, function (t) {
+  const ctx = new LlamaContext(loaded.model, { contextSize: 512 })
+  t.exception(() => loaded.model.loadAdapter('/nonexistent/adapter.gguf'), 'bad path throws')
+  t.exception(() => ctx.setAdapters([{ adapter: {} }]), 'rejects non-adapters')
+  t.is(ctx.setAdapters([]), false, 'no adapters is unchanged')
+  ctx.free()
+})
+
+const adapterModel = findAdapterModel()
+
+test('adapter applies and outlives the handle it was loaded with', { skip: !adapterModel }, function (t) {
+  const { LlamaModel } = require('..')
+  const first = new LlamaModel(adapterModel.modelPath)
+  const second = new LlamaModel(adapterModel.modelPath)
+  const adapter = first.loadAdapter(adapterModel.adapterPath)
+  const tokens = first.tokenize('Hello world', true)
+
+  const logits = (adapters) => {
+    const ctx = new LlamaContext(second, { contextSize: 512 })
+    if (adapters) t.ok(ctx.setAdapters(adapters), 'adapters changed')
+    ctx.decode(tokens)
+    const out = Float32Array.from(ctx.getLogits())
+    ctx.free()
+    return out
+  }
+
+  const base = logits()
+  // Freeing the loading handle leaves the shared weights and the adapter
+  first.free()
+  const adapted = logits([adapter])
+  t.not(adapted.join(), base.join(), 'adapter changes the logits')
+
+  const ctx = new LlamaContext(second, { contextSize: 512 })
+  ctx.setAdapters([adapter])
+  adapter.free()
+  ctx.decode(tokens)
+  t.alike(Float32Array.from(ctx.getLogits()), adapted, 'contexts keep a freed adapter')
+  ctx.free()
+  second.free()
+})
+
 test('free() is idempotent', { skip: !loaded }, function (t) {
   const ctx = new LlamaContext(loaded.model, { contextSize: 512 })
   ctx.free()
@@ -55,6 +55,50 @@ test('reuse produces consistent results', { skip: !loaded }, function (t) {
   ctx.free()
 })
 
+test('embeddings view matches copy and detaches on clearMemory', { skip: !loaded }, function (t) {
+  const ctx = new LlamaContext(loaded.model, { contextSize: 512, embeddings: true, poolingType: 1 })
+  const emb = embed(loaded.model, ctx, 'Hello')
+  const view = ctx.getEmbeddingsView(-1)
+  const out = new Float32Array(emb.length)
+  ctx.getEmbeddingsInto(out, -1)
+  t.alike(Array.from(view), Array.from(emb), 'view matches copy')
+  t.alike(Array.from(out), Array.from(emb), 'into matches copy')
+  ctx.clearMemory()
+  t.is(view.length, 0, 'view detached')
+  ctx.free()
+})
+
+test('embedBatch matches per-text embeddings', { skip: !loaded }, function (t) {
+  const ctx = new LlamaContext(loaded.model, { contextSize: 2048, embeddings: true, poolingType: 1, sequences: 8 })
+  const texts = ['The cat sat on the mat.', 'A feline rested on the rug.', 'Machine learning is fun.']
+  const dim = loaded.model.embeddingDimension
+
+  const batch = ctx.embedBatch(texts)
+  t.ok(batch instanceof Float32Array, 'returns Float32Array')
+  t.is(batch.length, texts.length * dim, 'N x dimension floats')
+
+  for (let i = 0; i < texts.length; i++) {
+    ctx.clearMemory()
+    const single = embed(loaded.model, ctx, texts[i])
+    const sim = cosineSimilarity(single, batch.subarray(i * dim, (i + 1) * dim))
+    t.ok(sim > 0.999, `text ${i} similarity ${sim.toFixed(6)} > 0.999`)
+  }
+  ctx.free()
+})
+
+test('embedBatch spans multiple decodes when inputs exceed sequences', { skip: !loaded }, function (t) {
+  const ctx = new LlamaContext(loaded.model, { contextSize: 2048, embeddings: true, poolingType: 1, sequences: 2 })
+  const texts = ['one', 'two', 'three', 'four', 'five']
+  const out = ctx.embedBatch(texts.map((text) => loaded.model.tokenize(text, true)), { normalize: true })
+  const dim = loaded.model.embeddingDimension
+  t.is(out.length, texts.length * dim, 'all inputs embedded')
+
+  let norm = 0
+  for (let i = 0; i < dim; i++) norm += out[i] * out[i]
+  t.ok(Math.abs(norm - 1) < 1e-4, 'normalize produces unit vectors')
+  ctx.free()
+})
+
 test('cleanup', { skip: !loaded }, function (t) {
   loaded.model.free()
   t.pass('model freed')
@@ -1,5 +1,5 @@
 const test = require('brittle')
-const { LlamaContext, LlamaSampler, generate } = require('..')
+const { LlamaContext, LlamaSampler, generate, generateStream } = require('..')
 const { GENERATION_MODEL, tryLoadModel } = require('./helpers')
 
 const loaded = tryLoadModel(GENERATION_MODEL)
@@ -35,6 +35,130 @@ test('respects maxTokens', { skip: !loaded }, function (t) {
   ctx.free()
 })
 
+test('generate stops at a stop sequence', { skip: !loaded }, function (t) {
+  const ctx = new LlamaContext(loaded.model, { contextSize: 2048 })
+  const sampler = new LlamaSampler(loaded.model, { temp: 0 })
+  const full = generate(loaded.model, ctx, sampler, 'Count: 1, 2, 3,', 16)
+
+  ctx.clearMemory()
+  const stopAt = full.trim().split(' ')[0]
+  const output = generate(loaded.model, ctx, sampler, 'Count: 1, 2, 3,', { maxTokens: 16, stop: [stopAt] })
+  t.ok(!output.includes(stopAt), `output "${output}" excludes stop sequence "${stopAt}"`)
+  sampler.free()
+  ctx.free()
+})
+
+test('generateStream chunks concatenate to the final text', { skip: !loaded }, async function (t) {
+  const ctx = new LlamaContext(loaded.model, { contextSize: 2048 })
+  const sampler = new LlamaSampler(loaded.model, { temp: 0 })
+
+  const stream = generateStream(loaded.model, ctx, sampler, 'The quick brown fox', { maxTokens: 16 })
+  let streamed = ''
+  let next
+  while (!(next = await stream.next()).done) streamed += next.value
+
+  const result = next.value
+  t.is(streamed, result.text, 'streamed text matches result')
+  t.ok(result.tokens.length <= 16, 'respects maxTokens')
+  t.ok(['eog', 'stop', 'length'].includes(result.stopReason), `stopReason: ${result.stopReason}`)
+
+  sampler.free()
+  ctx.free()
+})
+
+test('generateStream matches synchronous generate', { skip: !loaded }, async function (t) {
+  const ctx = new LlamaContext(loaded.model, { contextSize: 2048 })
+  const sampler = new LlamaSampler(loaded.model, { temp: 0 })
+  const expected = generate(loaded.model, ctx, sampler, 'Once upon a time', 16)
+
+  ctx.clearMemory()
+  let streamed = ''
+  for await (const chunk of generateStream(loaded.model, ctx, sampler, 'Once upon a time', { maxTokens: 16 })) {
+    streamed += chunk
+  }
+  t.is(streamed, expected, 'same output with greedy sampling')
+
+  sampler.free()
+  ctx.free()
+})
+
+test('leaving generateStream early cancels it', { skip: !loaded }, async function (t) {
+  const ctx = new LlamaContext(loaded.model, { contextSize: 2048 })
+  const sampler = new LlamaSampler(loaded.model, { temp: 0 })
+
+  let chunks = 0
+  for await (const chunk of generateStream(loaded.model, ctx, sampler, 'Once upon a time', { maxTokens: 1024 })) {
+    if (chunk) chunks++
+    break
+  }
+  t.is(chunks, 1, 'got a chunk before breaking')
+
+  // Reusable as soon as the loop exits, without waiting for maxTokens
+  ctx.clearMemory()
+  const output = generate(loaded.model, ctx, sampler, 'Once upon a time', 4)
+  t.ok(typeof output === 'string', 'context and sampler are free')
+
+  // return() on a running stream resolves with the output so far
+  ctx.clearMemory()
+  const stream = generateStream(loaded.model, ctx, sampler, 'Once upon a time', { maxTokens: 1024 })
+  await stream.next()
+  const { done } = await stream.return()
+  t.ok(done, 'iterator finished')
+  ctx.clearMemory()
+  t.pass('context free after return()')
+
+  sampler.free()
+  ctx.free()
+})
+
+test('speculative generation with a draft matches plain generation', { skip: !loaded }, async function (t) {
+  const ctx = new LlamaContext(loaded.model, { contextSize: 2048 })
+  const sampler = new LlamaSampler(loaded.model, { temp: 0 })
+  const expected = generate(loaded.model, ctx, sampler, 'Once upon a time', 32)
+
+  // The model drafting for itself should have nearly every guess accepted
+  ctx.clearMemory()
+  const draft = new LlamaContext(loaded.model, { contextSize: 2048 })
+  const stream = generateStream(loaded.model, ctx, sampler, 'Once upon a time', { maxTokens: 32, draft, draftTokens: 4 })
+  let next
+  while (!(next = await stream.next()).done);
+
+  const result = next.value
+  t.is(result.text, expected, 'same output with greedy sampling')
+  t.ok(result.drafted > 0, `drafted ${result.drafted}`)
+  t.ok(result.accepted > result.drafted / 2, `accepted ${result.accepted}`)
+
+  ctx.clearMemory()
+  const sync = generate(loaded.model, ctx, sampler, 'Once upon a time', { maxTokens: 32, draft, draftTokens: 4, result: true })
+  t.is(sync.text, expected, 'synchronous too')
+  t.ok(sync.drafted > 0, `synchronous drafted ${sync.drafted}`)
+  t.ok(sync.accepted > sync.drafted / 2, `synchronous accepted ${sync.accepted}`)
+
+  draft.free()
+  sampler.free()
+  ctx.free()
+})
+
+test('prompt lookup speculation matches plain generation', { skip: !loaded }, async function (t) {
+  const ctx = new LlamaContext(loaded.model, { contextSize: 2048 })
+  const sampler = new LlamaSampler(loaded.model, { temp: 0 })
+  const prompt = 'Repeat exactly: the red fox jumps over the brown log.\nthe red fox'
+  const expected = generate(loaded.model, ctx, sampler, prompt, 24)
+
+  ctx.clearMemory()
+  const stream = generateStream(loaded.model, ctx, sampler, prompt, { maxTokens: 24, lookup: 2, draftTokens: 6 })
+  let next
+  while (!(next = await stream.next()).done);
+
+  const result = next.value
+  t.is(result.text, expected, 'same output with greedy sampling')
+  t.ok(result.drafted > 0, `drafted ${result.drafted}`)
+  t.ok(result.accepted <= result.drafted, `accepted ${result.accepted}`)
+
+  sampler.free()
+  ctx.free()
+})
+
 test('cleanup', { skip: !loaded }, function (t) {
   loaded.model.free()
   t.pass('model freed')
@@ -1,5 +1,5 @@
 const test = require('brittle')
-const { readGgufMeta, getModelName } = require('..')
+const { readGgufMeta, readGgufMetaAll, getModelName } = require('..')
 const { GENERATION_MODEL, tryLoadModel } = require('./helpers')
 
 const loaded = tryLoadModel(GENERATION_MODEL)
@@ -15,6 +15,32 @@ test('readGgufMeta returns null for unknown key', { skip: !loaded }, function (t
   t.is(val, null, 'returns null')
 })
 
+test('readGgufMeta returns null for non-string values', { skip: !loaded }, function (t) {
+  const arch = readGgufMeta(loaded.modelPath, 'general.architecture')
+  t.is(readGgufMeta(loaded.modelPath, `${arch}.context_length`), null, 'number key returns null')
+})
+
+test('readGgufMetaAll returns typed values', { skip: !loaded }, function (t) {
+  const meta = readGgufMetaAll(loaded.modelPath)
+  const arch = meta['general.architecture']
+  t.ok(typeof arch === 'string', 'architecture is a string')
+  t.is(meta[`${arch}.context_length`], loaded.model.trainingContextSize, 'context length is a number')
+  t.absent('tokenizer.ggml.tokens' in meta, 'vocab skipped by default')
+  t.alike(readGgufMetaAll(loaded.modelPath), meta, 'repeated reads agree')
+})
+
+test('readGgufMetaAll returns requested keys in full', { skip: !loaded }, function (t) {
+  const meta = readGgufMetaAll(loaded.modelPath, { keys: ['tokenizer.ggml.tokens', 'general.name', 'missing.key'] })
+  t.alike(Object.keys(meta).sort(), ['general.name', 'tokenizer.ggml.tokens'], 'only requested keys')
+  t.ok(meta['tokenizer.ggml.tokens'].length > 64, 'vocab returned in full')
+  t.is(meta['tokenizer.ggml.tokens'][loaded.model.tokenize('Hello', false)[0]].length > 0, true, 'tokens are strings')
+})
+
+test('readGgufMetaAll returns null for non-GGUF files', function (t) {
+  t.is(readGgufMetaAll(__filename), null, 'returns null')
+  t.is(readGgufMetaAll('/nonexistent/model.gguf'), null, 'missing file returns null')
+})
+
 test('getModelName works', { skip: !loaded }, function (t) {
   const name = getModelName(loaded.modelPath)
   t.ok(typeof name === 'string' || name === null, 'returns string or null')
@@ -1,5 +1,5 @@
 const { LlamaModel, setQuiet } = require('..')
-const { getModelInfo } = require('../lib/ollama-models')
+const { getModelInfo, getAdapterPaths, listModels } = require('../lib/ollama-models')
 
 setQuiet(true)
 
@@ -26,9 +26,21 @@ function tryLoadModel (name, opts = {}) {
   }
 }
 
+// First installed Ollama model that ships a LoRA adapter layer
+function findAdapterModel () {
+  for (const name of listModels()) {
+    const info = getModelInfo(name)
+    if (!info || !info.path) continue
+    const adapters = getAdapterPaths(name)
+    if (adapters.length > 0) return { modelPath: info.path, adapterPath: adapters[0] }
+  }
+  return null
+}
+
 module.exports = {
   GENERATION_MODEL,
   EMBEDDING_MODEL,
   resolveModel,
-  tryLoadModel
+  tryLoadModel,
+  findAdapterModel
 }
@@ -1,6 +1,6 @@
 const test = require('brittle')
 const { LlamaModel } = require('..')
-const { GENERATION_MODEL, tryLoadModel } = require('./helpers')
+const { GENERATION_MODEL, resolveModel, tryLoadModel } = require('./helpers')
 
 const loaded = tryLoadModel(GENERATION_MODEL)
 
@@ -25,6 +25,46 @@ test('tokenize/detokenize roundtrip', { skip: !loaded }, function (t) {
   }
 })
 
+test('Detokenizer streams multibyte text one token at a time', { skip: !loaded }, function (t) {
+  const { Detokenizer } = require('..')
+  const text = '日本語 emoji: 🎉🚀 done'
+  const tokens = loaded.model.tokenize(text, false)
+  const detok = new Detokenizer(loaded.model)
+
+  let out = ''
+  for (const token of tokens) {
+    const piece = detok.push(token)
+    t.absent(piece.includes('\uFFFD'), 'no broken characters')
+    out += piece
+  }
+  out += detok.flush()
+  t.is(out, loaded.model.detokenize(tokens), 'matches detokenize')
+
+  t.is(detok.push(tokens) + detok.flush(), out, 'accepts Int32Array after flush')
+  detok.free()
+})
+
+test('tokenizeBatch matches tokenize per text', { skip: !loaded }, function (t) {
+  const texts = ['Hello', '', 'The quick brown fox jumps over the lazy dog.', 'ünïcödé ✓']
+  const expected = texts.map((text) => loaded.model.tokenize(text, true))
+
+  for (const threads of [1, 3]) {
+    const { tokens, offsets } = loaded.model.tokenizeBatch(texts, { threads })
+    t.is(offsets.length, texts.length + 1, 'one offset per text plus end')
+    for (let i = 0; i < texts.length; i++) {
+      t.alike(tokens.subarray(offsets[i], offsets[i + 1]), expected[i], `text ${i} with ${threads} threads`)
+    }
+  }
+})
+
+test('tokenizeBatch writes into a caller buffer', { skip: !loaded }, function (t) {
+  const out = new Int32Array(1024)
+  const { tokens, offsets } = loaded.model.tokenizeBatch(['Hello', 'world'], { out, addSpecial: false })
+  t.is(tokens.buffer, out.buffer, 'uses caller buffer')
+  t.is(tokens.length, offsets[2], 'length is token count')
+  t.exception(() => loaded.model.tokenizeBatch(['Hello world'], { out: new Int32Array(1) }), 'rejects short buffer')
+})
+
 test('embeddingDimension is a number', { skip: !loaded }, function (t) {
   const dim = loaded.model.embeddingDimension
   t.ok(typeof dim === 'number', 'is a number')
@@ -51,6 +91,68 @@ test('isEogToken returns boolean', { skip: !loaded }, function (t) {
   t.ok(typeof loaded.model.isEogToken(0) === 'boolean', 'returns boolean')
 })
 
+test('vocabOnly model tokenizes like the full model', { skip: !loaded }, function (t) {
+  const vocab = new LlamaModel(resolveModel(GENERATION_MODEL), { vocabOnly: true })
+  t.alike(vocab.tokenize('Hello, world!', true), loaded.model.tokenize('Hello, world!', true), 'same tokens')
+  vocab.free()
+})
+
+test('onProgress reports load progress and can cancel', { skip: !loaded }, function (t) {
+  const path = resolveModel(GENERATION_MODEL)
+
+  const seen = []
+  const model = new LlamaModel(path, { useMlock: false, onProgress: (p) => { seen.push(p) } })
+  t.ok(seen.length > 0, 'progress reported')
+  t.is(seen[seen.length - 1], 1, 'ends at 1')
+  model.free()
+
+  t.exception(() => new LlamaModel(path, { onProgress: () => false }), /cancelled/, 'returning false cancels')
+})
+
+test('tensorOverrides rejects unknown buffer types', { skip: !loaded }, function (t) {
+  t.exception(() => new LlamaModel(resolveModel(GENERATION_MODEL), { tensorOverrides: { '.*': 'NOPE' } }), /buffer type/)
+})
+
+test('loading the same file shares one model', { skip: !loaded }, function (t) {
+  const { getModelCacheStats } = require('..')
+  const path = resolveModel(GENERATION_MODEL)
+  const before = getModelCacheStats()
+
+  const again = new LlamaModel(path)
+  const stats = getModelCacheStats()
+  t.is(stats.hits, before.hits + 1, 'second load is a cache hit')
+  t.is(stats.models.length, before.models.length, 'no new model registered')
+  t.ok(stats.models.some((m) => m.refs >= 2), 'model has two handles')
+
+  again.free()
+  t.ok(loaded.model.tokenize('Hello', true).length > 0, 'first handle still works after the second is freed')
+
+  const separate = new LlamaModel(path, { shared: false })
+  t.is(getModelCacheStats().models.length, before.models.length, 'shared: false bypasses the registry')
+  separate.free()
+})
+
+test('idle models stay cached within the budget', { skip: !loaded }, function (t) {
+  const { getModelCacheStats, setModelCacheBudget, clearModelCache } = require('..')
+  const path = resolveModel(GENERATION_MODEL)
+
+  const vocab = new LlamaModel(path, { vocabOnly: true })
+  const count = getModelCacheStats().models.length
+
+  setModelCacheBudget(Number.MAX_SAFE_INTEGER)
+  vocab.free()
+  t.is(getModelCacheStats().models.length, count, 'idle model kept')
+
+  const hits = getModelCacheStats().hits
+  const reloaded = new LlamaModel(path, { vocabOnly: true })
+  t.is(getModelCacheStats().hits, hits + 1, 'reload hits the idle entry')
+  reloaded.free()
+
+  clearModelCache()
+  t.is(getModelCacheStats().models.length, count - 1, 'clearModelCache evicts idle models')
+  setModelCacheBudget(0)
+})
+
 test('constructor throws on bad path', function (t) {
   t.exception(() => new LlamaModel('/nonexistent/model.gguf'), 'throws on bad path')
 })
@@ -98,6 +98,39 @@ test('reranking produces correct ordering for multiple documents', { skip: !load
   ctx.free()
 })
 
+test('ctx.rerank scores all documents in one call', { skip: !loaded }, function (t) {
+  const ctx = new LlamaContext(loaded.model, { contextSize: 2048, embeddings: true, poolingType: 4, sequences: 8 })
+
+  const query = 'How does photosynthesis work?'
+  const docs = [
+    'The stock market experienced significant volatility last quarter due to rising interest rates.',
+    'Photosynthesis converts sunlight, water, and carbon dioxide into glucose and oxygen in plant cells.',
+    'Plants are green because of chlorophyll, a pigment found in their leaves.'
+  ]
+
+  const scores = ctx.rerank(query, docs)
+  t.ok(scores instanceof Float32Array, 'returns Float32Array')
+  t.is(scores.length, docs.length, 'one score per document')
+  t.ok(scores[1] > scores[0], `best match (${scores[1].toFixed(4)}) > worst match (${scores[0].toFixed(4)})`)
+
+  const again = ctx.rerank(query, docs)
+  for (let i = 0; i < docs.length; i++) {
+    t.ok(Math.abs(scores[i] - again[i]) < 1e-4, `score ${i} is consistent across calls`)
+  }
+
+  const top = ctx.rerank(query, docs, { topK: 2 })
+  t.is(top.indices.length, 2, 'topK limits results')
+  t.is(top.indices[0], 1, 'best document first')
+  t.ok(top.scores[0] >= top.scores[1], 'scores sorted descending')
+  ctx.free()
+})
+
+test('ctx.rerank requires rank pooling', { skip: !loaded }, function (t) {
+  const ctx = new LlamaContext(loaded.model, { contextSize: 512, embeddings: true, poolingType: 1 })
+  t.exception(() => ctx.rerank('query', ['doc']), /rank/, 'throws without rank pooling')
+  ctx.free()
+})
+
 test('cleanup', { skip: !loaded }, function (t) {
   loaded.model.free()
   t.pass('model freed')
@@ -31,6 +31,35 @@ test('accept does not throw', { skip: !loaded }, function (t) {
   ctx.free()
 })
 
+test('getPerf counts samples', { skip: !loaded }, function (t) {
+  const ctx = new LlamaContext(loaded.model, { contextSize: 512 })
+  const sampler = new LlamaSampler(loaded.model, { temp: 0 })
+  ctx.decode(loaded.model.tokenize('Hello', true))
+  sampler.sample(ctx, -1)
+  sampler.sample(ctx, -1)
+  t.is(sampler.getPerf().samples, 2, 'two samples')
+  sampler.resetPerf()
+  t.is(sampler.getPerf().samples, 0, 'reset')
+  sampler.free()
+  ctx.free()
+})
+
+test('getMetrics counts tokenization', { skip: !loaded }, function (t) {
+  const { getMetrics } = require('..')
+  const before = getMetrics()
+  const tokens = loaded.model.tokenize('Hello world', false)
+  const after = getMetrics()
+  t.is(after.tokenizeCalls - before.tokenizeCalls, 1, 'one call')
+  t.is(after.tokenizeTexts - before.tokenizeTexts, 1, 'one text')
+  t.is(after.tokenizeBytes - before.tokenizeBytes, 11, 'input bytes')
+  t.is(after.tokenizeTokens - before.tokenizeTokens, tokens.length, 'output tokens')
+
+  loaded.model.tokenizeBatch(['Hello', 'world', 'again'])
+  const batch = getMetrics()
+  t.is(batch.tokenizeCalls - after.tokenizeCalls, 1, 'a batch is one call')
+  t.is(batch.tokenizeTexts - after.tokenizeTexts, 3, 'of three texts')
+})
+
 test('free() is idempotent', { skip: !loaded }, function (t) {
   const sampler = new LlamaSampler(loaded.model, { temp: 0 })
   sampler.free()
@@ -0,0 +1,104 @@
+const test = require('brittle')
+const { LlamaContext, LlamaSampler, Scheduler, generate } = require('..')
+const { GENERATION_MODEL, tryLoadModel } = require('./helpers')
+
+const loaded = tryLoadModel(GENERATION_MODEL)
+
+test('constructor requires LlamaModel', function (t) {
+  t.exception(() => new Scheduler({}), 'throws on non-model')
+})
+
+test('concurrent requests match sequential greedy output', { skip: !loaded }, async function (t) {
+  const prompts = ['The capital of France is', 'Once upon a time', 'def fibonacci(n):']
+
+  const ctx = new LlamaContext(loaded.model, { contextSize: 1024 })
+  const expected = prompts.map((prompt) => {
+    ctx.clearMemory()
+    const sampler = new LlamaSampler(loaded.model, { temp: 0 })
+    const text = generate(loaded.model, ctx, sampler, prompt, 12)
+    sampler.free()
+    return text
+  })
+  ctx.free()
+
+  const scheduler = new Scheduler(loaded.model, { contextSize: 4096, sequences: 4 })
+  const samplers = prompts.map(() => new LlamaSampler(loaded.model, { temp: 0 }))
+  const results = await Promise.all(prompts.map((prompt, i) => scheduler.submit(samplers[i], prompt, { maxTokens: 12 })))
+
+  for (let i = 0; i < prompts.length; i++) {
+    t.is(results[i].text, expected[i], `request ${i} matches sequential output`)
+  }
+  t.is(scheduler.pending, 0, 'no pending requests')
+
+  for (const sampler of samplers) sampler.free()
+  scheduler.free()
+})
+
+test('requests beyond the sequence count wait for a free slot', { skip: !loaded }, async function (t) {
+  const scheduler = new Scheduler(loaded.model, { contextSize: 2048, sequences: 2 })
+  const samplers = [0, 1, 2, 3, 4].map(() => new LlamaSampler(loaded.model, { temp: 0 }))
+  const results = await Promise.all(samplers.map((sampler, i) => scheduler.submit(sampler, `Item ${i}:`, { maxTokens: 4 })))
+
+  t.is(results.length, 5, 'all requests completed')
+  for (const result of results) t.ok(result.tokens.length <= 4, 'respects maxTokens')
+
+  for (const sampler of samplers) sampler.free()
+  scheduler.free()
+})
+
+test('requests can join while a step is in flight', { skip: !loaded }, async function (t) {
+  const ctx = new LlamaContext(loaded.model, { contextSize: 1024 })
+  const sampler = new LlamaSampler(loaded.model, { temp: 0 })
+  const expected = generate(loaded.model, ctx, sampler, 'Once upon a time', 8)
+  sampler.free()
+  ctx.free()
+
+  const scheduler = new Scheduler(loaded.model, { contextSize: 2048, sequences: 2 })
+  const first = new LlamaSampler(loaded.model, { temp: 0 })
+  const second = new LlamaSampler(loaded.model, { temp: 0 })
+
+  // submit() starts the first step before returning
+  const early = scheduler.submit(first, 'The capital of France is', { maxTokens: 16 })
+  t.ok(scheduler._running, 'a step is in flight')
+  const late = scheduler.submit(second, 'Once upon a time', { maxTokens: 8 })
+
+  // And once the run is underway
+  const tokens = loaded.model.tokenize('Item 1:', true)
+  const third = new LlamaSampler(loaded.model, { temp: 0 })
+  await new Promise((resolve) => setTimeout(resolve, 0))
+  const later = scheduler.submit(third, tokens, { maxTokens: 4 })
+
+  const results = await Promise.all([early, late, later])
+  t.is(results[1].text, expected, 'late request matches sequential output')
+  t.ok(results[2].tokens.length <= 4, 'later request completed')
+
+  first.free()
+  second.free()
+  third.free()
+  scheduler.free()
+})
+
+test('sampler is busy while its request runs', { skip: !loaded }, async function (t) {
+  const scheduler = new Scheduler(loaded.model, { contextSize: 1024, sequences: 2 })
+  const sampler = new LlamaSampler(loaded.model, { temp: 0 })
+  const pending = scheduler.submit(sampler, 'Hello', { maxTokens: 4 })
+  t.exception(() => scheduler.submit(sampler, 'Hello'), /Sampler is busy/, 'cannot submit the same sampler twice')
+  await pending
+  sampler.free()
+  scheduler.free()
+})
+
+test('free() rejects pending requests', { skip: !loaded }, async function (t) {
+  const scheduler = new Scheduler(loaded.model, { contextSize: 1024, sequences: 2 })
+  const sampler = new LlamaSampler(loaded.model, { temp: 0 })
+  const pending = scheduler.submit(sampler, 'Hello', { maxTokens: 64 })
+  scheduler.free()
+  await t.exception(pending, /Scheduler has been freed/, 'request rejected')
+  t.is(scheduler.pending, 0, 'no pending requests')
+  sampler.free()
+})
+
+test('cleanup', { skip: !loaded }, function (t) {
+  loaded.model.free()
+  t.pass('model freed')
+})
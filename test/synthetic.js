@@ -0,0 +1,57 @@
+const test = require('brittle')
+const { LlamaModel, LlamaContext, readGgufMetaAll } = require('..')
+const { syntheticModel, syntheticAdapter } = require('../bench/synthetic')
+
+const opts = { embd: 64, layers: 2, ff: 128 }
+
+test('synthetic benchmark model loads and decodes', function (t) {
+  const path = syntheticModel(opts)
+
+  const meta = readGgufMetaAll(path)
+  t.is(meta['general.architecture'], 'llama', 'architecture')
+  t.is(meta['llama.embedding_length'], 64, 'embedding length')
+
+  const model = new LlamaModel(path, { shared: false })
+  const text = 'the quick brown fox'
+  const tokens = model.tokenize(text, false)
+  t.ok(tokens.length < text.length, 'word pieces merge')
+  t.is(model.detokenize(tokens).trimStart(), text, 'roundtrip (SentencePiece adds a leading space)')
+
+  const ctx = new LlamaContext(model, { contextSize: 128 })
+  ctx.decode(model.tokenize(text, true))
+  t.is(ctx.getLogits().length, meta['llama.vocab_size'], 'logits over the vocab')
+  ctx.free()
+  model.free()
+})
+
+test('adapter applies and outlives the handle it was loaded with', function (t) {
+  const path = syntheticModel(opts)
+  const first = new LlamaModel(path)
+  const second = new LlamaModel(path)
+  const adapter = first.loadAdapter(syntheticAdapter(opts))
+  const tokens = first.tokenize('the lazy dog', true)
+
+  const logits = (adapters) => {
+    const ctx = new LlamaContext(second, { contextSize: 128 })
+    if (adapters) t.ok(ctx.setAdapters(adapters), 'adapters changed')
+    ctx.decode(tokens)
+    const out = Float32Array.from(ctx.getLogits())
+    ctx.free()
+    return out
+  }
+
+  const base = logits()
+  // Freeing the loading handle leaves the shared weights and the adapter
+  first.free()
+  const adapted = logits([adapter])
+  t.not(adapted.join(), base.join(), 'adapter changes the logits')
+  t.alike(logits([{ adapter, scale: 0 }]), base, 'scale 0 matches the base model')
+
+  const ctx = new LlamaContext(second, { contextSize: 128 })
+  ctx.setAdapters([adapter])
+  adapter.free()
+  ctx.decode(tokens)
+  t.alike(Float32Array.from(ctx.getLogits()), adapted, 'contexts keep a freed adapter')
+  ctx.free()
+  second.free()
+})